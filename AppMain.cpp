@@ -1,1181 +1,9237 @@
-#include <GLEW/glew.h>
-#include <GLFW/glfw3.h>
-#include <iostream>
-
-// GLM headers
-#include <glm/glm/glm.hpp>
-#include <glm/glm/gtc/matrix_transform.hpp>
-#include <glm/glm/gtc/type_ptr.hpp>
-
-#include<SOIL2/SOIL2.h>
-
-using namespace std;
-
-
-int width = 640, height = 480;
-const double PI = 3.14159;
-const float toRadians = PI / 180.0f;
-
-// Input Callback Function prototypes
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
-void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
-
-// Decalre global view matrix
-glm::mat4 viewMatrix;
-
-// intialize global fov
-GLfloat fov = 45.0f;
-
-// Define Camera Attributes
-glm::vec3 cameraPosition = glm::vec3(0.0f, 1.25f, 6.0f);
-glm::vec3 target = glm::vec3(0.0f, 0.0f, 0.0f);
-glm::vec3 cameraDirection = glm::normalize(cameraPosition - target);
-glm::vec3 worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
-glm::vec3 cameraRight = glm::normalize(glm::cross(worldUp, cameraDirection));
-glm::vec3 cameraUp = glm::normalize(glm::cross(cameraDirection, cameraRight));
-glm::vec3 cameraFront = glm::normalize(glm::vec3(0.0f, 0.0f, -1.0f));
-
-// Declare get target prototype
-glm::vec3 getTarget();
-
-// Camera transformation prototype (event listener)
-void TransformCamera();
-
-// Boolean array for keys and mouse buttons
-bool keys[1024];
-bool mouseButtons[3];
-
-// Booleans to check camera transformation
-bool isPanning = false;
-bool isOrbiting = false;
-bool isPerspective = true;
-
-// Radius, Pitch, and Yaw
-GLfloat radius = 6.0f;
-GLfloat rawYaw = 0.0f;
-GLfloat rawPtich = 0.0f;
-GLfloat degYaw;
-GLfloat degPitch;
-
-GLfloat deltaTime = 0.0f;
-GLfloat lastFrame = 0.0f;
-GLfloat lastUse = 0.0f;
-
-GLfloat lastX = width / 2;
-GLfloat lastY = height / 2;
-GLfloat xChange = 0.0f;
-GLfloat yChange = 0.0f;
-
-// Detect initial mouse movement
-bool firstMouseMove = true;
-
-void initCamera();
-
-// Light source position
-glm::vec3 lightPosition(0.0f, -2.0f, 5.0f);
-glm::vec3 lightPosition1(-2.0f, 0.0f, -5.0f);
-
-// Draw Primitive(s)
-void draw(GLsizei indices)
-{
-	GLenum mode = GL_TRIANGLES;
-	glDrawElements(mode, indices, GL_UNSIGNED_BYTE, nullptr);
-
-}
-
-// Create and Compile Shaders
-static GLuint CompileShader(const string& source, GLuint shaderType)
-{
-	// Create Shader object
-	GLuint shaderID = glCreateShader(shaderType);
-	const char* src = source.c_str();
-
-	// Attach source code to Shader object
-	glShaderSource(shaderID, 1, &src, nullptr);
-
-	// Compile Shader
-	glCompileShader(shaderID);
-
-	// Return ID of Compiled shader
-	return shaderID;
-
-}
-
-// Create Program Object
-static GLuint CreateShaderProgram(const string& vertexShader, const string& fragmentShader)
-{
-	// Compile vertex shader
-	GLuint vertexShaderComp = CompileShader(vertexShader, GL_VERTEX_SHADER);
-
-	// Compile fragment shader
-	GLuint fragmentShaderComp = CompileShader(fragmentShader, GL_FRAGMENT_SHADER);
-
-	// Create program object
-	GLuint shaderProgram = glCreateProgram();
-
-	// Attach vertex and fragment shaders to program object
-	glAttachShader(shaderProgram, vertexShaderComp);
-	glAttachShader(shaderProgram, fragmentShaderComp);
-
-	// Link shaders to create executable
-	glLinkProgram(shaderProgram);
-
-	// Delete compiled vertex and fragment shaders
-	glDeleteShader(vertexShaderComp);
-	glDeleteShader(fragmentShaderComp);
-
-	// Return Shader Program
-	return shaderProgram;
-
-}
-
-
-int main(void)
-{
-
-	GLFWwindow* window;
-
-	/* Initialize the library */
-	if (!glfwInit())
-		return -1;
-
-	/* Create a windowed mode window and its OpenGL context */
-	window = glfwCreateWindow(width, height, "Main Window", NULL, NULL);
-	if (!window)
-	{
-		glfwTerminate();
-		return -1;
-	}
-
-	// Set Input Callback Functions
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetScrollCallback(window, scroll_callback);
-	glfwSetCursorPosCallback(window, cursor_position_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-
-	/* Make the window's context current */
-	glfwMakeContextCurrent(window);
-
-	// Initialize GLEW
-	if (glewInit() != GLEW_OK)
-		cout << "Error!" << endl;
-
-	// Enable Depth Buffer
-	glEnable(GL_DEPTH_TEST);
-
-	// Wireframe mode
-	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-
-	// CREATE AND BIND LAMP START *******************************************************
-
-	GLfloat lampVertices[] = {
-
-		// Triangle 1
-		-0.5, -0.5, 0.0, // index 0
-
-		-0.5, 0.5, 0.0, // index 1
-
-		0.5, -0.5, 0.0,  // index 2	
-
-		// Triangle 2	
-		0.5, 0.5, 0.0  // index 3	
-
-	};
-
-	// Define element indices
-	GLubyte lampIndices[] = {
-		0, 1, 2,
-		1, 2, 3
-	};
-
-	// Plane Transforms
-	glm::vec3 lampPlanePositions[] = {
-		glm::vec3(0.0f,  0.0f,  0.5f),
-		glm::vec3(0.5f,  0.0f,  0.0f),
-		glm::vec3(0.0f,  0.0f,  -0.5f),
-		glm::vec3(-0.5f, 0.0f,  0.0f),
-		glm::vec3(0.0f, 0.5f,  0.0f),
-		glm::vec3(0.0f, -0.5f,  0.0f)
-	};
-
-	glm::float32 lampPlaneRotations[] = {
-		0.0f, 90.0f, 180.0f, -90.0f, -90.f, 90.f
-	};
-
-	GLuint lampVBO, lampEBO, lampVAO;
-
-	glGenBuffers(1, &lampVBO); // Create VBO
-	glGenBuffers(1, &lampEBO); // Create EBO
-
-	glGenVertexArrays(1, &lampVAO); // Create VOA
-
-	glBindVertexArray(lampVAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, lampVBO); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lampEBO); // Select EBO
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(lampVertices), lampVertices, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(lampIndices), lampIndices, GL_STATIC_DRAW); // Load indices 
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-
-	glBindVertexArray(0);
-
-	// CREATE AND BIND LAMP END *******************************************************
-
-	// CREATE AND BIND LAPIS START *******************************************************
-	GLfloat verticesLapis[] = {
-
-		// Triangle 1
-		-0.25, -0.5, 0.435, // index 0
-		1.0, 0.0, 0.0, // red
-		0.0, 3.0,    // Texture UV left side near top
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		0.0, 0.25, 0.0, // index 1
-		0.0, 1.0, 0.0, // green
-		0.5, 3.435,      // Texture UV top middle
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		0.25, -0.5, 0.435,  // index 2	
-		0.0, 0.0, 1.0, // blue
-		1.0, 3.0,    // Texture UV right side near top
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		// Triangle 2 and 3
-		0.25, -3.0, 0.435,  // index 3
-		1.0, 0.0, 1.0, // purple
-		1.0, 0.0,      // Texture UV bottom right
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		-0.25, -3.0, 0.435,  // index 4
-		1.0, 0.0, 1.0, // purple
-		0.0, 0.0,       // Texture UV bottom left
-		0.0f, 0.0f, 1.0f // normal positive z
-
-	};
-
-	// Define element indices
-	GLubyte indicesLapis[] = {
-		0, 1, 2,
-		2, 4, 3,
-		2, 4, 0
-	};
-
-	// Plane roations for Y axis
-	glm::float32 planeRotationsYLapis[] = {
-		0.0f,
-		60.0f,
-		120.0f,
-		180.0f,
-		240.0f,
-		300.0f
-	};
-
-
-	GLuint VBOLapis, EBOLapis, VAOLapis;
-
-	glGenBuffers(1, &VBOLapis); // Create VBO
-	glGenBuffers(1, &EBOLapis); // Create EBO
-
-	glGenVertexArrays(1, &VAOLapis); // Create VOA
-	glBindVertexArray(VAOLapis);
-
-	// VBO and EBO Placed in User-Defined VAO
-	glBindBuffer(GL_ARRAY_BUFFER, VBOLapis); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOLapis); // Select EBO
-
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesLapis), verticesLapis, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesLapis), indicesLapis, GL_STATIC_DRAW); // Load indices 
-
-	// Specify attribute location and layout to GPU
-	
-	// location
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1);
-	// texture
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-	// normal
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(3);
-
-	glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
-
-	glm::vec3 LapisPosition(1.5f, 0.0f, 0.0f);
-
-	// CREATE AND BIND LAPIS END *******************************************************
-
-	// CREATE AND BIND PLANE START *******************************************************
-	GLfloat verticesPlane[] = {
-
-		// Triangle 1
-		-5.0, -3.0, 5.0, // index 0
-		0.57, 0.31, 0.14, // BROWN
-		0.0, 0.0,         // Texture UV bottom left
-		0.0f, 1.0f, 0.0f, // normal positive z
-
-		5.0, -3.0, -5.0, // index 1
-		0.57, 0.31, 0.14, // BROWN
-		1.0, 1.0,         // Texture UV top right
-		0.0f, 1.0f, 0.0f, // normal positive z
-
-		5.0, -3.0, 5.0,  // index 2	
-		0.57, 0.31, 0.14, // BROWN
-		1.0, 0.0,        // Texture UV bottom right
-		0.0f, 1.0f, 0.0f, // normal positive z
-
-		// Triangle 2
-		-5.0, -3.0, -5.0,  // index 3
-		0.57, 0.31, 0.14, // BROWN
-		0.0, 1.0,         // Texture UV top left
-		0.0f, 1.0f, 0.0f // normal positive z
-
-	};
-
-	// Define element indices
-	GLubyte PlaneIndices[] = {
-		0, 1, 2,
-		0, 1, 3
-	};
-
-	GLuint VBOPlane, EBOPlane, VAOPlane;
-
-	glGenBuffers(1, &VBOPlane); // Create VBO
-	glGenBuffers(1, &EBOPlane); // Create EBO
-
-	glGenVertexArrays(1, &VAOPlane); // Create VOA
-	glBindVertexArray(VAOPlane);
-
-	// VBO and EBO Placed in User-Defined VAO
-	glBindBuffer(GL_ARRAY_BUFFER, VBOPlane); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOPlane); // Select EBO
-
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesPlane), verticesPlane, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(PlaneIndices), PlaneIndices, GL_STATIC_DRAW); // Load indices 
-
-	// Specify attribute location and layout to GPU
-	// location
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1);
-	// texture
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-	// normal
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(3);
-
-	glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
-
-	// CREATE AND BIND PLANE END *******************************************************
-
-	// CREATE AND BIND CHARGER/LASER POINTER START (CYLINDER) 
-
-	GLfloat verticesCyl[] = {
-
-		// Triangle 1
-		-0.25, -0.5, 0.435, // index 0
-		1.0, 0.0, 0.0, // red
-		0.0, 3.0,    // Texture UV left side near top
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		0.0, -0.5, 0.0, // index 1
-		0.0, 1.0, 0.0, // green
-		0.5, 3.435,      // Texture UV top middle
-		0.0f, 1.0f, 0.0f, // normal positive y
-
-		0.25, -0.5, 0.435,  // index 2	
-		0.0, 0.0, 1.0, // blue
-		1.0, 3.0,    // Texture UV right side near top
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		// Triangle 2 and 3
-		0.25, -3.0, 0.435,  // index 3
-		1.0, 0.0, 1.0, // purple
-		1.0, 0.0,      // Texture UV bottom right
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		-0.25, -3.0, 0.435,  // index 4
-		1.0, 0.0, 1.0, // purple
-		0.0, 0.0,       // Texture UV bottom left
-		0.0f, 0.0f, 1.0f // normal positive z
-
-	};
-
-	// Define element indices
-	GLubyte indicesCyl[] = {
-		0, 1, 2,
-		2, 4, 3,
-		2, 4, 0
-	};
-
-	// Plane roations for Y axis
-	glm::float32 planeRotationsYCyl[] = {
-		0.0f,
-		60.0f,
-		120.0f,
-		180.0f,
-		240.0f,
-		300.0f
-	};
-
-
-	GLuint VBOCyl, EBOCyl, VAOCyl;
-
-	glGenBuffers(1, &VBOCyl); // Create VBO
-	glGenBuffers(1, &EBOCyl); // Create EBO
-
-	glGenVertexArrays(1, &VAOCyl); // Create VOA
-	glBindVertexArray(VAOCyl);
-
-	// VBO and EBO Placed in User-Defined VAO
-	glBindBuffer(GL_ARRAY_BUFFER, VBOCyl); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOCyl); // Select EBO
-
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesCyl), verticesCyl, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesCyl), indicesCyl, GL_STATIC_DRAW); // Load indices 
-
-	// Specify attribute location and layout to GPU
-
-	// location
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1);
-	// texture
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-	// normal
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(3);
-
-	glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
-
-	glm::vec3 chargerPosition(-1.5f, 0.0f, 0.0f);
-
-	// CREATE AND BIND CHARGER/LASER POINTER/LEGO NUB END (CYLINDER)
-
-	// CREATE AND BIND RECTANGULAR PRISM START
-
-	GLfloat verticesRec[] = {
-
-		// Triangle 1
-		-0.5, 0.0, 0.5, // index 0
-		1.0, 0.0, 0.0, // red
-		0.0, 0.0,    // Texture bottom left
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		-0.5, 0.5, 0.5, // index 1
-		0.0, 1.0, 0.0, // green
-		0.0, 1.0,      // Texture UV top left
-		0.0f, 0.0f, 0.0f, // normal positive z
-
-		0.5, 0.5, 0.5,  // index 2	
-		0.0, 0.0, 1.0, // blue
-		1.0, 1.0,    // Texture UV top right
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		// Triangle 2
-		0.5, 0.0, 0.5,  // index 3
-		1.0, 0.0, 1.0, // purple
-		1.0, 0.0,      // Texture UV bottom right
-		0.0f, 0.0f, 1.0f, // normal positive z
-
-		// Triangle 3
-		0.0, 0.5, 0.0,  // index 4
-		1.0, 0.0, 1.0, // purple
-		0.5, 1.0,      // Texture UV top middle
-		0.0f, 1.0f, 0.0f, // normal positive y
-
-
-
-	};
-
-	// Define element indices
-	GLubyte indicesRec[] = {
-		0, 1, 2,
-		0, 2, 3,
-		1, 4, 2
-	};
-
-	glm::float32 recPlaneRotations[] = {
-		0.0f, 90.0f, 180.0f, -90.0f
-	};
-
-	GLuint VBORec, EBORec, VAORec;
-
-	glGenBuffers(1, &VBORec); // Create VBO
-	glGenBuffers(1, &EBORec); // Create EBO
-
-	glGenVertexArrays(1, &VAORec); // Create VOA
-	glBindVertexArray(VAORec);
-
-	// VBO and EBO Placed in User-Defined VAO
-	glBindBuffer(GL_ARRAY_BUFFER, VBORec); // Select VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBORec); // Select EBO
-
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesRec), verticesRec, GL_STATIC_DRAW); // Load vertex attributes
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indicesRec), indicesRec, GL_STATIC_DRAW); // Load indices 
-
-	// Specify attribute location and layout to GPU
-
-	// location
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	// color
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1);
-	// texture
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
-	// normal
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(3);
-
-	glBindVertexArray(0); // Unbind VOA or close off (Must call VOA explicitly in loop)
-
-	// CREATE AND BIND RECTANGULAR PRISM END
-
-	// Load textures
-	int lapisTexWidth;
-	int lapisTexHeight;
-	int woodTexWidth;
-	int woodTexHeight;
-	int blackTexWidth;
-	int blackTexHeight;
-	int tanTexWidth;
-	int tanTexHeight;
-	int goldTexWidth;
-	int goldTexHeight;
-
-	unsigned char* lapisImage = SOIL_load_image("lapis.jpg", &lapisTexWidth, &lapisTexHeight, 0, SOIL_LOAD_RGB);
-	unsigned char* woodImage = SOIL_load_image("wood.png", &woodTexWidth, &woodTexHeight, 0, SOIL_LOAD_RGB);
-	unsigned char* blackImage = SOIL_load_image("grey.png", &blackTexWidth, &blackTexHeight, 0, SOIL_LOAD_RGB); // **************
-	unsigned char* tanImage = SOIL_load_image("tan.jpg", &tanTexWidth, &tanTexHeight, 0, SOIL_LOAD_RGB); // ******************
-	unsigned char* goldImage = SOIL_load_image("gold.png", &goldTexWidth, &goldTexHeight, 0, SOIL_LOAD_RGB);
-
-	// Generate Textures
-
-	GLuint lapisTexture;
-	glGenTextures(1, &lapisTexture);
-	glBindTexture(GL_TEXTURE_2D, lapisTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, lapisTexWidth, lapisTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, lapisImage);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(lapisImage);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	GLuint woodTexture;
-	glGenTextures(1, &woodTexture);
-	glBindTexture(GL_TEXTURE_2D, woodTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, woodTexWidth, woodTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, woodImage);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(woodImage);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	GLuint blackTexture;
-	glGenTextures(1, &blackTexture);
-	glBindTexture(GL_TEXTURE_2D, blackTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, blackTexWidth, blackTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, blackImage);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(blackImage);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	GLuint tanTexture;
-	glGenTextures(1, &tanTexture);
-	glBindTexture(GL_TEXTURE_2D, tanTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tanTexWidth, tanTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, tanImage);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(tanImage);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	GLuint goldTexture;
-	glGenTextures(1, &goldTexture);
-	glBindTexture(GL_TEXTURE_2D, goldTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, goldTexWidth, goldTexHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, goldImage);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(goldImage);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Vertex shader source code
-	string vertexShaderSource =
-		"#version 330 core\n"
-		"layout(location = 0) in vec3 vPosition;"
-		"layout(location = 1) in vec3 aColor;"
-		"layout(location = 2) in vec2 texCoord;"
-		"layout(location = 3) in vec3 normal;"
-		"out vec3 oColor;"
-		"out vec2 oTexCoord;"
-		"out vec3 oNormal;"
-		"out vec3 fragPos;"
-		"uniform mat4 model;"
-		"uniform mat4 view;"
-		"uniform mat4 projection;"
-		"void main()\n"
-		"{\n"
-		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
-		"oColor = aColor;"
-		"oTexCoord = texCoord;"
-		"oNormal = mat3(transpose(inverse(model))) * normal;"
-		"fragPos = vec3(model * vec4(vPosition, 1.0f));"
-		"}\n";
-
-	// Fragment shader source code
-	string fragmentShaderSource =
-		"#version 330 core\n"
-		"in vec3 oColor;"
-		"in vec2 oTexCoord;"
-		"in vec3 oNormal;"
-		"in vec3 fragPos;"
-		"out vec4 fragColor;"
-		"uniform sampler2D myTexture;"
-		"uniform vec3 objectColor;"
-		"uniform vec3 lightColor;"
-		"uniform vec3 lightPos;"
-		"uniform vec3 lightColor1;"
-		"uniform vec3 lightPos1;"
-		"uniform vec3 viewPos;"
-		"void main()\n"
-		"{\n"
-		"// Ambient\n"
-		"float ambientStrength = 0.4f;"
-		"float ambientStrength1 = 0.2f;"
-		"vec3 ambient = ambientStrength * lightColor;"
-		"vec3 ambient1 = ambientStrength1 * lightColor1;"
-		"// Diffuse\n"
-		"vec3 norm = normalize(oNormal);"
-		"vec3 lightDir = normalize(lightPos - fragPos);"
-		"vec3 lightDir1 = normalize(lightPos1 - fragPos);"
-		"float diff = max(dot(norm, lightDir), 0.0);"
-		"float diff1 = max(dot(norm, lightDir1), 0.0);"
-		"vec3 diffuse = diff * lightColor;"
-		"vec3 diffuse1 = diff1 * lightColor1;"
-		"// Specular\n"
-		"float specularStrength = 1.5f;"
-		"vec3 viewDir = normalize(viewPos - fragPos);"
-		"vec3 reflectDir = reflect(-lightDir, norm);"
-		"vec3 reflectDir1 = reflect(-lightDir1, norm);"
-		"float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 128);"
-		"float spec1 = pow(max(dot(viewDir, reflectDir1), 0.0f), 128);"
-		"vec3 specular = specularStrength * spec * lightColor;"
-		"vec3 specular1 = specularStrength * spec1 * lightColor1;"
-		"vec3 result = (ambient + ambient1 + diffuse + diffuse1 + specular + specular1) * objectColor;"
-		"fragColor = texture(myTexture, oTexCoord) * vec4(result, 1.0f);"
-		"}\n";
-
-	// LAMP Vertex shader source code
-	string lampVertexShaderSource =
-		"#version 330 core\n"
-		"layout(location = 0) in vec3 vPosition;"
-		"uniform mat4 model;"
-		"uniform mat4 view;"
-		"uniform mat4 projection;"
-		"void main()\n"
-		"{\n"
-		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
-		"}\n";
-
-	// LAMP Fragment shader source code
-	string lampFragmentShaderSource =
-		"#version 330 core\n"
-		"out vec4 fragColor;"
-		"void main()\n"
-		"{\n"
-		"fragColor = vec4(1.0f);" // Set lamp to white.
-		"}\n";
-
-	// Creating Shader Program
-	GLuint shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
-	GLuint lampShaderProgram = CreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource);
-
-	// Use Shader Program exe once
-	//glUseProgram(shaderProgram);
-
-	cout << "Scroll to Zoom." << endl;
-	cout << "[L-Alt + LMB] to Orbit." << endl;
-	cout << "[L-Alt + MMB] to Pan." << endl;
-	cout << "[F] to Reset camera." << endl;
-	cout << "[P] to Switch projection." << endl;
-
-	/* Loop until the user closes the window */
-	while (!glfwWindowShouldClose(window))
-	{
-
-		// set delta time
-		GLfloat currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// Resize window and graphics simultaneously
-		glfwGetFramebufferSize(window, &width, &height);
-		
-
-		/* Render here */
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Use Shader Program exe and select VAO before drawing 
-		glUseProgram(shaderProgram); // Call Shader per-frame when updating attributes
-
-		// Declare identity matrix
-		glm::mat4 modelMatrix;
-		glm::mat4 projectionMatrix;
-
-		
-		// Initialize transforms
-		viewMatrix = glm::lookAt(cameraPosition, getTarget(), worldUp);
-
-		// specify projection
-		// fov, width, height, nearplane, farplane
-		
-
-		if (isPerspective) {
-			// specify projection
-			//glViewport(0, 0, width, height);
-			// fov, width, height, nearplane, farplane
-			projectionMatrix = glm::perspective(fov, (GLfloat)width / (GLfloat)height, 0.1f, 100.0f);
-			//cout << "perspective" << endl;
-
-		}
-		else {
-			// specify projection
-			//glOrtho(0, width, height, 0, 0.1, 50.0);
-			// left, right, bottom, top, near, far
-			projectionMatrix = glm::ortho(-9.0f, 9.0f, -9.0f, 9.0f, 0.1f, 100.0f);
-			//cout << "ortho" << endl;
-		}
-
-		// Select shader and uniform variable
-		GLuint modelLoc = glGetUniformLocation(shaderProgram, "model");
-		GLuint viewLoc = glGetUniformLocation(shaderProgram, "view");
-		GLuint projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-
-		// Get light and object color, and light position location
-		GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
-		GLint lightColorLoc = glGetUniformLocation(shaderProgram, "lightColor");
-		GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-		GLint lightColorLoc1 = glGetUniformLocation(shaderProgram, "lightColor1");
-		GLint lightPosLoc1 = glGetUniformLocation(shaderProgram, "lightPos1");
-		GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-
-		// LAPIS *****************************
-
-		// Assign light and object Colors
-		glUniform3f(objectColorLoc, 1.0f, 1.0f, 1.0f); // object was very dark without using white
-		glUniform3f(lightColorLoc, 1.0f, 1.0f, 1.0f);
-		glUniform3f(lightColorLoc1, 1.0f, 1.0f, 0.0f);
-		// Set light position 
-		glUniform3f(lightPosLoc, lightPosition.x, lightPosition.y, lightPosition.z);
-		glUniform3f(lightPosLoc1, lightPosition1.x, lightPosition1.y, lightPosition1.z);
-		// Specify view position
-		glUniform3f(viewPosLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-		// Pass transform to shader
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		glBindTexture(GL_TEXTURE_2D, lapisTexture);
-
-		glBindVertexArray(VAOLapis); // User-defined VAO must be called before draw. 
-
-
-		for (GLuint i = 0; i < 6; i++) { // Loop to draw duplicate shapes with different transformations
-			// Declare identity matrix
-			glm::mat4 modelMatrix;
-
-			// Initialize transforms
-
-			// matrix, angle in rad, vector(numbners multiplied by angle)
-			modelMatrix = glm::translate(modelMatrix, LapisPosition);
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsYLapis[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-
-			// Pass transform to shader
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-			// Draw primitive(s)
-			draw(sizeof(indicesLapis));
-		}
-		
-		// Redeclare model matrix to identity after previous translations
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		// Unbind VOA after drawing
-		glBindVertexArray(0); //Incase different VAO wii be used after
-
-		// CHARGER *************************
-
-		glBindTexture(GL_TEXTURE_2D, blackTexture);
-
-		glBindVertexArray(VAOCyl); // User-defined VAO must be called before draw. 
-
-		for (GLuint i = 0; i < 6; i++) { // Loop to draw duplicate shapes with different transformations
-			// Declare identity matrix
-			glm::mat4 modelMatrix;
-
-			// Initialize transforms
-
-			modelMatrix = glm::translate(modelMatrix, chargerPosition);
-			// matrix, angle in rad, vector(numbners multiplied by angle)
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsYCyl[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-
-			// Pass transform to shader
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-			// Draw primitive(s)
-			draw(sizeof(indicesCyl));
-		}
-
-		// Redeclare model matrix to identity after previous translations
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		// LASER POINTER **********************
-
-		glBindTexture(GL_TEXTURE_2D, goldTexture);
-
-		for (GLuint i = 0; i < 6; i++) { // Loop to draw duplicate shapes with different transformations
-			// Declare identity matrix
-			glm::mat4 modelMatrix;
-
-			// Initialize transforms
-
-
-
-			modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, -2.835f, 0.0f));
-			modelMatrix = glm::rotate(modelMatrix, 90.0f * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-			modelMatrix = glm::rotate(modelMatrix, 20.0f * toRadians, glm::vec3(0.0f, 0.0f, 1.0f));
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsYCyl[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.35f, .7f, .35f));
-
-			// Pass transform to shader
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-			// Draw primitive(s)
-			draw(sizeof(indicesCyl));
-		}
-
-		// Redeclare model matrix to identity after previous translations
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		// Unbind VOA after drawing
-	
-
-		// LEGO NUB  *******************************************************
-		glBindTexture(GL_TEXTURE_2D, tanTexture);
-
-		for (GLuint i = 0; i < 6; i++) { // Loop to draw duplicate shapes with different transformations
-			// Declare identity matrix
-			glm::mat4 modelMatrix;
-
-			// Initialize transforms
-
-			modelMatrix = glm::translate(modelMatrix, glm::vec3(-1.0f, -2.85f, 1.0f));
-			modelMatrix = glm::rotate(modelMatrix, planeRotationsYCyl[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.15f, .03f, .15f));
-
-			// Pass transform to shader
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-			// Draw primitive(s)
-			draw(sizeof(indicesCyl));
-		}
-
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		glBindVertexArray(0); //Incase different VAO wii be used after
-
-		// LEGO BODY (RECTANGULAR PRISM) ***********************************************************
-
-		glBindVertexArray(VAORec);
-
-		for (GLuint i = 0; i < 4; i++)
-		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::translate(modelMatrix, glm::vec3(-1.0f, -3.0f, 1.0f));
-			modelMatrix = glm::rotate(modelMatrix, recPlaneRotations[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.2f, .2f, .2f));
-				
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			draw(sizeof(indicesRec));
-		}
-
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-
-		glBindVertexArray(0); //Incase different VAO wii be used after
-
-		// PLANE ***************************
-
-		// Assign light and object Colors
-		glUniform3f(objectColorLoc, 0.46f, 0.36f, 0.25f);
-
-		// Bind texture
-		glBindTexture(GL_TEXTURE_2D, woodTexture);
-
-		// Bind to Plane VOA
-		glBindVertexArray(VAOPlane);
-
-		// Draw Plane
-		draw(sizeof(PlaneIndices));
-
-		// Unbind VAO
-		glBindVertexArray(0);
-
-		// Unbind Shader
-		glUseProgram(0); // Incase different shader will be used after
-
-
-		// LAMP *************
-
-		glUseProgram(lampShaderProgram);
-
-		// Get matrix's uniform location and set matrix
-		GLint lampModelLoc = glGetUniformLocation(lampShaderProgram, "model");
-		GLint lampViewLoc = glGetUniformLocation(lampShaderProgram, "view");
-		GLint lampProjLoc = glGetUniformLocation(lampShaderProgram, "projection");
-
-		glUniformMatrix4fv(lampViewLoc, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(lampProjLoc, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		glBindVertexArray(lampVAO);
-
-		// Transform planes to form cube
-		// lamp 0
-		for (GLuint i = 0; i < 6; i++)
-		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::translate(modelMatrix, lampPlanePositions[i] / glm::vec3(8.0f, 8.0f, 8.0f) + lightPosition);
-			modelMatrix = glm::rotate(modelMatrix, lampPlaneRotations[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.125f, .125f, .125f));
-			if (i >= 4)
-				modelMatrix = glm::rotate(modelMatrix, lampPlaneRotations[i] * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-			glUniformMatrix4fv(lampModelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			draw(sizeof(lampIndices));
-		}
-
-		// lamp 1
-		for (GLuint i = 0; i < 6; i++)
-		{
-			glm::mat4 modelMatrix;
-			modelMatrix = glm::translate(modelMatrix, lampPlanePositions[i] / glm::vec3(8.0f, 8.0f, 8.0f) + lightPosition1);
-			modelMatrix = glm::rotate(modelMatrix, lampPlaneRotations[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(.125f, .125f, .125f));
-			if (i >= 4)
-				modelMatrix = glm::rotate(modelMatrix, lampPlaneRotations[i] * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-			glUniformMatrix4fv(lampModelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			// Draw primitive(s)
-			draw(sizeof(lampIndices));
-		}
-
-		glBindVertexArray(0); //Incase different VAO will be used after
-
-		glUseProgram(0); // Incase different shader will be used after
-
-		/* Swap front and back buffers */
-		glfwSwapBuffers(window);
-
-		/* Poll for and process events */
-		glfwPollEvents();
-
-		// Poll camera transformations
-		TransformCamera();
-	}
-
-	//Clear GPU resources
-	glDeleteVertexArrays(1, &VAOLapis);
-	glDeleteBuffers(1, &VBOLapis);
-	glDeleteBuffers(1, &EBOLapis);
-
-
-	glfwTerminate();
-	return 0;
-}
-
-// Define Input Callback funtions
-
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
-{
-	// Display ASCII Keycode
-	//cout << "ASCII: " << key << endl;
-
-	if (action == GLFW_PRESS) {
-		keys[key] = true;
-	}
-	else if (action == GLFW_RELEASE) {
-		keys[key] = false;
-	}
-
-	// Switch between orthographic and perspective view
-
-	if (action == GLFW_PRESS && key == GLFW_KEY_P) {
-		isPerspective = !isPerspective;
-	}
-
-
-}
-
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
-{
-	// Display scroll offset value
-	/*
-	if (yoffset > 0) {
-		cout << "Scroll up: ";
-	}
-	else if (yoffset < 0) {
-		cout << "Scroll down: ";
-	}
-
-	cout << yoffset << endl;
-	*/
-
-	// Clamp FOV
-	if (fov >= 1.5f && fov <= 45.0f) {
-		fov -= yoffset * 0.01f;
-	}
-
-	//Default FOV
-	if (fov < 1.5f) {
-		fov = 1.5f;
-	}
-	if (fov > 45.0f) {
-		fov = 45.0f;
-	}
-
-}
-
-void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
-{
-	// Display Mouse Position
-	//cout << "Mouse pos [" << xpos << ", " << ypos << "]" << endl;
-
-	if (firstMouseMove) { // Getting initial mouse position
-		lastX = xpos;
-		lastY = ypos;
-		firstMouseMove = false;
-	}
-
-	// Calculate cursor offset
-	xChange = xpos - lastX;
-	yChange = lastY - ypos; // inverted controls for y
-
-	lastX = xpos;
-	lastY = ypos;
-
-
-	if (isPanning) {
-
-		if (cameraPosition.z < 0.0f) {
-			cameraFront.z = 6.0f;
-		}
-		else {
-			cameraFront.z = -1.0f;
-		}
-
-		// Pan camera X
-		GLfloat cameraSpeed = xChange * deltaTime;
-		cameraPosition += cameraSpeed * cameraRight;
-
-		// Pan camera Y
-		cameraSpeed = yChange * deltaTime;
-		cameraPosition += cameraSpeed * cameraUp;
-	}
-
-	// Orbit camera
-	if (isOrbiting) {
-		rawYaw += xChange;
-		rawPtich += yChange;
-
-		// Convert Yaw and Pitch to degrees
-		degYaw = glm::radians(rawYaw);
-		degPitch = glm::radians(rawPtich);
-
-		// Azimuth Altitude formula
-		cameraPosition.x = target.x + radius * cosf(degPitch) * sinf(degYaw);
-		cameraPosition.y = target.y + radius * sinf(degPitch);
-		cameraPosition.z = target.z + radius * cosf(degPitch) * cosf(degYaw);
-	}
-
-}
-
-void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
-{
-	/*
-	// Display mouse button clicks
-	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-		cout << "LMB clicked" << endl;
-	}
-	if (button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_PRESS) {
-		cout << "MMB clicked" << endl;
-	}
-	if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
-		cout << "RMB clicked" << endl;
-	}
-	*/
-
-	if (action == GLFW_PRESS) {
-		mouseButtons[button] = true;
-	}
-	else if (action == GLFW_RELEASE) {
-		mouseButtons[button] = false;
-	}
-}
-
-// Define getTarget function
-glm::vec3 getTarget() {
-
-	if (isPanning) {
-		target = cameraPosition + cameraFront;
-	}
-
-	return target;
-}
-
-// Define TransformCamera function
-void TransformCamera() {
-
-	// Pan Camera
-	if (keys[GLFW_KEY_LEFT_ALT] && mouseButtons[GLFW_MOUSE_BUTTON_MIDDLE]) {
-		isPanning = true;
-	}
-	else {
-		isPanning = false;
-	}
-
-	// Orbit Camera
-	if (keys[GLFW_KEY_LEFT_ALT] && mouseButtons[GLFW_MOUSE_BUTTON_LEFT]) {
-		isOrbiting = true;
-	}
-	else {
-		isOrbiting = false;
-	}
-
-	// Reset/init camera
-	if (keys[GLFW_KEY_F]) {
-		initCamera();
-	}
-
-}
-
-void initCamera() {
-	cameraPosition = glm::vec3(0.0f, 1.25f, 6.0f);
-	target = glm::vec3(0.0f, 0.0f, 0.0f);
-	cameraDirection = glm::normalize(cameraPosition - target);
-	worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
-	cameraRight = glm::normalize(glm::cross(worldUp, cameraDirection));
-	cameraUp = glm::normalize(glm::cross(cameraDirection, cameraRight));
-	cameraFront = glm::normalize(glm::vec3(0.0f, 0.0f, -1.0f));
-	firstMouseMove = true;
-	fov = 45.0f;
+#include <GLEW/glew.h>
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+#include <cstdio>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// SIMD intrinsics for the software occlusion rasterizer and mip generation
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// GLM headers
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+
+#include<SOIL2/SOIL2.h>
+
+using namespace std;
+
+
+int width = 640, height = 480;
+const double PI = 3.14159;
+const float toRadians = PI / 180.0f;
+
+// Input Callback Function prototypes
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+
+// Job system shared by the frame, mesh building, import and mip generation
+void runOnAllThreads(const function<void()>& job);
+
+// Decalre global view matrix
+glm::mat4 viewMatrix;
+
+// intialize global fov
+GLfloat fov = 45.0f;
+
+// Define Camera Attributes
+glm::vec3 cameraPosition = glm::vec3(0.0f, 1.25f, 6.0f);
+glm::vec3 target = glm::vec3(0.0f, 0.0f, 0.0f);
+glm::vec3 cameraDirection = glm::normalize(cameraPosition - target);
+glm::vec3 worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
+glm::vec3 cameraRight = glm::normalize(glm::cross(worldUp, cameraDirection));
+glm::vec3 cameraUp = glm::normalize(glm::cross(cameraDirection, cameraRight));
+glm::vec3 cameraFront = glm::normalize(glm::vec3(0.0f, 0.0f, -1.0f));
+
+// Declare get target prototype
+glm::vec3 getTarget();
+
+// Camera transformation prototype (event listener)
+void TransformCamera();
+
+// Boolean array for keys and mouse buttons
+bool keys[1024];
+bool mouseButtons[3];
+
+// Booleans to check camera transformation
+bool isPanning = false;
+bool isOrbiting = false;
+bool isPerspective = true;
+
+// Radius, Pitch, and Yaw
+GLfloat radius = 6.0f;
+GLfloat rawYaw = 0.0f;
+GLfloat rawPtich = 0.0f;
+GLfloat degYaw;
+GLfloat degPitch;
+
+GLfloat deltaTime = 0.0f;
+GLfloat lastFrame = 0.0f;
+GLfloat lastUse = 0.0f;
+
+GLfloat lastX = width / 2;
+GLfloat lastY = height / 2;
+GLfloat xChange = 0.0f;
+GLfloat yChange = 0.0f;
+
+// Detect initial mouse movement
+bool firstMouseMove = true;
+
+void initCamera();
+
+// Light source position
+glm::vec3 lightPosition(0.0f, -2.0f, 5.0f);
+glm::vec3 lightPosition1(-2.0f, 0.0f, -5.0f);
+
+// Booleans to toggle occlusion culling and the crowded desk scene
+bool isOcclusionCulling = true;
+bool isCrowdedDesk = false;
+
+// Boolean to toggle the GPU driven (compute culled, indirect draw) path
+bool isGpuCulling = false;
+
+// Booleans to toggle Hi-Z occlusion in the GPU path and its culled object view
+bool isHiZCulling = true;
+bool isShowingCulled = false;
+
+// Booleans to toggle the depth pre-pass, front-to-back sorting and the overdraw stress scene
+bool isDepthPrepass = false;
+bool isFrontToBack = true;
+bool isStressScene = false;
+
+// Boolean to toggle deferred shading (G-buffer and screen space light passes)
+bool isDeferred = false;
+
+// Boolean to toggle level of detail selection, and the fraction a size must pass a threshold by to switch
+bool isLod = true;
+float lodHysteresis = 0.15f;
+
+// Boolean to toggle the quantized 20 byte vertex format (the full one is 11 floats, 44 bytes)
+bool isQuantizedVertices = true;
+
+// MIP GENERATION START *******************************************************
+
+// Mip chains are built on the CPU when a texture is cooked. The linear light filters decode the sRGB
+// bytes, filter in float (planar, so each kernel runs on plain rows of floats) and encode each level
+// once; each level is filtered from the previous float level, not from its rounded bytes. Blocks of
+// target rows are spread over the worker threads.
+// Filter: 0 averages the sRGB bytes directly, which darkens high contrast detail; 1 averages 2 x 2
+// boxes in linear light; 2 is a Kaiser windowed sinc in linear light, sharper than the box.
+int mipFilter = 2;
+const char* mipFilterNames[3] = { "gamma box", "sRGB box", "sRGB Kaiser" };
+
+// Steps linear light is quantized to before looking up its sRGB byte
+const int linearSteps = 8192;
+
+struct SrgbTables {
+	float toLinear[256];
+	int32_t toSrgb[linearSteps + 1];
+};
+
+const SrgbTables& srgbTables()
+{
+	static const SrgbTables tables = [] {
+		SrgbTables built;
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			built.toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i <= linearSteps; i++) {
+			float l = (float)i / linearSteps;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			built.toSrgb[i] = (int32_t)(c * 255.0f + 0.5f);
+		}
+		return built;
+	}();
+	return tables;
+}
+
+// 8 taps of the Kaiser windowed sinc halving filter, for the source texels 2x - 3 to 2x + 4 of target x
+const float* kaiserWeights()
+{
+	static const vector<float> weights = [] {
+		auto besselI0 = [](float x) {
+			float sum = 1.0f, term = 1.0f;
+			for (int k = 1; k < 16; k++) {
+				term *= (x * 0.5f / k) * (x * 0.5f / k);
+				sum += term;
+			}
+			return sum;
+		};
+		const float alpha = 4.0f, radius = 2.0f;
+		vector<float> built(8);
+		float total = 0.0f;
+		for (int k = 0; k < 8; k++) {
+			float t = (k - 3.5f) * 0.5f; // distance in target texels
+			float sinc = sinf((float)PI * t) / ((float)PI * t);
+			float window = besselI0(alpha * sqrtf(max(1.0f - (t / radius) * (t / radius), 0.0f))) / besselI0(alpha);
+			built[k] = sinc * window;
+			total += built[k];
+		}
+		for (float& weight : built)
+			weight /= total;
+		return built;
+	}();
+	return weights.data();
+}
+
+// Next mip level of a tightly packed RGB8 image by 2 x 2 averaging; an odd last row or column is
+// folded into its neighbour's box by clamping
+void downsampleRgb(const GLubyte* source, int width, int height, GLubyte* target)
+{
+	int targetWidth = max(width / 2, 1), targetHeight = max(height / 2, 1);
+	for (int y = 0; y < targetHeight; y++) {
+		const GLubyte* row0 = source + (size_t)min(y * 2, height - 1) * width * 3;
+		const GLubyte* row1 = source + (size_t)min(y * 2 + 1, height - 1) * width * 3;
+		for (int x = 0; x < targetWidth; x++) {
+			int x0 = min(x * 2, width - 1) * 3, x1 = min(x * 2 + 1, width - 1) * 3;
+			for (int c = 0; c < 3; c++)
+				target[((size_t)y * targetWidth + x) * 3 + c] = (GLubyte)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+		}
+	}
+}
+
+// Run rows [0, rowCount) in blocks on the worker threads, or inline when there is too little work
+void parallelRows(int rowCount, int rowWidth, const function<void(int, int)>& rows)
+{
+	if ((size_t)rowCount * rowWidth < 32768) {
+		rows(0, rowCount);
+		return;
+	}
+	const int block = 16;
+	atomic<int> next(0);
+	runOnAllThreads([&] {
+		for (int first = next.fetch_add(block); first < rowCount; first = next.fetch_add(block))
+			rows(first, min(first + block, rowCount));
+	});
+}
+
+// Average 2 x 2 boxes of two source rows into one target row, clamping at an odd edge
+void boxRow(const float* row0, const float* row1, int width, float* target, int targetWidth)
+{
+	int x = 0;
+#if defined(__AVX2__)
+	__m256 quarter = _mm256_set1_ps(0.25f);
+	for (; x + 8 <= targetWidth && 2 * x + 16 <= width; x += 8) {
+		__m256 a = _mm256_add_ps(_mm256_loadu_ps(row0 + 2 * x), _mm256_loadu_ps(row1 + 2 * x));
+		__m256 b = _mm256_add_ps(_mm256_loadu_ps(row0 + 2 * x + 8), _mm256_loadu_ps(row1 + 2 * x + 8));
+		// hadd leaves the pair sums of a and b interleaved by 128 bit lane; put them back in order
+		__m256 sums = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_hadd_ps(a, b)), 0xD8));
+		_mm256_storeu_ps(target + x, _mm256_mul_ps(sums, quarter));
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	__m128 quarter = _mm_set1_ps(0.25f);
+	for (; x + 4 <= targetWidth && 2 * x + 8 <= width; x += 4) {
+		__m128 a = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x), _mm_loadu_ps(row1 + 2 * x));
+		__m128 b = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x + 4), _mm_loadu_ps(row1 + 2 * x + 4));
+		__m128 sums = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm_storeu_ps(target + x, _mm_mul_ps(sums, quarter));
+	}
+#endif
+	for (; x < targetWidth; x++) {
+		int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+		target[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) * 0.25f;
+	}
+}
+
+// Vertical Kaiser pass: one full width target row from 8 source rows
+void kaiserColumns(const float* const* rows, int width, float* target)
+{
+	const float* weights = kaiserWeights();
+	int x = 0;
+#if defined(__AVX2__)
+	for (; x + 8 <= width; x += 8) {
+		__m256 sum = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_loadu_ps(rows[0] + x));
+		for (int k = 1; k < 8; k++)
+			sum = _mm256_fmadd_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + x), sum);
+		_mm256_storeu_ps(target + x, sum);
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	for (; x + 4 <= width; x += 4) {
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(rows[0] + x));
+		for (int k = 1; k < 8; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + x)));
+		_mm_storeu_ps(target + x, sum);
+	}
+#endif
+	for (; x < width; x++) {
+		float sum = 0.0f;
+		for (int k = 0; k < 8; k++)
+			sum += weights[k] * rows[k][x];
+		target[x] = sum;
+	}
+}
+
+// Horizontal Kaiser pass: halve one row, clamping taps past either edge
+void kaiserRow(const float* row, int width, float* target, int targetWidth)
+{
+	const float* weights = kaiserWeights();
+	auto clamped = [&](int x) {
+		float sum = 0.0f;
+		for (int k = 0; k < 8; k++)
+			sum += weights[k] * row[min(max(2 * x - 3 + k, 0), width - 1)];
+		return sum;
+	};
+
+	int x = 0;
+	for (; x < targetWidth && 2 * x - 3 < 0; x++)
+		target[x] = clamped(x);
+#if defined(__AVX2__)
+	// Every other texel, so each tap is a gather of 8 texels two apart
+	__m256i evens = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+	for (; x + 8 <= targetWidth && 2 * (x + 7) + 4 < width; x += 8) {
+		const float* first = row + 2 * x - 3;
+		__m256 sum = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_i32gather_ps(first, evens, 4));
+		for (int k = 1; k < 8; k++)
+			sum = _mm256_fmadd_ps(_mm256_set1_ps(weights[k]), _mm256_i32gather_ps(first + k, evens, 4), sum);
+		_mm256_storeu_ps(target + x, sum);
+	}
+#endif
+	for (; x < targetWidth; x++) {
+		if (2 * x + 4 < width) {
+			const float* first = row + 2 * x - 3;
+			float sum = 0.0f;
+			for (int k = 0; k < 8; k++)
+				sum += weights[k] * first[k];
+			target[x] = sum;
+		}
+		else {
+			target[x] = clamped(x);
+		}
+	}
+}
+
+// Rows [firstRow, lastRow) of a tightly packed RGB8 image to three linear light planes (all red,
+// then all green, then all blue, each lastRow - firstRow rows)
+void linearizeRows(const GLubyte* image, int width, int firstRow, int lastRow, float* planes)
+{
+	const float* toLinear = srgbTables().toLinear;
+	size_t planeSize = (size_t)(lastRow - firstRow) * width;
+	image += (size_t)firstRow * width * 3;
+	for (size_t i = 0; i < planeSize; i++) {
+		planes[i] = toLinear[image[i * 3]];
+		planes[i + planeSize] = toLinear[image[i * 3 + 1]];
+		planes[i + planeSize * 2] = toLinear[image[i * 3 + 2]];
+	}
+}
+
+// Pixels [first, end) of three linear light planes back to tightly packed RGB8
+void encodeRows(const float* planes, size_t planeSize, size_t first, size_t end, GLubyte* image)
+{
+	const int32_t* toSrgb = srgbTables().toSrgb;
+	size_t i = first;
+#if defined(__AVX2__)
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), steps = _mm256_set1_ps((float)linearSteps);
+	int32_t encoded[3][8];
+	for (; i + 8 <= end; i += 8) {
+		for (int c = 0; c < 3; c++) {
+			__m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(planes + planeSize * c + i), zero), one);
+			__m256i step = _mm256_cvtps_epi32(_mm256_mul_ps(value, steps));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(encoded[c]), _mm256_i32gather_epi32(toSrgb, step, 4));
+		}
+		for (int j = 0; j < 8; j++) {
+			image[(i + j) * 3] = (GLubyte)encoded[0][j];
+			image[(i + j) * 3 + 1] = (GLubyte)encoded[1][j];
+			image[(i + j) * 3 + 2] = (GLubyte)encoded[2][j];
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		for (int c = 0; c < 3; c++) {
+			float value = min(max(planes[planeSize * c + i], 0.0f), 1.0f);
+			image[i * 3 + c] = (GLubyte)toSrgb[(int)(value * linearSteps + 0.5f)];
+		}
+	}
+}
+
+// Write the mip levels below a tightly packed RGB8 image, from half size down to 1 x 1, one after
+// another into target
+void generateMipChain(const GLubyte* image, int width, int height, GLubyte* target)
+{
+	if (mipFilter == 0) {
+		for (; width > 1 || height > 1; width = max(width / 2, 1), height = max(height / 2, 1)) {
+			downsampleRgb(image, width, height, target);
+			image = target;
+			target += (size_t)max(width / 2, 1) * max(height / 2, 1) * 3;
+		}
+		return;
+	}
+
+	// level holds the previous level's planes; it is empty for the first level, whose source rows are
+	// linearized from the image by the block that reads them, so the full size image is never in float
+	vector<float> level, next;
+	bool isKaiser = mipFilter == 2;
+	while (width > 1 || height > 1) {
+		int targetWidth = max(width / 2, 1), targetHeight = max(height / 2, 1);
+		size_t targetPlaneSize = (size_t)targetWidth * targetHeight;
+		next.resize(targetPlaneSize * 3);
+
+		parallelRows(targetHeight, width * (isKaiser ? 24 : 6), [&](int firstRow, int lastRow) {
+			thread_local vector<float> linear, columns;
+			int firstSource = isKaiser ? max(2 * firstRow - 3, 0) : min(2 * firstRow, height - 1);
+			int lastSource = isKaiser ? min(2 * lastRow + 5, height) : min(2 * lastRow, height);
+			size_t sourcePlaneSize = (size_t)width * height;
+			const float* planes = level.data();
+			if (level.empty()) {
+				sourcePlaneSize = (size_t)(lastSource - firstSource) * width;
+				linear.resize(sourcePlaneSize * 3);
+				linearizeRows(image, width, firstSource, lastSource, linear.data());
+				planes = linear.data() - (size_t)firstSource * width;
+			}
+			auto sourceRow = [&](int plane, int y) { return planes + plane * sourcePlaneSize + (size_t)y * width; };
+
+			columns.resize(width);
+			for (int y = firstRow; y < lastRow; y++) {
+				for (int plane = 0; plane < 3; plane++) {
+					float* row = next.data() + plane * targetPlaneSize + (size_t)y * targetWidth;
+					if (isKaiser) {
+						const float* rows[8];
+						for (int k = 0; k < 8; k++)
+							rows[k] = sourceRow(plane, min(max(2 * y - 3 + k, 0), height - 1));
+						kaiserColumns(rows, width, columns.data());
+						kaiserRow(columns.data(), width, row, targetWidth);
+					}
+					else {
+						boxRow(sourceRow(plane, min(2 * y, height - 1)), sourceRow(plane, min(2 * y + 1, height - 1)), width, row, targetWidth);
+					}
+				}
+			}
+			encodeRows(next.data(), targetPlaneSize, (size_t)firstRow * targetWidth, (size_t)lastRow * targetWidth, target);
+		});
+
+		target += targetPlaneSize * 3;
+		swap(level, next);
+		width = targetWidth;
+		height = targetHeight;
+	}
+}
+
+// "--mip-benchmark [size]": every filter against glGenerateMipmap on a size x size texture, and
+// what each does to a one texel black and white checker (linear light keeps its brightness at 188)
+void runMipBenchmark(int size)
+{
+	vector<GLubyte> image((size_t)size * size * 3);
+	uint32_t noise = 12345;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			noise = noise * 1664525u + 1013904223u;
+			GLubyte checker = ((x ^ y) & 1) ? 255 : 0;
+			for (int c = 0; c < 3; c++)
+				image[((size_t)y * size + x) * 3 + c] = x < size / 2 ? checker : (GLubyte)(noise >> (8 + c * 8));
+		}
+	}
+	size_t chainBytes = 0;
+	for (int level = size / 2; level >= 1; level /= 2)
+		chainBytes += (size_t)level * level * 3;
+	vector<GLubyte> chain(chainBytes);
+
+	cout << "Mip benchmark: " << size << "x" << size << " RGB8" << endl;
+	int savedFilter = mipFilter;
+	for (int filter = 0; filter < 3; filter++) {
+		mipFilter = filter;
+		auto start = chrono::high_resolution_clock::now();
+		generateMipChain(image.data(), size, size, chain.data());
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		cout << "  " << mipFilterNames[filter] << ": " << ms << " ms (" << image.size() / 1048576.0 / (ms / 1000.0) << " MB/s), checker -> "
+			<< (int)chain[0] << endl;
+	}
+	mipFilter = savedFilter;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data());
+	glFinish();
+	auto start = chrono::high_resolution_clock::now();
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glFinish();
+	double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	vector<GLubyte> levelOne((size_t)(size / 2) * (size / 2) * 3);
+	glGetTexImage(GL_TEXTURE_2D, 1, GL_RGB, GL_UNSIGNED_BYTE, levelOne.data());
+	cout << "  glGenerateMipmap: " << ms << " ms (" << image.size() / 1048576.0 / (ms / 1000.0) << " MB/s), checker -> " << (int)levelOne[0] << endl;
+
+	// What a cooked texture costs instead: uploading the CPU built levels
+	start = chrono::high_resolution_clock::now();
+	const GLubyte* level = chain.data();
+	for (int i = 1, levelSize = size / 2; levelSize >= 1; i++, levelSize /= 2) {
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, levelSize, levelSize, 0, GL_RGB, GL_UNSIGNED_BYTE, level);
+		level += (size_t)levelSize * levelSize * 3;
+	}
+	glFinish();
+	cout << "  uploading CPU levels 1+: " << chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() << " ms" << endl;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glDeleteTextures(1, &texture);
+}
+
+// MIP GENERATION END *******************************************************
+
+// ASSET CACHE START *******************************************************
+
+// Cooked outputs (textures with their mip chains, program binaries, the built mesh arena, imported
+// models) are stored under a content hash of everything that went into them plus the cooker version,
+// so a launch only reads them back. Bump assetCookerVersion whenever a cooker or generator changes
+// its output; delete the directory to measure a cold start.
+const char* assetCacheDirectory = "asset_cache";
+const uint32_t assetCookerVersion = 1;
+
+// Hits, misses and where startup time went, printed once loading is done
+struct AssetCacheStats {
+	int hits;
+	int misses;
+	double textureMs;
+	double shaderMs;
+	double meshMs;
+};
+
+AssetCacheStats assetCache;
+
+// Program binaries need GL 4.1 or ARB_get_program_binary and at least one binary format
+bool isProgramBinarySupported = false;
+
+// Immutable texture storage needs GL 4.2 or ARB_texture_storage
+bool isTextureStorageSupported = false;
+
+// 64 bit content hash, eight bytes per step; chain calls by passing the previous hash as seed
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed ^ (size * 0x9E3779B97F4A7C15ull);
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		hash ^= word * 0xC2B2AE3D27D4EB4Full;
+		hash = ((hash << 31) | (hash >> 33)) * 0x9E3779B97F4A7C15ull;
+	}
+	for (; size > 0; p++, size--)
+		hash = ((hash ^ *p) * 0x100000001B3ull) ^ (hash >> 29);
+	hash ^= hash >> 32;
+	hash *= 0xD6E8FEB86659FD93ull;
+	return hash ^ (hash >> 32);
+}
+
+uint64_t hashString(const string& text, uint64_t seed)
+{
+	return hashBytes(text.data(), text.size(), seed);
+}
+
+// Cache file for one cooked artifact, e.g. asset_cache/texture-0123456789abcdef.bin
+string assetCachePath(const char* kind, uint64_t key)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%s-%016llx.bin", kind, (unsigned long long)hashBytes(&assetCookerVersion, sizeof(assetCookerVersion), key));
+	return assetCacheDirectory + string(name);
+}
+
+bool readAssetFile(const string& path, vector<char>& bytes)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file)
+		return false;
+	bytes.resize((size_t)file.tellg());
+	file.seekg(0);
+	return (bool)file.read(bytes.data(), bytes.size());
+}
+
+// Written beside the final name and renamed, so a crash never leaves a truncated artifact behind
+void writeAssetFile(const string& path, const vector<char>& bytes)
+{
+#ifdef _WIN32
+	_mkdir(assetCacheDirectory);
+#else
+	mkdir(assetCacheDirectory, 0755);
+#endif
+	string temporaryPath = path + ".tmp";
+	{
+		ofstream file(temporaryPath, ios::binary);
+		if (!file.write(bytes.data(), bytes.size()))
+			return;
+	}
+	remove(path.c_str());
+	rename(temporaryPath.c_str(), path.c_str());
+}
+
+template <typename T>
+void appendBytes(vector<char>& bytes, const T* data, size_t count)
+{
+	bytes.insert(bytes.end(), reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data + count));
+}
+
+// Cooked texture: this header, then every RGB8 mip level from the largest down to 1 x 1, tightly packed
+struct CookedTextureHeader {
+	char magic[4];
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+};
+
+// Bytes of a cooked texture's levels from firstLevel down to 1 x 1
+size_t mipChainBytes(const CookedTextureHeader& header, uint32_t firstLevel)
+{
+	size_t size = 0;
+	for (uint32_t level = firstLevel; level < header.levelCount; level++)
+		size += (size_t)max(header.width >> level, 1u) * max(header.height >> level, 1u) * 3;
+	return size;
+}
+
+// Decode an image file and build its full mip chain into the cooked layout
+bool cookTexture(const vector<char>& source, vector<char>& cooked)
+{
+	int width, height, channels;
+	unsigned char* image = SOIL_load_image_from_memory(reinterpret_cast<const unsigned char*>(source.data()), (int)source.size(),
+		&width, &height, &channels, SOIL_LOAD_RGB);
+	if (!image)
+		return false;
+
+	CookedTextureHeader header = { { 'T', 'E', 'X', '1' }, (uint32_t)width, (uint32_t)height, 1 };
+	for (int size = max(width, height); size > 1; size /= 2)
+		header.levelCount++;
+	cooked.clear();
+	appendBytes(cooked, &header, 1);
+	appendBytes(cooked, image, (size_t)width * height * 3);
+	SOIL_free_image_data(image);
+
+	cooked.resize(sizeof(header) + mipChainBytes(header, 0));
+	GLubyte* base = reinterpret_cast<GLubyte*>(cooked.data() + sizeof(header));
+	generateMipChain(base, width, height, base + (size_t)width * height * 3);
+	return true;
+}
+
+bool isCookedTextureValid(const vector<char>& cooked)
+{
+	CookedTextureHeader header;
+	if (cooked.size() < sizeof(header))
+		return false;
+	memcpy(&header, cooked.data(), sizeof(header));
+	size_t size = sizeof(header);
+	uint32_t width = header.width, height = header.height;
+	for (uint32_t level = 0; level < header.levelCount && level < 32; level++) {
+		size += (size_t)width * height * 3;
+		width = max(width / 2, 1u);
+		height = max(height / 2, 1u);
+	}
+	return memcmp(header.magic, "TEX1", 4) == 0 && header.levelCount > 0 && cooked.size() == size;
+}
+
+// Cooked texture of an image file through the cache, returning its cache path. A missing or
+// undecodable file gives a cooked 1 x 1 white texture and an empty path.
+string loadCookedTexture(const char* path, vector<char>& cooked)
+{
+	vector<char> source;
+	if (readAssetFile(path, source)) {
+		string cachePath = assetCachePath("texture", hashBytes(source.data(), source.size(), hashBytes(&mipFilter, sizeof(mipFilter), 0)));
+		if (readAssetFile(cachePath, cooked) && isCookedTextureValid(cooked)) {
+			assetCache.hits++;
+			return cachePath;
+		}
+		if (cookTexture(source, cooked)) {
+			assetCache.misses++;
+			writeAssetFile(cachePath, cooked);
+			return cachePath;
+		}
+	}
+
+	cout << "Cannot load texture " << path << endl;
+	CookedTextureHeader header = { { 'T', 'E', 'X', '1' }, 1, 1, 1 };
+	const GLubyte white[3] = { 255, 255, 255 };
+	cooked.clear();
+	appendBytes(cooked, &header, 1);
+	appendBytes(cooked, white, 3);
+	return string();
+}
+
+// Allocate every level of the bound 2D texture or cube map at once as immutable storage. Without
+// texture storage each level (and face) is specified instead, with the level range clamped to what
+// exists, so the texture is complete under any sampler just like an immutable one.
+void allocateTexture(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+	if (isTextureStorageSupported) {
+		glTexStorage2D(target, levels, internalFormat, width, height);
+		return;
+	}
+	for (GLsizei level = 0; level < levels; level++) {
+		GLsizei levelWidth = max(width >> level, 1), levelHeight = max(height >> level, 1);
+		if (target == GL_TEXTURE_CUBE_MAP) {
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat, levelWidth, levelHeight, 0, format, type, nullptr);
+		}
+		else {
+			glTexImage2D(target, level, internalFormat, levelWidth, levelHeight, 0, format, type, nullptr);
+		}
+	}
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+// Create a 2D texture from a cooked texture's levels starting at firstLevel, which becomes its level 0.
+// levels points at firstLevel's pixels, the coarser levels follow.
+GLuint uploadMipChain(const CookedTextureHeader& header, uint32_t firstLevel, const char* levels)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	int width = max(header.width >> firstLevel, 1u), height = max(header.height >> firstLevel, 1u);
+	allocateTexture(GL_TEXTURE_2D, header.levelCount - firstLevel, GL_RGB8, width, height, GL_RGB, GL_UNSIGNED_BYTE);
+	for (uint32_t i = firstLevel; i < header.levelCount; i++) {
+		glTexSubImage2D(GL_TEXTURE_2D, i - firstLevel, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, levels);
+		levels += (size_t)width * height * 3;
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+GLuint uploadCookedTexture(const vector<char>& cooked, uint32_t firstLevel)
+{
+	CookedTextureHeader header;
+	memcpy(&header, cooked.data(), sizeof(header));
+	return uploadMipChain(header, firstLevel, cooked.data() + sizeof(header) + mipChainBytes(header, 0) - mipChainBytes(header, firstLevel));
+}
+
+// Program binaries are only valid for the driver that made them, so its strings are part of the key
+uint64_t programCacheKey(const string* sources, int count)
+{
+	uint64_t key = 0;
+	GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : names) {
+		const GLubyte* text = glGetString(name);
+		key = hashString(text ? reinterpret_cast<const char*>(text) : "", key);
+	}
+	for (int i = 0; i < count; i++)
+		key = hashString(sources[i], key);
+	return key;
+}
+
+// Program from a cached binary, or 0 if there is none or the driver rejects it
+GLuint loadProgramBinary(uint64_t key)
+{
+	vector<char> bytes;
+	if (!isProgramBinarySupported || !readAssetFile(assetCachePath("program", key), bytes) || bytes.size() <= sizeof(GLenum))
+		return 0;
+
+	GLenum format;
+	memcpy(&format, bytes.data(), sizeof(format));
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, bytes.data() + sizeof(format), (GLsizei)(bytes.size() - sizeof(format)));
+	GLint isLinked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	if (!isLinked) {
+		glDeleteProgram(program);
+		return 0;
+	}
+	assetCache.hits++;
+	return program;
+}
+
+void storeProgramBinary(uint64_t key, GLuint program)
+{
+	if (!isProgramBinarySupported)
+		return;
+	assetCache.misses++;
+	GLint length = 0, isLinked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	if (!isLinked)
+		return;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	vector<char> bytes(sizeof(GLenum) + length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, nullptr, &format, bytes.data() + sizeof(format));
+	memcpy(bytes.data(), &format, sizeof(format));
+	writeAssetFile(assetCachePath("program", key), bytes);
+}
+
+// Print this launch's load times; a launch that cooked everything saves its times so a later
+// launch that cooked nothing can compare cold against warm
+void reportAssetStartup()
+{
+	double totalMs = assetCache.textureMs + assetCache.shaderMs + assetCache.meshMs;
+	const char* state = assetCache.misses == 0 ? "warm" : (assetCache.hits == 0 ? "cold" : "partly warm");
+	cout << "Asset startup (" << state << " cache, " << assetCache.hits << " hits, " << assetCache.misses << " misses): textures "
+		<< assetCache.textureMs << " ms, shaders " << assetCache.shaderMs << " ms, meshes " << assetCache.meshMs << " ms, total "
+		<< totalMs << " ms" << endl;
+
+	string coldPath = assetCacheDirectory + string("/cold_startup.txt");
+	if (assetCache.hits == 0) {
+		ofstream file(coldPath);
+		file << assetCache.textureMs << " " << assetCache.shaderMs << " " << assetCache.meshMs << endl;
+		return;
+	}
+	ifstream file(coldPath);
+	double coldTextureMs, coldShaderMs, coldMeshMs;
+	if (assetCache.misses == 0 && file >> coldTextureMs >> coldShaderMs >> coldMeshMs) {
+		double coldMs = coldTextureMs + coldShaderMs + coldMeshMs;
+		cout << "Cold cache startup was: textures " << coldTextureMs << " ms, shaders " << coldShaderMs << " ms, meshes " << coldMeshMs
+			<< " ms, total " << coldMs << " ms (warm is " << coldMs / max(totalMs, 1e-3) << "x faster)" << endl;
+	}
+}
+
+// ASSET CACHE END *******************************************************
+
+// MATERIALS START *******************************************************
+
+// Every scene texture is also a layer of one GL_TEXTURE_2D_ARRAY, so changing material between draws
+// is a layer index (a uniform here, per instance on the GPU culling path) rather than a texture bind.
+// Layers share one size, so sources of another size are resampled; unlike an atlas, layers never
+// bleed into each other at coarse mips, so no padding is needed.
+struct MaterialLibrary {
+	GLuint textureArray;
+	GLsizei layerSize;
+	vector<GLuint> textures; // the separate 2D texture of each layer, for the unbatched path
+	vector<CookedTextureHeader> headers; // full size and level count of each separate texture
+	vector<string> cachePaths;           // cooked texture each one streams from, empty if it cannot
+};
+
+MaterialLibrary materials;
+
+// How the CPU path picks each object's texture: 0 binds it, 1 draws from the texture array,
+// 2 reads a bindless handle (falls back to 1 when ARB_bindless_texture is missing)
+int materialMode = 1;
+const char* materialModeNames[3] = { "separate textures", "texture array", "bindless handles" };
+
+// Texture unit the array stays bound to, clear of the material, G-buffer and shadow units
+const GLint materialArrayUnit = 5;
+
+// Texture binds and layer changes of the last CPU path scene pass
+struct MaterialStats {
+	int textureBinds;
+	int layerChanges;
+};
+
+MaterialStats materialStats;
+
+// Bilinear resample of a tightly packed RGB8 image, wrapping at the edges like GL_REPEAT
+void resampleRgb(const GLubyte* source, int width, int height, GLubyte* target, int targetWidth, int targetHeight)
+{
+	for (int y = 0; y < targetHeight; y++) {
+		float sourceY = (y + 0.5f) * height / targetHeight - 0.5f;
+		int y0 = (int)floor(sourceY);
+		float fy = sourceY - y0;
+		const GLubyte* row0 = source + (size_t)((y0 + height) % height) * width * 3;
+		const GLubyte* row1 = source + (size_t)((y0 + 1) % height) * width * 3;
+		for (int x = 0; x < targetWidth; x++) {
+			float sourceX = (x + 0.5f) * width / targetWidth - 0.5f;
+			int x0 = (int)floor(sourceX);
+			float fx = sourceX - x0;
+			int c0 = (x0 + width) % width * 3, c1 = (x0 + 1) % width * 3;
+			for (int c = 0; c < 3; c++) {
+				float top = row0[c0 + c] + (row0[c1 + c] - row0[c0 + c]) * fx;
+				float bottom = row1[c0 + c] + (row1[c1 + c] - row1[c0 + c]) * fx;
+				target[((size_t)y * targetWidth + x) * 3 + c] = (GLubyte)(top + (bottom - top) * fy + 0.5f);
+			}
+		}
+	}
+}
+
+// Finest level of a texture no larger than size, the level streamed textures start from
+uint32_t firstLevelWithin(const CookedTextureHeader& header, uint32_t size)
+{
+	uint32_t level = 0;
+	while (level + 1 < header.levelCount && max(header.width >> level, header.height >> level) > size)
+		level++;
+	return level;
+}
+
+// Load every material texture through the asset cache as its own 2D texture and as one layer of
+// the array. The layer size is the largest source dimension rounded up to a power of two (at most 1024).
+// The separate textures only get their levels no larger than startSize; texture streaming brings in the rest.
+void loadMaterials(MaterialLibrary& library, const char* const* paths, int count, uint32_t startSize)
+{
+	auto start = chrono::high_resolution_clock::now();
+	vector<vector<char>> cooked(count);
+	CookedTextureHeader header;
+	library.layerSize = 1;
+	for (int i = 0; i < count; i++) {
+		string cachePath = loadCookedTexture(paths[i], cooked[i]);
+		memcpy(&header, cooked[i].data(), sizeof(header));
+		library.textures.push_back(uploadCookedTexture(cooked[i], cachePath.empty() ? 0 : firstLevelWithin(header, startSize)));
+		library.headers.push_back(header);
+		library.cachePaths.push_back(cachePath);
+		while (library.layerSize < 1024 && library.layerSize < (GLsizei)max(header.width, header.height))
+			library.layerSize *= 2;
+	}
+
+	GLsizei levelCount = 1;
+	for (GLsizei size = library.layerSize; size > 1; size /= 2)
+		levelCount++;
+
+	glGenTextures(1, &library.textureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, library.textureArray);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (isTextureStorageSupported) {
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGB8, library.layerSize, library.layerSize, count);
+	}
+	else {
+		for (GLsizei level = 0, size = library.layerSize; level < levelCount; level++, size = max(size / 2, 1))
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, size, size, count, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	}
+
+	vector<GLubyte> layer;
+	for (int i = 0; i < count; i++) {
+		memcpy(&header, cooked[i].data(), sizeof(header));
+		const GLubyte* level = reinterpret_cast<const GLubyte*>(cooked[i].data() + sizeof(header));
+		bool isLayerSized = header.width == (uint32_t)library.layerSize && header.height == (uint32_t)library.layerSize;
+
+		// A source of the layer size already has the chain; others are resampled and mipmapped again
+		if (!isLayerSized) {
+			layer.resize((size_t)library.layerSize * library.layerSize * 3 * 4 / 3 + 3);
+			resampleRgb(level, header.width, header.height, layer.data(), library.layerSize, library.layerSize);
+			generateMipChain(layer.data(), library.layerSize, library.layerSize, layer.data() + (size_t)library.layerSize * library.layerSize * 3);
+			level = layer.data();
+		}
+
+		for (GLsizei mip = 0, size = library.layerSize; mip < levelCount; mip++, size = max(size / 2, 1)) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, 0, i, size, size, 1, GL_RGB, GL_UNSIGNED_BYTE, level);
+			level += (size_t)size * size * 3;
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	// The array stays bound on its own unit for the whole run
+	glActiveTexture(GL_TEXTURE0 + materialArrayUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, library.textureArray);
+	glActiveTexture(GL_TEXTURE0);
+
+	assetCache.textureMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// Layer of a texture in the array, or -1 if it is not a material
+GLint materialLayer(const MaterialLibrary& library, GLuint texture)
+{
+	for (size_t i = 0; i < library.textures.size(); i++) {
+		if (library.textures[i] == texture)
+			return (GLint)i;
+	}
+	return -1;
+}
+
+void setMaterialSamplerUnit(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "materialTextures"), materialArrayUnit);
+	glUseProgram(0);
+}
+
+// Sampling state lives in shared sampler objects bound once per unit, not in each texture. Materials
+// (unit 0 and the array unit) repeat, since UVs run past 1, with trilinear and anisotropic filtering.
+// The G-buffer and shadow units clamp and filter nothing. The other passes on unit 0 only texelFetch,
+// which ignores the sampler.
+struct TextureSamplers {
+	GLuint material;
+	GLuint nearestClamp;
+	GLfloat anisotropy; // 1 without EXT_texture_filter_anisotropic
+};
+
+TextureSamplers samplers;
+
+// Anisotropy asked for where the driver allows it
+const GLfloat materialAnisotropy = 16.0f;
+
+void createSamplers()
+{
+	glGenSamplers(1, &samplers.material);
+	glSamplerParameteri(samplers.material, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glSamplerParameteri(samplers.material, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glSamplerParameteri(samplers.material, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(samplers.material, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	samplers.anisotropy = 1.0f;
+	if (GLEW_EXT_texture_filter_anisotropic) {
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &samplers.anisotropy);
+		samplers.anisotropy = min(max(samplers.anisotropy, 1.0f), materialAnisotropy);
+		glSamplerParameterf(samplers.material, GL_TEXTURE_MAX_ANISOTROPY_EXT, samplers.anisotropy);
+	}
+
+	glGenSamplers(1, &samplers.nearestClamp);
+	glSamplerParameteri(samplers.nearestClamp, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(samplers.nearestClamp, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(samplers.nearestClamp, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(samplers.nearestClamp, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glSamplerParameteri(samplers.nearestClamp, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glBindSampler(0, samplers.material);
+	glBindSampler(materialArrayUnit, samplers.material);
+	for (GLuint unit = 1; unit <= 4; unit++)
+		glBindSampler(unit, samplers.nearestClamp);
+}
+
+// Bindless path: the separate 2D textures keep their own sizes, their handles (with the material
+// sampler, since a bindless lookup does not go through a unit) are made resident
+// once and stored in layer order in a shader storage buffer that the scene shaders index with the
+// object's layer. The index must be the same across a draw, so this covers the CPU path (one
+// uniform per draw); the GPU culling path mixes materials within a draw and keeps the array.
+struct BindlessMaterials {
+	bool isSupported;
+	GLuint handleBuffer;
+	vector<GLuint64> handles;
+	GLuint forwardProgram;
+	GLuint geometryProgram;
+};
+
+BindlessMaterials bindless;
+
+// Storage buffer binding of the handle array, after the GPU culling buffers
+const GLuint materialHandleBinding = 5;
+
+// Make every material resident and upload the handles; false (and nothing resident) if the driver
+// hands out no handle
+bool makeMaterialsResident(BindlessMaterials& bindless, const MaterialLibrary& library)
+{
+	for (GLuint texture : library.textures) {
+		GLuint64 handle = glGetTextureSamplerHandleARB(texture, samplers.material);
+		if (handle == 0) {
+			for (GLuint64 resident : bindless.handles)
+				glMakeTextureHandleNonResidentARB(resident);
+			bindless.handles.clear();
+			return false;
+		}
+		glMakeTextureHandleResidentARB(handle);
+		bindless.handles.push_back(handle);
+	}
+
+	glGenBuffers(1, &bindless.handleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bindless.handleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bindless.handles.size() * sizeof(GLuint64), bindless.handles.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialHandleBinding, bindless.handleBuffer);
+	return true;
+}
+
+bool isProgramLinked(GLuint program)
+{
+	GLint isLinked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	return isLinked == GL_TRUE;
+}
+
+// MATERIALS END *******************************************************
+
+// TEXTURE STREAMING START *******************************************************
+
+// The separate material textures start with only their coarse levels resident. Every frame the draw
+// list records the finest level each drawn texture needs for its on screen size, and a loader thread
+// reads missing levels back from the cooked texture in the asset cache. Finer levels are swapped in
+// most needed first while they fit the budget; past it the least recently drawn textures fall back
+// to the levels they still need. A swap builds a new texture object holding the resident levels (its
+// level 0 is the finest), since a bindless handle freezes the texture it was taken from.
+// The material array keeps every layer resident, so only the separate texture and bindless paths stream.
+struct StreamedTexture {
+	uint32_t startLevel;    // coarse level loaded at startup and never evicted
+	uint32_t residentLevel; // finest level on the GPU
+	uint32_t targetLevel;   // level being loaded, residentLevel when idle
+	uint32_t requiredLevel; // finest level drawn this frame, UINT32_MAX if not drawn
+	long long lastDrawnFrame;
+	bool isStreamable;
+};
+
+// Levels read by the loader, from level down to 1 x 1; empty if the cooked texture could not be read
+struct StreamedLevels {
+	int texture;
+	uint32_t level;
+	vector<char> levels;
+};
+
+struct TextureStreamer {
+	vector<StreamedTexture> textures;
+	size_t budgetBytes = (size_t)256 << 20;
+	long long frame = 0;
+	thread loader;
+	mutex lock;
+	condition_variable wake;
+	vector<pair<int, uint32_t>> requests; // texture and level waiting for the loader
+	vector<StreamedLevels> loaded;        // read, waiting for the GL thread to upload
+	bool quit = false;
+	int uploads = 0;   // since the last stats print
+	int evictions = 0;
+};
+
+TextureStreamer textureStreamer;
+
+// Levels no larger than this are resident from startup
+const uint32_t streamingStartSize = 64;
+
+// Swaps per frame, so a burst of finished loads does not stall one frame
+const int streamingUploadsPerFrame = 2;
+
+void textureLoaderLoop()
+{
+	while (true) {
+		pair<int, uint32_t> request;
+		{
+			unique_lock<mutex> guard(textureStreamer.lock);
+			textureStreamer.wake.wait(guard, [] { return textureStreamer.quit || !textureStreamer.requests.empty(); });
+			if (textureStreamer.quit)
+				return;
+			request = textureStreamer.requests.front();
+			textureStreamer.requests.erase(textureStreamer.requests.begin());
+		}
+
+		// Read just the requested levels, after checking the file still holds the same texture
+		StreamedLevels result = { request.first, request.second, vector<char>() };
+		const CookedTextureHeader& header = materials.headers[request.first];
+		ifstream file(materials.cachePaths[request.first], ios::binary);
+		CookedTextureHeader fileHeader;
+		if (file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader)) && memcmp(&fileHeader, &header, sizeof(header)) == 0) {
+			result.levels.resize(mipChainBytes(header, request.second));
+			file.seekg(sizeof(header) + mipChainBytes(header, 0) - result.levels.size());
+			if (!file.read(result.levels.data(), result.levels.size()))
+				result.levels.clear();
+		}
+
+		lock_guard<mutex> guard(textureStreamer.lock);
+		textureStreamer.loaded.push_back(move(result));
+	}
+}
+
+void startTextureStreaming(const MaterialLibrary& library)
+{
+	for (size_t i = 0; i < library.textures.size(); i++) {
+		const CookedTextureHeader& header = library.headers[i];
+		uint32_t startLevel = library.cachePaths[i].empty() ? 0 : firstLevelWithin(header, streamingStartSize);
+		StreamedTexture streamed = { startLevel, startLevel, startLevel, UINT32_MAX, -1, !library.cachePaths[i].empty() };
+		textureStreamer.textures.push_back(streamed);
+	}
+	textureStreamer.loader = thread(textureLoaderLoop);
+}
+
+void stopTextureStreaming()
+{
+	{
+		lock_guard<mutex> guard(textureStreamer.lock);
+		textureStreamer.quit = true;
+	}
+	textureStreamer.wake.notify_all();
+	if (textureStreamer.loader.joinable())
+		textureStreamer.loader.join();
+}
+
+// Record that a material was drawn this frame spanning screenSize pixels, taken as the texture
+// spanning the part once, so a level is fine enough while it has at least a texel per pixel
+void noteTextureCoverage(GLint layer, float screenSize)
+{
+	if (layer < 0 || layer >= (GLint)textureStreamer.textures.size())
+		return;
+	StreamedTexture& streamed = textureStreamer.textures[layer];
+	const CookedTextureHeader& header = materials.headers[layer];
+	uint32_t level = 0;
+	for (float texels = (float)max(header.width, header.height); level + 1 < header.levelCount && texels * 0.5f >= screenSize; texels *= 0.5f)
+		level++;
+	streamed.requiredLevel = min(streamed.requiredLevel, level);
+	streamed.lastDrawnFrame = textureStreamer.frame;
+}
+
+void requestTextureLevel(int index, uint32_t level)
+{
+	textureStreamer.textures[index].targetLevel = level;
+	{
+		lock_guard<mutex> guard(textureStreamer.lock);
+		textureStreamer.requests.push_back(make_pair(index, level));
+	}
+	textureStreamer.wake.notify_one();
+}
+
+// Replace a material's texture with one holding the loaded levels, moving its bindless handle along
+void swapStreamedTexture(const StreamedLevels& loaded)
+{
+	GLuint texture = uploadMipChain(materials.headers[loaded.texture], loaded.level, loaded.levels.data());
+	if (!bindless.handles.empty()) {
+		GLuint64 handle = glGetTextureSamplerHandleARB(texture, samplers.material);
+		glMakeTextureHandleResidentARB(handle);
+		glMakeTextureHandleNonResidentARB(bindless.handles[loaded.texture]);
+		bindless.handles[loaded.texture] = handle;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bindless.handleBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, loaded.texture * sizeof(GLuint64), sizeof(GLuint64), &handle);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	glDeleteTextures(1, &materials.textures[loaded.texture]);
+	materials.textures[loaded.texture] = texture;
+	textureStreamer.textures[loaded.texture].residentLevel = loaded.level;
+	textureStreamer.uploads++;
+}
+
+// Bytes every texture will hold once its pending loads land, what the budget is checked against
+size_t committedTextureBytes()
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < textureStreamer.textures.size(); i++)
+		bytes += mipChainBytes(materials.headers[i], textureStreamer.textures[i].targetLevel);
+	return bytes;
+}
+
+size_t residentTextureBytes()
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < textureStreamer.textures.size(); i++)
+		bytes += mipChainBytes(materials.headers[i], textureStreamer.textures[i].residentLevel);
+	return bytes;
+}
+
+// Once per frame after the scene is drawn: upload finished loads, evict down to the budget, then
+// request finer levels for this frame's coverage, evicting least recently drawn levels when short
+void updateTextureStreaming()
+{
+	vector<StreamedLevels> loaded;
+	{
+		lock_guard<mutex> guard(textureStreamer.lock);
+		size_t count = min(textureStreamer.loaded.size(), (size_t)streamingUploadsPerFrame);
+		move(textureStreamer.loaded.begin(), textureStreamer.loaded.begin() + count, back_inserter(loaded));
+		textureStreamer.loaded.erase(textureStreamer.loaded.begin(), textureStreamer.loaded.begin() + count);
+	}
+	for (const StreamedLevels& levels : loaded) {
+		StreamedTexture& streamed = textureStreamer.textures[levels.texture];
+		if (levels.levels.empty()) {
+			cout << "Cannot stream " << materials.cachePaths[levels.texture] << endl;
+			streamed.isStreamable = false;
+			streamed.targetLevel = streamed.residentLevel;
+		}
+		else {
+			swapStreamedTexture(levels);
+		}
+	}
+
+	// A lowered budget has to shrink what is resident even when nothing wants a finer level: drop the
+	// least recently drawn textures to what they still need (at most their start level), or one level
+	// coarser if they need all they have, until the committed bytes fit
+	size_t committed = committedTextureBytes();
+	while (committed > textureStreamer.budgetBytes) {
+		int victim = -1;
+		for (int i = 0; i < (int)textureStreamer.textures.size(); i++) {
+			const StreamedTexture& candidate = textureStreamer.textures[i];
+			bool isEvictable = candidate.isStreamable && candidate.targetLevel == candidate.residentLevel
+				&& candidate.residentLevel < candidate.startLevel;
+			if (isEvictable && (victim < 0 || candidate.lastDrawnFrame < textureStreamer.textures[victim].lastDrawnFrame))
+				victim = i;
+		}
+		if (victim < 0)
+			break;
+		StreamedTexture& evicted = textureStreamer.textures[victim];
+		const CookedTextureHeader& header = materials.headers[victim];
+		uint32_t level = max(min(evicted.requiredLevel, evicted.startLevel), evicted.residentLevel + 1);
+		committed -= mipChainBytes(header, evicted.targetLevel) - mipChainBytes(header, level);
+		requestTextureLevel(victim, level);
+		textureStreamer.evictions++;
+	}
+
+	// Most needed first: the most levels short of what was drawn
+	vector<int> upgrades;
+	for (int i = 0; i < (int)textureStreamer.textures.size(); i++) {
+		const StreamedTexture& streamed = textureStreamer.textures[i];
+		if (streamed.isStreamable && streamed.targetLevel == streamed.residentLevel && streamed.requiredLevel < streamed.residentLevel)
+			upgrades.push_back(i);
+	}
+	sort(upgrades.begin(), upgrades.end(), [](int a, int b) {
+		const StreamedTexture& first = textureStreamer.textures[a];
+		const StreamedTexture& second = textureStreamer.textures[b];
+		return first.residentLevel - first.requiredLevel > second.residentLevel - second.requiredLevel;
+	});
+
+	for (int index : upgrades) {
+		StreamedTexture& streamed = textureStreamer.textures[index];
+		const CookedTextureHeader& header = materials.headers[index];
+
+		// Evict idle textures, least recently drawn first, down to what they still need (their start
+		// level if they were not drawn this frame) until the wanted level fits
+		while (committed + mipChainBytes(header, streamed.requiredLevel) - mipChainBytes(header, streamed.targetLevel) > textureStreamer.budgetBytes) {
+			int victim = -1;
+			for (int i = 0; i < (int)textureStreamer.textures.size(); i++) {
+				const StreamedTexture& candidate = textureStreamer.textures[i];
+				bool isEvictable = candidate.isStreamable && candidate.targetLevel == candidate.residentLevel
+					&& min(candidate.requiredLevel, candidate.startLevel) > candidate.residentLevel;
+				if (i != index && isEvictable && (victim < 0 || candidate.lastDrawnFrame < textureStreamer.textures[victim].lastDrawnFrame))
+					victim = i;
+			}
+			if (victim < 0)
+				break;
+			StreamedTexture& evicted = textureStreamer.textures[victim];
+			size_t residentBytes = mipChainBytes(materials.headers[victim], evicted.residentLevel);
+			requestTextureLevel(victim, min(evicted.requiredLevel, evicted.startLevel));
+			committed -= residentBytes - mipChainBytes(materials.headers[victim], evicted.targetLevel);
+			textureStreamer.evictions++;
+		}
+
+		// Settle for the finest level that fits
+		uint32_t level = streamed.requiredLevel;
+		while (level < streamed.residentLevel && committed + mipChainBytes(header, level) - mipChainBytes(header, streamed.residentLevel) > textureStreamer.budgetBytes)
+			level++;
+		if (level < streamed.residentLevel) {
+			committed += mipChainBytes(header, level) - mipChainBytes(header, streamed.residentLevel);
+			requestTextureLevel(index, level);
+		}
+	}
+
+	for (StreamedTexture& streamed : textureStreamer.textures)
+		streamed.requiredLevel = UINT32_MAX;
+	textureStreamer.frame++;
+}
+
+// TEXTURE STREAMING END *******************************************************
+
+// Create and Compile Shaders
+static GLuint CompileShader(const string& source, GLuint shaderType)
+{
+	// Create Shader object
+	GLuint shaderID = glCreateShader(shaderType);
+	const char* src = source.c_str();
+
+	// Attach source code to Shader object
+	glShaderSource(shaderID, 1, &src, nullptr);
+
+	// Compile Shader
+	glCompileShader(shaderID);
+
+	// Return ID of Compiled shader
+	return shaderID;
+
+}
+
+// Create Program Object
+static GLuint CreateShaderProgram(const string& vertexShader, const string& fragmentShader)
+{
+	// A cached binary for this driver skips compiling and linking
+	auto start = chrono::high_resolution_clock::now();
+	string sources[2] = { vertexShader, fragmentShader };
+	uint64_t key = programCacheKey(sources, 2);
+	GLuint cachedProgram = loadProgramBinary(key);
+	if (cachedProgram) {
+		assetCache.shaderMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		return cachedProgram;
+	}
+
+	// Compile vertex shader
+	GLuint vertexShaderComp = CompileShader(vertexShader, GL_VERTEX_SHADER);
+
+	// Compile fragment shader
+	GLuint fragmentShaderComp = CompileShader(fragmentShader, GL_FRAGMENT_SHADER);
+
+	// Create program object
+	GLuint shaderProgram = glCreateProgram();
+
+	// Attach vertex and fragment shaders to program object
+	glAttachShader(shaderProgram, vertexShaderComp);
+	glAttachShader(shaderProgram, fragmentShaderComp);
+
+	// Link shaders to create executable
+	if (isProgramBinarySupported)
+		glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(shaderProgram);
+
+	// Delete compiled vertex and fragment shaders
+	glDeleteShader(vertexShaderComp);
+	glDeleteShader(fragmentShaderComp);
+
+	storeProgramBinary(key, shaderProgram);
+	assetCache.shaderMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	// Return Shader Program
+	return shaderProgram;
+
+}
+
+// Create Compute Program Object
+static GLuint CreateComputeProgram(const string& computeShader)
+{
+	auto start = chrono::high_resolution_clock::now();
+	uint64_t key = programCacheKey(&computeShader, 1);
+	GLuint cachedProgram = loadProgramBinary(key);
+	if (cachedProgram) {
+		assetCache.shaderMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		return cachedProgram;
+	}
+
+	// Compile compute shader
+	GLuint computeShaderComp = CompileShader(computeShader, GL_COMPUTE_SHADER);
+
+	// Create program object, attach and link
+	GLuint computeProgram = glCreateProgram();
+	glAttachShader(computeProgram, computeShaderComp);
+	if (isProgramBinarySupported)
+		glProgramParameteri(computeProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(computeProgram);
+
+	// Delete compiled compute shader
+	glDeleteShader(computeShaderComp);
+
+	storeProgramBinary(key, computeProgram);
+	assetCache.shaderMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	// Return Compute Program
+	return computeProgram;
+
+}
+
+// DYNAMIC RING START *******************************************************
+
+// Per frame data (the forward light list, GPU culling's counter resets) is written into one buffer
+// split in three frame segments, so the CPU fills one segment while the GPU may still read the two
+// before it. Each frame bump allocates aligned ranges from its segment and fences it at the end; a
+// segment is only reused once its fence has signaled. A frame that outgrows its segment carries on
+// in the next one, so every range it handed out stays valid until its commands are done with it.
+// Past the whole ring (or for one range larger than a segment) the frame falls back to temporary
+// buffers, and the ring grows to fit such a frame at the next frame boundary. With GL 4.4 or
+// ARB_buffer_storage the buffer is persistently and coherently mapped, so a write is the whole
+// upload. Otherwise writes go to a CPU copy and commitDynamic uploads each range with glBufferSubData.
+const int dynamicSegmentCount = 3;
+const GLsizeiptr dynamicSegmentStartSize = 1 << 20;
+
+struct DynamicRing {
+	GLuint buffer;
+	char* mapped;           // persistent mapping, or the CPU copy
+	vector<char> staging;
+	bool isPersistent;
+	GLint uniformAlignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for ranges bound as uniform blocks
+	GLsizeiptr segmentSize = dynamicSegmentStartSize;
+	GLsizeiptr grownSize;   // segment size to grow to at the next frame boundary, after a frame spilled out
+	int segment;
+	int firstSegment;       // segment the frame started in, when it spilled over into the following ones
+	GLsizeiptr head;        // next free byte in the current segment
+	GLsizeiptr spilled;     // bytes the frame used outside the current segment
+	GLsync fences[dynamicSegmentCount];
+	vector<GLuint> spillBuffers;        // this frame's temporary buffers, deleted once it is submitted
+	vector<vector<char>> spillStaging;  // and their CPU copies
+	GLsizeiptr frameBytes;  // most bytes one frame used since the last stats print
+	int fenceWaits;         // frames that had to wait for the GPU to release their segment
+	int overflows;          // allocations that did not fit their segment, moved on to the next or spilled
+};
+
+DynamicRing dynamicRing;
+
+struct DynamicAllocation {
+	GLuint buffer;          // the ring, or a temporary buffer when the frame outgrew the ring
+	GLintptr offset;
+	GLsizeiptr size;
+	void* data;
+};
+
+void createDynamicRing()
+{
+	GLsizeiptr size = dynamicRing.segmentSize * dynamicSegmentCount;
+	glGenBuffers(1, &dynamicRing.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, dynamicRing.buffer);
+	dynamicRing.isPersistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	if (dynamicRing.isPersistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+		dynamicRing.mapped = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+		dynamicRing.isPersistent = dynamicRing.mapped != nullptr;
+	}
+	if (!dynamicRing.isPersistent) {
+		glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		dynamicRing.staging.assign(size, 0);
+		dynamicRing.mapped = dynamicRing.staging.data();
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &dynamicRing.uniformAlignment);
+	dynamicRing.uniformAlignment = max(dynamicRing.uniformAlignment, 16);
+}
+
+void destroyDynamicRing()
+{
+	for (GLsync& fence : dynamicRing.fences) {
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+	if (dynamicRing.isPersistent) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, dynamicRing.buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &dynamicRing.buffer);
+}
+
+// Move the frame on to the next segment, once the GPU is done with what it last held
+void enterDynamicSegment()
+{
+	dynamicRing.segment = (dynamicRing.segment + 1) % dynamicSegmentCount;
+	dynamicRing.head = 0;
+
+	GLsync& fence = dynamicRing.fences[dynamicRing.segment];
+	if (!fence)
+		return;
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		dynamicRing.fenceWaits++;
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			;
+	}
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+void beginDynamicFrame()
+{
+	// The last frame spilled out of the ring: once the GPU is done with it, recreate it large enough
+	if (dynamicRing.grownSize > dynamicRing.segmentSize) {
+		glFinish();
+		destroyDynamicRing();
+		dynamicRing.segmentSize = dynamicRing.grownSize;
+		createDynamicRing();
+	}
+	dynamicRing.grownSize = 0;
+
+	enterDynamicSegment();
+	dynamicRing.firstSegment = dynamicRing.segment;
+	dynamicRing.spilled = 0;
+}
+
+// Fence every segment the frame wrote to; its temporary buffers are deleted now that every command
+// reading them is queued (GL keeps their storage until those commands are done)
+void endDynamicFrame()
+{
+	dynamicRing.frameBytes = max(dynamicRing.frameBytes, dynamicRing.spilled + dynamicRing.head);
+	for (int segment = dynamicRing.firstSegment; ; segment = (segment + 1) % dynamicSegmentCount) {
+		dynamicRing.fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (segment == dynamicRing.segment)
+			break;
+	}
+
+	if (!dynamicRing.spillBuffers.empty()) {
+		glDeleteBuffers((GLsizei)dynamicRing.spillBuffers.size(), dynamicRing.spillBuffers.data());
+		dynamicRing.spillBuffers.clear();
+		dynamicRing.spillStaging.clear();
+	}
+}
+
+// A range in a temporary buffer of its own, for a frame the ring cannot hold, and a ring the whole
+// frame fits in one segment of from the next frame on
+DynamicAllocation spillDynamic(GLsizeiptr size)
+{
+	dynamicRing.overflows++;
+	dynamicRing.spilled += size;
+	GLsizeiptr grownSize = dynamicRing.segmentSize;
+	while (grownSize < dynamicRing.spilled + dynamicRing.head)
+		grownSize *= 2;
+	dynamicRing.grownSize = max(dynamicRing.grownSize, grownSize);
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	dynamicRing.spillBuffers.push_back(buffer);
+	dynamicRing.spillStaging.push_back(vector<char>(size));
+
+	DynamicAllocation allocation;
+	allocation.buffer = buffer;
+	allocation.offset = 0;
+	allocation.size = size;
+	allocation.data = dynamicRing.spillStaging.back().data();
+	return allocation;
+}
+
+// Bump allocate an aligned range of this frame's segment, or of the next one when it is full, or
+// spill to a temporary buffer once the frame has been through every segment
+DynamicAllocation allocateDynamic(GLsizeiptr size, GLsizeiptr alignment)
+{
+	GLsizeiptr offset = (dynamicRing.head + alignment - 1) / alignment * alignment;
+	if (offset + size > dynamicRing.segmentSize) {
+		bool isRingFull = (dynamicRing.segment + 1) % dynamicSegmentCount == dynamicRing.firstSegment;
+		if (size > dynamicRing.segmentSize || isRingFull)
+			return spillDynamic(size);
+		dynamicRing.overflows++;
+		dynamicRing.spilled += dynamicRing.head;
+		enterDynamicSegment();
+		offset = 0;
+	}
+	dynamicRing.head = offset + size;
+
+	DynamicAllocation allocation;
+	allocation.buffer = dynamicRing.buffer;
+	allocation.offset = dynamicRing.segment * dynamicRing.segmentSize + offset;
+	allocation.size = size;
+	allocation.data = dynamicRing.mapped + allocation.offset;
+	return allocation;
+}
+
+// Make a written range visible to the GPU; nothing to do when it is in the coherently mapped ring
+void commitDynamic(const DynamicAllocation& allocation)
+{
+	if (dynamicRing.isPersistent && allocation.buffer == dynamicRing.buffer)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, allocation.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, allocation.size, allocation.data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Copy a written range into another buffer on the GPU, for data a shader then overwrites
+void copyDynamic(const DynamicAllocation& allocation, GLenum target, GLuint buffer, GLintptr offset)
+{
+	commitDynamic(allocation);
+	glBindBuffer(GL_COPY_READ_BUFFER, allocation.buffer);
+	glBindBuffer(target, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, target, allocation.offset, offset, allocation.size);
+	glBindBuffer(target, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+// DYNAMIC RING END *******************************************************
+
+// FRAME ARENA START *******************************************************
+
+// What a frame builds on the CPU (object lists, visible sets, draw items, cluster draw ranges) is bump
+// allocated from a linear arena that is reset instead of freed. The frame thread alternates between two
+// arenas, so whatever the previous frame built stays readable for one more frame; every other thread
+// gets its own arena for job scratch, reset the first time it allocates in a new frame. An arena that
+// runs out hands out heap blocks for the rest of the frame and grows to cover the frame at its next
+// reset, so a steady state frame makes no heap allocations; operator new counts them to show it.
+const size_t frameArenaStartSize = 256 << 10;
+
+struct LinearArena {
+	vector<char> memory;
+	size_t head;
+	size_t overflowBytes;    // asked for after the arena was full
+	vector<void*> overflow;  // the heap blocks those went to, freed at the next reset
+	long long frame;         // frame the arena was last reset for
+};
+
+struct FrameArenas {
+	LinearArena arenas[2];
+	long long frame;
+	thread::id frameThread;
+	size_t peakBytes;                   // most bytes one frame needed since the last stats print
+	int overflows;                      // frames that outgrew their arena since the last stats print
+	long long heapAllocationsAtStart;
+	long long frameHeapAllocations;     // in the last whole frame, on every thread
+};
+
+FrameArenas frameArenas;
+atomic<long long> heapAllocations(0);
+thread_local LinearArena workerArena;
+
+// Every new on every thread is counted (the worker pool, the texture loader and the libraries included).
+// All forms of new and delete are replaced, over-aligned ones included, so each block goes back
+// through the same pair. GCC warns when an inlined delete frees memory that came from operator new
+// without seeing that this operator new is malloc; the pairing is right, so that warning is off for
+// these only.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	if (void* memory = malloc(size > 0 ? size : 1))
+		return memory;
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return ::operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t& tag) noexcept
+{
+	return ::operator new(size, tag);
+}
+
+// Over-aligned types; aligned_alloc wants the size in whole alignments, MSVC has its own pair
+void* allocateAligned(size_t size, size_t alignment)
+{
+	size = (max(size, (size_t)1) + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	return aligned_alloc(alignment, size);
+#endif
+}
+
+void freeAligned(void* memory)
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	if (void* memory = allocateAligned(size, (size_t)alignment))
+		return memory;
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+	return ::operator new(size, alignment);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	return allocateAligned(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t& tag) noexcept
+{
+	return ::operator new(size, alignment, tag);
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, const nothrow_t&) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory, const nothrow_t&) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, align_val_t) noexcept
+{
+	freeAligned(memory);
+}
+
+void operator delete[](void* memory, align_val_t) noexcept
+{
+	freeAligned(memory);
+}
+
+void operator delete(void* memory, size_t, align_val_t) noexcept
+{
+	freeAligned(memory);
+}
+
+void operator delete[](void* memory, size_t, align_val_t) noexcept
+{
+	freeAligned(memory);
+}
+
+void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept
+{
+	freeAligned(memory);
+}
+
+void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept
+{
+	freeAligned(memory);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+void* allocateLinear(LinearArena& arena, size_t size, size_t alignment)
+{
+	uintptr_t base = (uintptr_t)arena.memory.data();
+	size_t offset = (size_t)(((base + arena.head + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+	if (offset + size <= arena.memory.size()) {
+		arena.head = offset + size;
+		return arena.memory.data() + offset;
+	}
+	arena.overflowBytes += size + alignment;
+	arena.overflow.push_back(::operator new(size));
+	return arena.overflow.back();
+}
+
+// Start a frame in the arena, first growing it by whatever the last frame in it had to take from the heap
+void resetLinear(LinearArena& arena, long long frame)
+{
+	if (!arena.overflow.empty() || arena.memory.empty()) {
+		size_t size = max(arena.memory.size(), frameArenaStartSize);
+		while (size < arena.head + arena.overflowBytes)
+			size *= 2;
+		for (void* memory : arena.overflow)
+			::operator delete(memory);
+		arena.overflow.clear();
+		arena.memory.resize(size);
+	}
+	arena.head = 0;
+	arena.overflowBytes = 0;
+	arena.frame = frame;
+}
+
+// Called by the frame thread before it builds anything for the frame
+void beginFrameArena()
+{
+	LinearArena& finished = frameArenas.arenas[frameArenas.frame & 1];
+	frameArenas.peakBytes = max(frameArenas.peakBytes, finished.head + finished.overflowBytes);
+	frameArenas.overflows += finished.overflow.empty() ? 0 : 1;
+	long long allocations = heapAllocations.load(memory_order_relaxed);
+	frameArenas.frameHeapAllocations = allocations - frameArenas.heapAllocationsAtStart;
+	frameArenas.heapAllocationsAtStart = allocations;
+
+	frameArenas.frame++;
+	frameArenas.frameThread = this_thread::get_id();
+	resetLinear(frameArenas.arenas[frameArenas.frame & 1], frameArenas.frame);
+}
+
+// The calling thread's arena for this frame: the frame thread's current one, or the thread's own
+LinearArena& threadFrameArena()
+{
+	if (this_thread::get_id() == frameArenas.frameThread)
+		return frameArenas.arenas[frameArenas.frame & 1];
+	if (workerArena.frame != frameArenas.frame || workerArena.memory.empty())
+		resetLinear(workerArena, frameArenas.frame);
+	return workerArena;
+}
+
+// STL allocator over a linear arena, by default the calling thread's arena for this frame. Freeing is a
+// no-op; the memory comes back when the arena resets, so a container must not outlive its frame
+template <typename T>
+struct FrameAllocator {
+	typedef T value_type;
+	typedef true_type propagate_on_container_move_assignment;
+
+	LinearArena* arena;
+
+	FrameAllocator() : arena(&threadFrameArena()) {}
+	FrameAllocator(LinearArena& arena) : arena(&arena) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(allocateLinear(*arena, count * sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena == b.arena; }
+
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena != b.arena; }
+
+template <typename T>
+using FrameVector = vector<T, FrameAllocator<T>>;
+
+// FRAME ARENA END *******************************************************
+
+// SCENE OBJECTS START *******************************************************
+
+// Cluster of consecutive triangles of a large mesh, see MESHLETS
+struct Meshlet {
+	GLsizei firstIndex;   // relative to the mesh's first index
+	GLsizei indexCount;
+	glm::vec3 center;     // bounding sphere, mesh space
+	float radius;
+	glm::vec3 coneAxis;   // average facing; every triangle normal is within the cone around it
+	float coneCutoff;     // sine of the cone's half angle, 1 when the cone is too wide to cull
+};
+
+// CPU copy of a mesh uploaded to a VAO (11 floats per vertex, indices relative to the mesh's first vertex).
+// Triangle lists are what the CPU side (occlusion, simplification, optimization) understands; strips
+// split by the primitive restart index are only drawn.
+struct Mesh {
+	GLuint vao;
+	GLenum mode;             // GL_TRIANGLES or GL_TRIANGLE_STRIP
+	GLsizei indexCount;
+	const GLfloat* vertices;
+	GLsizei vertexCount;
+	const GLvoid* indices;   // GLubyte, GLushort or GLuint, see indexType
+	GLenum indexType;
+	GLsizeiptr indexOffset;  // byte offset of the first index in the VAO's element buffer
+	GLint baseVertex;        // first vertex in the VAO's vertex buffer
+	const Meshlet* meshlets; // clusters covering the index range in order, if the mesh was split
+	GLsizei meshletCount;
+};
+
+GLsizeiptr indexTypeSize(GLenum type)
+{
+	if (type == GL_UNSIGNED_INT)
+		return sizeof(GLuint);
+	if (type == GL_UNSIGNED_SHORT)
+		return sizeof(GLushort);
+	return sizeof(GLubyte);
+}
+
+// The largest value of an index type ends a strip, the same value GL_PRIMITIVE_RESTART_FIXED_INDEX uses
+GLuint restartIndex(GLenum type)
+{
+	if (type == GL_UNSIGNED_INT)
+		return 0xFFFFFFFFu;
+	if (type == GL_UNSIGNED_SHORT)
+		return 0xFFFFu;
+	return 0xFFu;
+}
+
+// Narrowest index type that can address every vertex of a mesh relative to its base vertex,
+// leaving the restart value free when the mesh uses it
+GLenum selectIndexType(GLsizei vertexCount, bool isRestart)
+{
+	GLuint largest = vertexCount > 0 ? (GLuint)vertexCount - 1 : 0;
+	if (largest < 0xFFu || (!isRestart && largest == 0xFFu))
+		return GL_UNSIGNED_BYTE;
+	if (largest < 0xFFFFu || (!isRestart && largest == 0xFFFFu))
+		return GL_UNSIGNED_SHORT;
+	return GL_UNSIGNED_INT;
+}
+
+// Read one index from a mesh's CPU copy
+GLuint meshIndex(const Mesh& mesh, GLsizei i)
+{
+	if (mesh.indexType == GL_UNSIGNED_INT)
+		return static_cast<const GLuint*>(mesh.indices)[i];
+	if (mesh.indexType == GL_UNSIGNED_SHORT)
+		return static_cast<const GLushort*>(mesh.indices)[i];
+	return static_cast<const GLubyte*>(mesh.indices)[i];
+}
+
+// Draw a whole mesh (its VAO must be bound). Restart is only switched on around strips, since a list
+// packed at its full width may use the restart value as a real index.
+void drawMesh(const Mesh& mesh)
+{
+	bool isRestart = mesh.mode != GL_TRIANGLES;
+	if (isRestart) {
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(restartIndex(mesh.indexType));
+	}
+	glDrawElementsBaseVertex(mesh.mode, mesh.indexCount, mesh.indexType, (GLvoid*)mesh.indexOffset, mesh.baseVertex);
+	if (isRestart)
+		glDisable(GL_PRIMITIVE_RESTART);
+}
+
+// Tessellation levels of a generated mesh, finest first, with the smallest on screen diameter
+// (pixels) each level is drawn at; the coarsest level has no lower limit
+const int maxLodLevels = 4;
+
+struct MeshLods {
+	const Mesh* levels[maxLodLevels];
+	float minScreenSize[maxLodLevels];
+	int levelCount;
+};
+
+// One textured object made of one or more transformed copies (parts) of a mesh
+struct SceneObject {
+	const Mesh* mesh;
+	GLuint texture;
+	glm::vec3 objectColor;
+	vector<glm::mat4> parts;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	bool isOccluder;
+	vector<glm::vec3> partCenters; // world space bounds center of each part, for depth sorting
+	const MeshLods* lods;          // null when the mesh has a single level, otherwise levels[0] is mesh
+	vector<float> partRadii;       // world space bounding sphere radius of each part, for LOD selection
+	vector<int> partLods;          // level each part was last drawn at, kept between frames for hysteresis
+	GLint materialLayer;           // texture's layer in the material array, -1 if it is not a material
+	int shadowFaces;               // shadow cube faces (bit light * 6 + face) the object was last found in
+	bool isShadowDirty;            // parts moved since the shadow maps last saw the object, set by computeBounds
+	int shadowUpdate;              // last shadow map update the object was a caster in
+};
+
+// Coarsest level of an object's mesh, also a conservative occluder since it is inscribed in the finest
+const Mesh* coarsestMesh(const SceneObject& object)
+{
+	return object.lods ? object.lods->levels[object.lods->levelCount - 1] : object.mesh;
+}
+
+// Grow a world space bounding box by one transformed copy of a mesh
+void growPartBounds(const Mesh& mesh, const glm::mat4& part, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	for (GLsizei v = 0; v < mesh.vertexCount; v++) {
+		const GLfloat* position = mesh.vertices + v * 11;
+		glm::vec3 world = glm::vec3(part * glm::vec4(position[0], position[1], position[2], 1.0f));
+		boundsMin = glm::min(boundsMin, world);
+		boundsMax = glm::max(boundsMax, world);
+	}
+}
+
+// Fit a world space bounding box around every part of an object
+void computeBounds(SceneObject& object)
+{
+	object.boundsMin = glm::vec3(1e30f);
+	object.boundsMax = glm::vec3(-1e30f);
+
+	object.partCenters.clear();
+	object.partRadii.clear();
+	object.partLods.assign(object.parts.size(), 0);
+	for (const glm::mat4& part : object.parts) {
+		glm::vec3 partMin(1e30f), partMax(-1e30f);
+		growPartBounds(*object.mesh, part, partMin, partMax);
+		object.partCenters.push_back((partMin + partMax) * 0.5f);
+		object.partRadii.push_back(glm::length(partMax - partMin) * 0.5f);
+		object.boundsMin = glm::min(object.boundsMin, partMin);
+		object.boundsMax = glm::max(object.boundsMax, partMax);
+	}
+	object.isShadowDirty = true;
+}
+
+// Extract the six frustum planes (xyz = inward normal, w = distance) from a view projection matrix
+void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	planes[0] = row[3] + row[0]; // left
+	planes[1] = row[3] - row[0]; // right
+	planes[2] = row[3] + row[1]; // bottom
+	planes[3] = row[3] - row[1]; // top
+	planes[4] = row[3] + row[2]; // near
+	planes[5] = row[3] - row[2]; // far
+
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// SCENE OBJECTS END *******************************************************
+
+// JOB SYSTEM START *******************************************************
+
+// Work stealing scheduler shared by the frame (occlusion, draw list building) and by startup work (mesh
+// building, import, mip generation). Every worker owns a deque of jobs; slot 0 belongs to the threads
+// outside the pool (the frame thread, the texture loader). A thread pushes and pops at the back of its
+// own deque, newest first while its data is still in cache, and once that is empty steals the oldest
+// job from the front of another deque, which is the largest piece left of a split range. Dependencies
+// are continuation style: a job counts its JobCounter down when it finishes, the last one pushes the
+// counter's continuation if it has one, and waiting on a counter runs other jobs instead of blocking.
+// A job is a function pointer and a range, so queuing one never allocates.
+const int maxJobThreads = 32;
+const int jobQueueSize = 1024;
+
+struct JobCounter;
+
+struct Job {
+	void (*run)(const void* data, int begin, int end);
+	const void* data;
+	int begin;
+	int end;
+	JobCounter* counter;
+};
+
+struct JobCounter {
+	atomic<int> pending;
+	Job continuation;  // pushed by whichever thread finishes the last pending job, if run is set
+
+	JobCounter() : pending(0), continuation() {}
+};
+
+struct JobQueue {
+	mutex lock;
+	Job jobs[jobQueueSize];  // ring, count jobs from front
+	int front = 0;
+	int count = 0;
+};
+
+struct JobSystem {
+	vector<thread> threads;
+	int slotCount = 1;  // deques in use, the workers' and slot 0; fixed while workers run
+	JobQueue queues[maxJobThreads];
+	atomic<int> queuedJobs;
+	atomic<int> sleeping;
+	mutex sleepLock;
+	condition_variable wake;
+	bool quit = false;
+	atomic<long long> jobsRun;
+	atomic<long long> jobsStolen;
+};
+
+JobSystem jobSystem;
+thread_local int jobThreadSlot = 0;
+
+void executeJob(const Job& job);
+
+void pushJob(const Job& job)
+{
+	JobQueue& queue = jobSystem.queues[jobThreadSlot];
+	bool isQueued = false;
+	{
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.count < jobQueueSize) {
+			queue.jobs[(queue.front + queue.count) % jobQueueSize] = job;
+			queue.count++;
+			isQueued = true;
+		}
+	}
+	// A full deque runs the job right away, which keeps the order a single thread would use
+	if (!isQueued) {
+		executeJob(job);
+		return;
+	}
+
+	jobSystem.queuedJobs++;
+	if (jobSystem.sleeping.load() > 0) {
+		{ lock_guard<mutex> guard(jobSystem.sleepLock); }
+		jobSystem.wake.notify_one();
+	}
+}
+
+// Newest job of the thread's own deque, else the oldest of the first other deque that has one
+bool takeJob(Job& job)
+{
+	for (int i = 0; i < jobSystem.slotCount; i++) {
+		int slot = (jobThreadSlot + i) % jobSystem.slotCount;
+		JobQueue& queue = jobSystem.queues[slot];
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.count == 0)
+			continue;
+		if (i == 0) {
+			job = queue.jobs[(queue.front + queue.count - 1) % jobQueueSize];
+		}
+		else {
+			job = queue.jobs[queue.front];
+			queue.front = (queue.front + 1) % jobQueueSize;
+			jobSystem.jobsStolen.fetch_add(1, memory_order_relaxed);
+		}
+		queue.count--;
+		jobSystem.queuedJobs--;
+		return true;
+	}
+	return false;
+}
+
+void executeJob(const Job& job)
+{
+	job.run(job.data, job.begin, job.end);
+	jobSystem.jobsRun.fetch_add(1, memory_order_relaxed);
+	if (!job.counter)
+		return;
+
+	// The waiter may return (and drop the counter) as soon as pending reaches zero, so read the continuation first
+	Job continuation = job.counter->continuation;
+	if (job.counter->pending.fetch_sub(1) == 1 && continuation.run)
+		pushJob(continuation);
+}
+
+bool runOneJob()
+{
+	Job job;
+	if (!takeJob(job))
+		return false;
+	executeJob(job);
+	return true;
+}
+
+// Help with any queued job until the counter's jobs are all done
+void waitForJobs(JobCounter& counter)
+{
+	while (counter.pending.load() > 0) {
+		if (!runOneJob())
+			this_thread::yield();
+	}
+}
+
+void jobWorkerLoop(int slot)
+{
+	jobThreadSlot = slot;
+	while (true) {
+		if (runOneJob())
+			continue;
+
+		unique_lock<mutex> guard(jobSystem.sleepLock);
+		jobSystem.sleeping++;
+		jobSystem.wake.wait(guard, [] { return jobSystem.quit || jobSystem.queuedJobs.load() > 0; });
+		jobSystem.sleeping--;
+		if (jobSystem.quit)
+			return;
+	}
+}
+
+// Start count workers, by default one less than the cores so the calling thread has one to itself
+void startJobWorkers(int count = -1)
+{
+	if (count < 0) {
+		unsigned int cores = thread::hardware_concurrency();
+		count = cores > 1 ? (int)cores - 1 : 0;
+	}
+	count = min(count, maxJobThreads - 1);
+
+	jobSystem.quit = false;
+	jobSystem.slotCount = count + 1;
+	for (int i = 0; i < count; i++)
+		jobSystem.threads.push_back(thread(jobWorkerLoop, i + 1));
+}
+
+void stopJobWorkers()
+{
+	{
+		lock_guard<mutex> guard(jobSystem.sleepLock);
+		jobSystem.quit = true;
+	}
+	jobSystem.wake.notify_all();
+
+	for (thread& worker : jobSystem.threads)
+		worker.join();
+	jobSystem.threads.clear();
+	jobSystem.slotCount = 1;
+}
+
+// Range [begin, end) of a parallel loop: halves are split off for other threads to steal until one
+// grain is left, which runs here
+template <typename Body>
+struct ParallelLoop {
+	const Body* body;
+	int grain;
+	JobCounter* counter;
+};
+
+template <typename Body>
+void runParallelRange(const void* data, int begin, int end)
+{
+	const ParallelLoop<Body>& loop = *static_cast<const ParallelLoop<Body>*>(data);
+	while (end - begin > loop.grain) {
+		int middle = begin + (end - begin) / 2;
+		loop.counter->pending++;
+		Job upper = { runParallelRange<Body>, data, middle, end, loop.counter };
+		pushJob(upper);
+		end = middle;
+	}
+	(*loop.body)(begin, end);
+}
+
+// Job running body(begin, end) over [0, count) in pieces of at least grain; the loop, the body and the
+// counter must outlive it
+template <typename Body>
+Job parallelJob(const ParallelLoop<Body>& loop, int count)
+{
+	loop.counter->pending++;
+	Job job = { runParallelRange<Body>, &loop, 0, count, loop.counter };
+	return job;
+}
+
+// body(begin, end) over [0, count) on every thread, returning once all of it ran
+template <typename Body>
+void parallelFor(int count, int grain, const Body& body)
+{
+	if (count <= 0)
+		return;
+	if (count <= grain || jobSystem.slotCount == 1) {
+		body(0, count);
+		return;
+	}
+	JobCounter counter;
+	ParallelLoop<Body> loop = { &body, max(grain, 1), &counter };
+	executeJob(parallelJob(loop, count));
+	waitForJobs(counter);
+}
+
+void runSharedJob(const void* data, int, int)
+{
+	(*static_cast<const function<void()>*>(data))();
+}
+
+// Run the same job once per thread (the workers and the caller), then wait for all of them; the job
+// shares out its own work, and a thread may end up running it more than once
+void runOnAllThreads(const function<void()>& job)
+{
+	JobCounter counter;
+	Job shared = { runSharedJob, &job, 0, 0, &counter };
+	counter.pending = (int)jobSystem.threads.size();
+	for (size_t i = 0; i < jobSystem.threads.size(); i++)
+		pushJob(shared);
+	job();
+	waitForJobs(counter);
+}
+
+// "--job-benchmark [parts]": the per part work of draw list building (view transform, screen size,
+// LOD selection, frustum test) over a synthetic scene, with 1 to N threads
+void runJobBenchmark(int partCount)
+{
+	vector<glm::mat4> parts(partCount);
+	vector<int> levels(partCount, 0);
+	uint32_t noise = 12345;
+	for (glm::mat4& part : parts) {
+		glm::vec3 position;
+		for (int k = 0; k < 3; k++) {
+			noise = noise * 1664525u + 1013904223u;
+			position[k] = (noise >> 8) / 16777216.0f * 100.0f - 50.0f;
+		}
+		part = glm::translate(glm::mat4(), position);
+	}
+	glm::mat4 viewMatrix = glm::lookAt(glm::vec3(0.0f, 5.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projectionMatrix = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 200.0f);
+	glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+	const float screenSizes[4] = { 200.0f, 80.0f, 30.0f, 0.0f };
+	atomic<int> visible(0);
+
+	auto updateParts = [&](int begin, int end) {
+		int visibleHere = 0;
+		for (int i = begin; i < end; i++) {
+			// A few transforms per part, like a small mesh's bounds and clusters
+			glm::vec3 center;
+			for (int k = 0; k < 8; k++)
+				center += glm::vec3(parts[i] * glm::vec4(0.01f * k, 0.0f, 0.0f, 1.0f));
+			center /= 8.0f;
+			float viewDepth = -(viewMatrix * glm::vec4(center, 1.0f)).z;
+			float screenSize = 2.0f * projectionMatrix[1][1] * 0.5f * 480.0f / max(viewDepth, 0.1f);
+			int level = levels[i];
+			while (level > 0 && screenSize > screenSizes[level - 1] * (1.0f + lodHysteresis))
+				level--;
+			while (level < 3 && screenSize < screenSizes[level] * (1.0f - lodHysteresis))
+				level++;
+			levels[i] = level;
+			bool isInside = true;
+			for (int p = 0; p < 6 && isInside; p++)
+				isInside = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -1.0f;
+			visibleHere += isInside ? 1 : 0;
+		}
+		visible += visibleHere;
+	};
+
+	unsigned int cores = max(thread::hardware_concurrency(), 1u);
+	cout << "Job benchmark: " << partCount << " parts, " << cores << " cores" << endl;
+	double singleMs = 0.0;
+	for (unsigned int threads = 1; threads <= cores; threads++) {
+		startJobWorkers(threads - 1);
+		parallelFor(partCount, 256, updateParts);
+		long long stolenBefore = jobSystem.jobsStolen.load();
+		const int repeats = 10;
+		auto start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++) {
+			visible = 0;
+			parallelFor(partCount, 256, updateParts);
+		}
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / repeats;
+		singleMs = threads == 1 ? ms : singleMs;
+		cout << "  " << threads << " threads: " << ms << " ms per pass, speedup " << singleMs / ms << "x, "
+			<< (jobSystem.jobsStolen.load() - stolenBefore) / repeats << " steals per pass, " << visible.load() << " parts visible" << endl;
+		stopJobWorkers();
+	}
+}
+
+// JOB SYSTEM END *******************************************************
+
+// PROCEDURAL MESHES START *******************************************************
+
+// Every mesh lives in one arena: one vertex buffer, one index buffer and one VAO.
+// The arena is sized up front so the CPU copies never move once a Mesh points into them.
+// Meshes are built with 32 bit indices; uploading packs each one at the narrowest type it
+// fits, aligned to that type, into a single shared index buffer.
+struct MeshArena {
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+	vector<GLubyte> packedIndices;
+	vector<Meshlet> meshlets;
+	GLuint vao;
+	GLuint vbo;
+	GLuint ebo;
+	GLuint quantizedVbo;
+	glm::vec2 uvOffset;      // quantized texture coordinates are uvOffset + unorm16 * uvScale
+	glm::vec2 uvScale;
+};
+
+// Vertex and index counts of a generated mesh, used to size the arena before generating
+struct MeshSize {
+	GLsizei vertexCount;
+	GLsizei indexCount;
+};
+
+MeshSize cylinderMeshSize(int segments, float topRadius)
+{
+	// Side ring pairs (seam duplicated for UVs) and bottom cap; a cylinder adds a top cap and
+	// two side triangles per segment, a cone meets at the apex with one
+	MeshSize size = { (segments + 1) * 2 + (segments + 2), segments * 3 * 2 };
+	if (topRadius > 0.0f) {
+		size.vertexCount += segments + 2;
+		size.indexCount += segments * 3 * 2;
+	}
+	return size;
+}
+
+// A strip box is one four index strip per face, split by five restart indices
+MeshSize boxMeshSize(GLenum mode)
+{
+	MeshSize size = { 24, mode == GL_TRIANGLES ? 36 : 6 * 4 + 5 };
+	return size;
+}
+
+MeshSize sphereMeshSize(int segments, int rings)
+{
+	MeshSize size = { (segments + 1) * (rings + 1), segments * (rings - 1) * 6 };
+	return size;
+}
+
+MeshSize torusMeshSize(int segments, int sides)
+{
+	MeshSize size = { (segments + 1) * (sides + 1), segments * sides * 6 };
+	return size;
+}
+
+// Size the arena for every mesh it will hold, so the meshes' pointers stay valid while generating
+void reserveMeshArena(MeshArena& arena, const vector<MeshSize>& sizes)
+{
+	size_t vertexCount = 0, indexCount = 0;
+	for (const MeshSize& size : sizes) {
+		vertexCount += size.vertexCount;
+		indexCount += size.indexCount;
+	}
+	arena.vertices.reserve(vertexCount * 11);
+	arena.indices.reserve(indexCount);
+}
+
+// Create the arena's GL objects (filled by uploadMeshArena and quantizeMeshArena)
+void createMeshArena(MeshArena& arena)
+{
+	glGenVertexArrays(1, &arena.vao);
+	glGenBuffers(1, &arena.vbo);
+	glGenBuffers(1, &arena.ebo);
+	glGenBuffers(1, &arena.quantizedVbo);
+}
+
+// Claim space for one mesh in the arena and point the Mesh at it
+Mesh beginArenaMesh(MeshArena& arena, MeshSize size)
+{
+	Mesh mesh;
+	mesh.vao = arena.vao;
+	mesh.mode = GL_TRIANGLES;
+	mesh.indexCount = size.indexCount;
+	mesh.vertexCount = size.vertexCount;
+	mesh.indexType = GL_UNSIGNED_INT;
+	mesh.indexOffset = arena.indices.size() * sizeof(GLuint);
+	mesh.baseVertex = (GLint)(arena.vertices.size() / 11);
+	mesh.meshlets = nullptr;
+	mesh.meshletCount = 0;
+
+	arena.vertices.resize(arena.vertices.size() + size.vertexCount * 11);
+	arena.indices.resize(arena.indices.size() + size.indexCount);
+	mesh.vertices = arena.vertices.data() + mesh.baseVertex * 11;
+	mesh.indices = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+	return mesh;
+}
+
+// Copy a hand built mesh into the arena so it shares the arena's buffers and VAO
+template <typename Index>
+Mesh addArenaMesh(MeshArena& arena, const GLfloat* vertices, GLsizei vertexCount, const Index* indices, GLsizei indexCount)
+{
+	MeshSize size = { vertexCount, indexCount };
+	Mesh mesh = beginArenaMesh(arena, size);
+	copy(vertices, vertices + vertexCount * 11, arena.vertices.begin() + mesh.baseVertex * 11);
+	copy(indices, indices + indexCount, arena.indices.begin() + mesh.indexOffset / sizeof(GLuint));
+	return mesh;
+}
+
+// Write one vertex in the 11 float layout (position, white color, UV, normal)
+GLfloat* writeVertex(GLfloat* vertex, const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal)
+{
+	vertex[0] = position.x;
+	vertex[1] = position.y;
+	vertex[2] = position.z;
+	vertex[3] = 1.0f;
+	vertex[4] = 1.0f;
+	vertex[5] = 1.0f;
+	vertex[6] = uv.x;
+	vertex[7] = uv.y;
+	vertex[8] = normal.x;
+	vertex[9] = normal.y;
+	vertex[10] = normal.z;
+	return vertex + 11;
+}
+
+GLuint* writeTriangle(GLuint* index, int a, int b, int c)
+{
+	index[0] = (GLuint)a;
+	index[1] = (GLuint)b;
+	index[2] = (GLuint)c;
+	return index + 3;
+}
+
+// Fan of triangles closing a ring of the given radius at height y
+void writeCap(GLfloat*& vertex, GLuint*& index, int& next, int segments, float radius, float y, bool isTop)
+{
+	glm::vec3 normal(0.0f, isTop ? 1.0f : -1.0f, 0.0f);
+	int center = next;
+	vertex = writeVertex(vertex, glm::vec3(0.0f, y, 0.0f), glm::vec2(0.5f, 0.5f), normal);
+	for (int i = 0; i <= segments; i++) {
+		float angle = 2.0f * glm::pi<float>() * i / segments;
+		glm::vec2 direction(cos(angle), sin(angle));
+		vertex = writeVertex(vertex, glm::vec3(direction.x * radius, y, direction.y * radius), glm::vec2(0.5f) + direction * 0.5f, normal);
+	}
+	for (int i = 0; i < segments; i++) {
+		if (isTop)
+			index = writeTriangle(index, center, center + 2 + i, center + 1 + i);
+		else
+			index = writeTriangle(index, center, center + 1 + i, center + 2 + i);
+	}
+	next += segments + 2;
+}
+
+// Capped cylinder along +Y from y = 0 to 1 with bottom radius 1; a top radius of 0 makes a cone
+Mesh generateCylinder(MeshArena& arena, int segments, float topRadius)
+{
+	Mesh mesh = beginArenaMesh(arena, cylinderMeshSize(segments, topRadius));
+	GLfloat* vertex = arena.vertices.data() + mesh.baseVertex * 11;
+	GLuint* index = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+	int next = 0;
+
+	// Side normals lean up by the slope of the wall
+	float slope = 1.0f - topRadius;
+	for (int i = 0; i <= segments; i++) {
+		float u = (float)i / segments;
+		float angle = 2.0f * glm::pi<float>() * u;
+		glm::vec3 direction(cos(angle), 0.0f, sin(angle));
+		glm::vec3 normal = glm::normalize(glm::vec3(direction.x, slope, direction.z));
+		vertex = writeVertex(vertex, direction, glm::vec2(u, 0.0f), normal);
+		vertex = writeVertex(vertex, direction * topRadius + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(u, 1.0f), normal);
+	}
+	for (int i = 0; i < segments; i++) {
+		int bottom = i * 2;
+		index = writeTriangle(index, bottom, bottom + 1, bottom + 2);
+		if (topRadius > 0.0f)
+			index = writeTriangle(index, bottom + 2, bottom + 1, bottom + 3);
+	}
+	next = (segments + 1) * 2;
+
+	writeCap(vertex, index, next, segments, 1.0f, 0.0f, false);
+	if (topRadius > 0.0f)
+		writeCap(vertex, index, next, segments, topRadius, 1.0f, true);
+
+	return mesh;
+}
+
+// Box from (-0.5, 0, -0.5) to (0.5, 1, 0.5), four vertices per face for flat normals,
+// as a triangle list or as one restart separated strip per face
+Mesh generateBox(MeshArena& arena, GLenum mode)
+{
+	static const glm::vec3 faceNormals[6] = {
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+	};
+	static const glm::vec3 faceRights[6] = {
+		glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f)
+	};
+
+	Mesh mesh = beginArenaMesh(arena, boxMeshSize(mode));
+	mesh.mode = mode;
+	GLfloat* vertex = arena.vertices.data() + mesh.baseVertex * 11;
+	GLuint* index = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+
+	for (int face = 0; face < 6; face++) {
+		glm::vec3 normal = faceNormals[face];
+		glm::vec3 right = faceRights[face];
+		glm::vec3 up = glm::cross(normal, right); // right x up = normal, so corners run counter clockwise
+		glm::vec3 center = glm::vec3(0.0f, 0.5f, 0.0f) + normal * 0.5f;
+
+		vertex = writeVertex(vertex, center - right * 0.5f - up * 0.5f, glm::vec2(0.0f, 0.0f), normal);
+		vertex = writeVertex(vertex, center + right * 0.5f - up * 0.5f, glm::vec2(1.0f, 0.0f), normal);
+		vertex = writeVertex(vertex, center + right * 0.5f + up * 0.5f, glm::vec2(1.0f, 1.0f), normal);
+		vertex = writeVertex(vertex, center - right * 0.5f + up * 0.5f, glm::vec2(0.0f, 1.0f), normal);
+
+		int first = face * 4;
+		if (mode == GL_TRIANGLES) {
+			index = writeTriangle(index, first, first + 1, first + 2);
+			index = writeTriangle(index, first, first + 2, first + 3);
+			continue;
+		}
+		if (face > 0)
+			*index++ = restartIndex(GL_UNSIGNED_INT);
+		index = writeTriangle(index, first, first + 1, first + 3);
+		*index++ = (GLuint)(first + 2);
+	}
+
+	return mesh;
+}
+
+// Unit sphere at the origin, rings run from the top pole down
+Mesh generateSphere(MeshArena& arena, int segments, int rings)
+{
+	Mesh mesh = beginArenaMesh(arena, sphereMeshSize(segments, rings));
+	GLfloat* vertex = arena.vertices.data() + mesh.baseVertex * 11;
+	GLuint* index = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+
+	for (int r = 0; r <= rings; r++) {
+		float v = (float)r / rings;
+		float phi = glm::pi<float>() * v;
+		for (int s = 0; s <= segments; s++) {
+			float u = (float)s / segments;
+			float theta = 2.0f * glm::pi<float>() * u;
+			glm::vec3 normal(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+			vertex = writeVertex(vertex, normal, glm::vec2(u, 1.0f - v), normal);
+		}
+	}
+
+	// Pole rows only need one triangle per segment
+	for (int r = 0; r < rings; r++) {
+		for (int s = 0; s < segments; s++) {
+			int above = r * (segments + 1) + s;
+			int below = above + segments + 1;
+			if (r != rings - 1)
+				index = writeTriangle(index, below, above, below + 1);
+			if (r != 0)
+				index = writeTriangle(index, below + 1, above, above + 1);
+		}
+	}
+
+	return mesh;
+}
+
+// Torus in the XZ plane with a ring radius of 1 around the Y axis
+Mesh generateTorus(MeshArena& arena, int segments, int sides, float tubeRadius)
+{
+	Mesh mesh = beginArenaMesh(arena, torusMeshSize(segments, sides));
+	GLfloat* vertex = arena.vertices.data() + mesh.baseVertex * 11;
+	GLuint* index = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+
+	for (int i = 0; i <= segments; i++) {
+		float u = (float)i / segments;
+		float theta = 2.0f * glm::pi<float>() * u;
+		glm::vec3 ring(cos(theta), 0.0f, sin(theta));
+		for (int j = 0; j <= sides; j++) {
+			float v = (float)j / sides;
+			float phi = 2.0f * glm::pi<float>() * v;
+			glm::vec3 normal = ring * cos(phi) + glm::vec3(0.0f, sin(phi), 0.0f);
+			vertex = writeVertex(vertex, ring + normal * tubeRadius, glm::vec2(u, v), normal);
+		}
+	}
+
+	for (int i = 0; i < segments; i++) {
+		for (int j = 0; j < sides; j++) {
+			int a = i * (sides + 1) + j;
+			int b = a + sides + 1;
+			index = writeTriangle(index, a, a + 1, b);
+			index = writeTriangle(index, b, a + 1, b + 1);
+		}
+	}
+
+	return mesh;
+}
+
+// Repack every mesh of the arena at its narrowest index type and point the meshes at the packed copy.
+// Returns the packed size in bytes per type (8, 16 and 32 bit) for reporting.
+void packMeshArena(MeshArena& arena, const vector<Mesh*>& meshes, size_t typeBytes[3])
+{
+	size_t packedSize = 0;
+	for (const Mesh* mesh : meshes) {
+		GLsizeiptr size = indexTypeSize(selectIndexType(mesh->vertexCount, mesh->mode != GL_TRIANGLES));
+		packedSize = (packedSize + size - 1) / size * size + mesh->indexCount * size;
+	}
+	arena.packedIndices.assign(packedSize, 0);
+
+	typeBytes[0] = typeBytes[1] = typeBytes[2] = 0;
+	size_t offset = 0;
+	for (Mesh* mesh : meshes) {
+		GLenum type = selectIndexType(mesh->vertexCount, mesh->mode != GL_TRIANGLES);
+		GLsizeiptr size = indexTypeSize(type);
+		offset = (offset + size - 1) / size * size;
+
+		const GLuint* source = arena.indices.data() + mesh->indexOffset / sizeof(GLuint);
+		GLubyte* target = arena.packedIndices.data() + offset;
+		for (GLsizei i = 0; i < mesh->indexCount; i++) {
+			GLuint index = source[i] == restartIndex(GL_UNSIGNED_INT) ? restartIndex(type) : source[i];
+			if (type == GL_UNSIGNED_INT)
+				reinterpret_cast<GLuint*>(target)[i] = index;
+			else if (type == GL_UNSIGNED_SHORT)
+				reinterpret_cast<GLushort*>(target)[i] = (GLushort)index;
+			else
+				target[i] = (GLubyte)index;
+		}
+
+		mesh->indexType = type;
+		mesh->indexOffset = offset;
+		mesh->indices = target;
+		typeBytes[size == 4 ? 2 : size - 1] += mesh->indexCount * size;
+		offset += mesh->indexCount * size;
+	}
+
+	// Every mesh now reads the packed copy, so the 32 bit build indices can go
+	vector<GLuint>().swap(arena.indices);
+}
+
+// Upload the whole arena's full precision vertices and packed indices once (after packing)
+void uploadMeshArena(MeshArena& arena)
+{
+	glBindVertexArray(arena.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ebo);
+	glBufferData(GL_ARRAY_BUFFER, arena.vertices.size() * sizeof(GLfloat), arena.vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, arena.packedIndices.size(), arena.packedIndices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+}
+
+// Built arena as stored in the asset cache: a header, one record per mesh (in the order given), then
+// the float vertices, the packed indices and the meshlets
+struct ArenaCacheHeader {
+	char magic[4];
+	uint32_t meshCount;
+	uint64_t floatCount;
+	uint64_t indexBytes;
+	uint64_t meshletCount;
+};
+
+struct ArenaCacheRecord {
+	GLenum mode;
+	GLsizei indexCount;
+	GLsizei vertexCount;
+	GLenum indexType;
+	uint64_t indexOffset;
+	GLint baseVertex;
+	GLsizei firstMeshlet;
+	GLsizei meshletCount;
+};
+
+// Save a packed arena (after packMeshArena) with the meshes that live in it
+void storeArenaCache(const MeshArena& arena, const vector<Mesh*>& meshes, uint64_t key)
+{
+	ArenaCacheHeader header = { { 'A', 'R', 'N', '1' }, (uint32_t)meshes.size(), arena.vertices.size(), arena.packedIndices.size(), arena.meshlets.size() };
+	vector<char> bytes;
+	appendBytes(bytes, &header, 1);
+	for (const Mesh* mesh : meshes) {
+		ArenaCacheRecord record = { mesh->mode, mesh->indexCount, mesh->vertexCount, mesh->indexType, (uint64_t)mesh->indexOffset, mesh->baseVertex,
+			mesh->meshlets ? (GLsizei)(mesh->meshlets - arena.meshlets.data()) : 0, mesh->meshletCount };
+		appendBytes(bytes, &record, 1);
+	}
+	appendBytes(bytes, arena.vertices.data(), arena.vertices.size());
+	appendBytes(bytes, arena.packedIndices.data(), arena.packedIndices.size());
+	appendBytes(bytes, arena.meshlets.data(), arena.meshlets.size());
+	assetCache.misses++;
+	writeAssetFile(assetCachePath("arena", key), bytes);
+}
+
+// Fill an arena and its meshes from the cache, ready for uploadMeshArena; false leaves both untouched
+bool loadArenaCache(MeshArena& arena, const vector<Mesh*>& meshes, uint64_t key)
+{
+	vector<char> bytes;
+	ArenaCacheHeader header;
+	if (!readAssetFile(assetCachePath("arena", key), bytes) || bytes.size() < sizeof(header))
+		return false;
+	memcpy(&header, bytes.data(), sizeof(header));
+	size_t recordBytes = meshes.size() * sizeof(ArenaCacheRecord);
+	size_t size = sizeof(header) + recordBytes + header.floatCount * sizeof(GLfloat) + header.indexBytes + header.meshletCount * sizeof(Meshlet);
+	if (memcmp(header.magic, "ARN1", 4) != 0 || header.meshCount != meshes.size() || bytes.size() != size)
+		return false;
+
+	vector<ArenaCacheRecord> records(meshes.size());
+	memcpy(records.data(), bytes.data() + sizeof(header), recordBytes);
+	for (const ArenaCacheRecord& record : records) {
+		if (record.indexOffset + record.indexCount * indexTypeSize(record.indexType) > header.indexBytes
+			|| (size_t)(record.baseVertex + record.vertexCount) * 11 > header.floatCount
+			|| (size_t)(record.firstMeshlet + record.meshletCount) > header.meshletCount)
+			return false;
+	}
+
+	const char* data = bytes.data() + sizeof(header) + recordBytes;
+	arena.vertices.resize(header.floatCount);
+	memcpy(arena.vertices.data(), data, header.floatCount * sizeof(GLfloat));
+	data += header.floatCount * sizeof(GLfloat);
+	arena.packedIndices.assign(data, data + header.indexBytes);
+	data += header.indexBytes;
+	arena.meshlets.resize(header.meshletCount);
+	memcpy(arena.meshlets.data(), data, header.meshletCount * sizeof(Meshlet));
+	vector<GLuint>().swap(arena.indices);
+
+	for (size_t m = 0; m < meshes.size(); m++) {
+		const ArenaCacheRecord& record = records[m];
+		Mesh& mesh = *meshes[m];
+		mesh.vao = arena.vao;
+		mesh.mode = record.mode;
+		mesh.indexCount = record.indexCount;
+		mesh.vertexCount = record.vertexCount;
+		mesh.indexType = record.indexType;
+		mesh.indexOffset = (GLsizeiptr)record.indexOffset;
+		mesh.baseVertex = record.baseVertex;
+		mesh.vertices = arena.vertices.data() + record.baseVertex * 11;
+		mesh.indices = arena.packedIndices.data() + record.indexOffset;
+		mesh.meshlets = record.meshletCount > 0 ? arena.meshlets.data() + record.firstMeshlet : nullptr;
+		mesh.meshletCount = record.meshletCount;
+	}
+	assetCache.hits++;
+	return true;
+}
+
+// PROCEDURAL MESHES END *******************************************************
+
+// VERTEX QUANTIZATION START *******************************************************
+
+// Compact vertex, 20 bytes: half float position (w is padding), RGBA8 color, unorm16 texture
+// coordinates over the arena's UV range and an octahedral normal in two snorm16.
+// Half floats need no per mesh decode, so every arena mesh still shares one VAO and the position
+// only shaders (depth, shadow, lamp) read it unchanged; the CPU keeps the float copy for culling.
+struct QuantizedVertex {
+	GLhalf position[4];
+	GLubyte color[4];
+	GLushort texCoord[2];
+	GLshort normal[2];
+};
+
+// Largest error the quantized arena introduces, measured by decoding every vertex on the CPU
+struct QuantizationStats {
+	float positionError;      // object space units
+	float normalErrorDegrees;
+	float texCoordError;      // UV units
+	float colorError;
+};
+
+// IEEE 754 binary16 with round to nearest even; mesh data is finite, so NaN is not handled
+GLhalf floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+
+	if (exponent >= 31)
+		return (GLhalf)(sign | 0x7C00u);
+	int shift = 13;
+	uint32_t half = (uint32_t)exponent << 10;
+	if (exponent <= 0) {
+		// Subnormal: shift the implicit bit in and drop the exponent
+		if (exponent < -10)
+			return (GLhalf)sign;
+		mantissa |= 0x800000u;
+		shift = 14 - exponent;
+		half = 0;
+	}
+	half |= mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1)))
+		half++; // a carry into the exponent is still the correctly rounded value
+	return (GLhalf)(sign | half);
+}
+
+float halfToFloat(GLhalf half)
+{
+	float sign = (half & 0x8000u) ? -1.0f : 1.0f;
+	int exponent = (half >> 10) & 0x1F;
+	int mantissa = half & 0x3FF;
+	if (exponent == 0)
+		return sign * ldexp((float)mantissa, -24);
+	if (exponent == 31)
+		return sign * INFINITY;
+	return sign * ldexp((float)(mantissa | 0x400), exponent - 25);
+}
+
+// Unit vector folded onto the octahedron and flattened to [-1, 1]^2
+glm::vec2 encodeOctahedral(glm::vec3 normal)
+{
+	float length = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+	if (length == 0.0f)
+		return glm::vec2(0.0f);
+	normal /= length;
+	if (normal.z >= 0.0f)
+		return glm::vec2(normal.x, normal.y);
+	return glm::vec2((1.0f - fabs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+		(1.0f - fabs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+// Same decode as the vertex shaders
+glm::vec3 decodeOctahedral(glm::vec2 encoded)
+{
+	glm::vec3 normal(encoded.x, encoded.y, 1.0f - fabs(encoded.x) - fabs(encoded.y));
+	float fold = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+	return glm::normalize(normal);
+}
+
+GLshort toSnorm16(float value)
+{
+	return (GLshort)lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+float fromSnorm16(GLshort value)
+{
+	return max(value / 32767.0f, -1.0f);
+}
+
+GLushort toUnorm16(float value)
+{
+	return (GLushort)lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Quantize every arena vertex into the compact buffer and measure the error against the float copy
+QuantizationStats quantizeMeshArena(MeshArena& arena)
+{
+	size_t vertexCount = arena.vertices.size() / 11;
+
+	// Whole texture units keep repeating textures lined up
+	glm::vec2 uvMin(0.0f), uvMax(1.0f);
+	for (size_t v = 0; v < vertexCount; v++) {
+		glm::vec2 uv(arena.vertices[v * 11 + 6], arena.vertices[v * 11 + 7]);
+		uvMin = glm::min(uvMin, uv);
+		uvMax = glm::max(uvMax, uv);
+	}
+	arena.uvOffset = glm::floor(uvMin);
+	arena.uvScale = glm::ceil(uvMax) - arena.uvOffset;
+
+	vector<QuantizedVertex> quantized(vertexCount);
+	QuantizationStats stats = {};
+	for (size_t v = 0; v < vertexCount; v++) {
+		const GLfloat* source = &arena.vertices[v * 11];
+		QuantizedVertex& target = quantized[v];
+
+		for (int k = 0; k < 3; k++) {
+			target.position[k] = floatToHalf(source[k]);
+			stats.positionError = max(stats.positionError, fabs(halfToFloat(target.position[k]) - source[k]));
+		}
+		target.position[3] = floatToHalf(1.0f);
+
+		for (int k = 0; k < 3; k++) {
+			target.color[k] = (GLubyte)lround(glm::clamp(source[3 + k], 0.0f, 1.0f) * 255.0f);
+			stats.colorError = max(stats.colorError, fabs(target.color[k] / 255.0f - source[3 + k]));
+		}
+		target.color[3] = 255;
+
+		for (int k = 0; k < 2; k++) {
+			target.texCoord[k] = toUnorm16((source[6 + k] - arena.uvOffset[k]) / arena.uvScale[k]);
+			float decoded = arena.uvOffset[k] + target.texCoord[k] / 65535.0f * arena.uvScale[k];
+			stats.texCoordError = max(stats.texCoordError, fabs(decoded - source[6 + k]));
+		}
+
+		glm::vec3 normal = glm::normalize(glm::vec3(source[8], source[9], source[10]));
+		glm::vec2 encoded = encodeOctahedral(normal);
+		target.normal[0] = toSnorm16(encoded.x);
+		target.normal[1] = toSnorm16(encoded.y);
+		glm::vec3 decoded = decodeOctahedral(glm::vec2(fromSnorm16(target.normal[0]), fromSnorm16(target.normal[1])));
+		float angle = glm::degrees(acos(glm::clamp(glm::dot(decoded, normal), -1.0f, 1.0f)));
+		stats.normalErrorDegrees = max(stats.normalErrorDegrees, angle);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, arena.quantizedVbo);
+	glBufferData(GL_ARRAY_BUFFER, quantized.size() * sizeof(QuantizedVertex), quantized.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return stats;
+}
+
+// Point a VAO's attributes at its full or its quantized vertex buffer
+void setVertexFormat(GLuint vao, GLuint vbo, GLuint quantizedVbo, bool isQuantized)
+{
+	glBindVertexArray(vao);
+	if (isQuantized) {
+		glBindBuffer(GL_ARRAY_BUFFER, quantizedVbo);
+		// location
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, position));
+		// color
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, color));
+		// texture
+		glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, texCoord));
+		// normal (octahedral, decoded in the vertex shader)
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, normal));
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		// location
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)0);
+		// color
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
+		// texture
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
+		// normal
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (GLvoid*)(8 * sizeof(GLfloat)));
+	}
+	for (GLuint location = 0; location < 4; location++)
+		glEnableVertexAttribArray(location);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Tell a scene program how to decode the arena's current vertex format
+void setVertexDecode(GLuint program, const MeshArena& arena, bool isQuantized)
+{
+	glUniform1i(glGetUniformLocation(program, "isOctahedralNormal"), isQuantized ? 1 : 0);
+	glm::vec2 uvOffset = isQuantized ? arena.uvOffset : glm::vec2(0.0f);
+	glm::vec2 uvScale = isQuantized ? arena.uvScale : glm::vec2(1.0f);
+	glUniform2f(glGetUniformLocation(program, "uvOffset"), uvOffset.x, uvOffset.y);
+	glUniform2f(glGetUniformLocation(program, "uvScale"), uvScale.x, uvScale.y);
+}
+
+// A/B image check for a vertex format switch: the last frame in the old format is read back, the
+// first frame in the new one is compared against it (hold the camera still while toggling)
+struct VertexFormatDiff {
+	vector<GLubyte> reference;
+	vector<GLubyte> current;
+	bool isComparing;
+};
+
+VertexFormatDiff vertexFormatDiff;
+
+void readFramePixels(int width, int height, vector<GLubyte>& pixels)
+{
+	pixels.resize((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+void reportVertexFormatDiff(int width, int height, bool isQuantized)
+{
+	readFramePixels(width, height, vertexFormatDiff.current);
+	const vector<GLubyte>& a = vertexFormatDiff.reference;
+	const vector<GLubyte>& b = vertexFormatDiff.current;
+	if (a.size() != b.size())
+		return;
+
+	int maxDifference = 0;
+	size_t differentPixels = 0;
+	double totalDifference = 0.0;
+	for (size_t p = 0; p < a.size(); p += 4) {
+		int pixelDifference = 0;
+		for (int c = 0; c < 3; c++)
+			pixelDifference = max(pixelDifference, abs((int)a[p + c] - (int)b[p + c]));
+		maxDifference = max(maxDifference, pixelDifference);
+		totalDifference += pixelDifference;
+		if (pixelDifference > 2)
+			differentPixels++;
+	}
+	size_t pixelCount = a.size() / 4;
+	cout << "Vertex format diff (" << (isQuantized ? "full -> quantized" : "quantized -> full") << "): max "
+		<< maxDifference << "/255, mean " << totalDifference / max(pixelCount, (size_t)1) << ", "
+		<< 100.0 * differentPixels / max(pixelCount, (size_t)1) << "% of pixels off by more than 2" << endl;
+}
+
+// VERTEX QUANTIZATION END *******************************************************
+
+// MESH HEAP START *******************************************************
+
+// Static meshes live in a few large vertex and index buffer pages, suballocated with a buddy allocator:
+// a block is halved until it fits and merges back with its free buddy when released, so meshes can come
+// and go while every page keeps one VAO that all of its meshes share
+
+// Vertex blocks count whole vertices, so a block's offset is the mesh's base vertex in the full and the
+// quantized buffer alike; index blocks count 4 bytes, so every index type stays aligned
+const uint32_t heapMinBlock = 16;
+const uint32_t heapPageVertices = 1 << 17;
+const uint32_t heapPageIndexUnits = 1 << 19;
+
+struct BuddyAllocator {
+	uint32_t size;                       // units, heapMinBlock << (orderCount - 1)
+	int orderCount;
+	vector<vector<uint32_t>> freeBlocks; // first slot of every free block per order; order k spans heapMinBlock << k units
+	vector<int8_t> freeOrder;            // order of the free block starting at each slot, -1 if none starts there
+	vector<uint32_t> freePosition;       // where that block sits in its free list
+	vector<int8_t> usedOrder;            // order of the allocated block starting at each slot, -1 if none
+	uint32_t requestedUnits;
+	uint32_t allocatedUnits;             // requests rounded up to whole blocks
+};
+
+void pushFreeBlock(BuddyAllocator& buddy, uint32_t slot, int order)
+{
+	buddy.freeOrder[slot] = (int8_t)order;
+	buddy.freePosition[slot] = (uint32_t)buddy.freeBlocks[order].size();
+	buddy.freeBlocks[order].push_back(slot);
+}
+
+void removeFreeBlock(BuddyAllocator& buddy, uint32_t slot)
+{
+	vector<uint32_t>& list = buddy.freeBlocks[buddy.freeOrder[slot]];
+	uint32_t last = list.back();
+	list[buddy.freePosition[slot]] = last;
+	buddy.freePosition[last] = buddy.freePosition[slot];
+	list.pop_back();
+	buddy.freeOrder[slot] = -1;
+}
+
+// Start with one free block covering size units (a power of two, at least heapMinBlock)
+void initBuddy(BuddyAllocator& buddy, uint32_t size)
+{
+	uint32_t slots = size / heapMinBlock;
+	buddy.size = size;
+	buddy.orderCount = 1;
+	while ((1u << (buddy.orderCount - 1)) < slots)
+		buddy.orderCount++;
+	buddy.freeBlocks.assign(buddy.orderCount, vector<uint32_t>());
+	buddy.freeOrder.assign(slots, -1);
+	buddy.freePosition.assign(slots, 0);
+	buddy.usedOrder.assign(slots, -1);
+	buddy.requestedUnits = 0;
+	buddy.allocatedUnits = 0;
+	pushFreeBlock(buddy, 0, buddy.orderCount - 1);
+}
+
+int buddyOrder(uint32_t units)
+{
+	int order = 0;
+	while ((heapMinBlock << order) < units)
+		order++;
+	return order;
+}
+
+// Take the smallest free block that fits and split it down to the order needed; false when none does
+bool allocateBuddy(BuddyAllocator& buddy, uint32_t units, uint32_t& offset)
+{
+	int order = buddyOrder(units);
+	int found = order;
+	while (found < buddy.orderCount && buddy.freeBlocks[found].empty())
+		found++;
+	if (found >= buddy.orderCount)
+		return false;
+
+	uint32_t slot = buddy.freeBlocks[found].back();
+	removeFreeBlock(buddy, slot);
+	while (found > order) {
+		found--;
+		pushFreeBlock(buddy, slot + (1u << found), found);
+	}
+	buddy.usedOrder[slot] = (int8_t)order;
+	buddy.requestedUnits += units;
+	buddy.allocatedUnits += heapMinBlock << order;
+	offset = slot * heapMinBlock;
+	return true;
+}
+
+// Release a block, merging it with its buddy for as long as the buddy is free as a whole
+void freeBuddy(BuddyAllocator& buddy, uint32_t offset, uint32_t units)
+{
+	uint32_t slot = offset / heapMinBlock;
+	int order = buddy.usedOrder[slot];
+	buddy.usedOrder[slot] = -1;
+	buddy.requestedUnits -= units;
+	buddy.allocatedUnits -= heapMinBlock << order;
+	while (order + 1 < buddy.orderCount) {
+		uint32_t buddySlot = slot ^ (1u << order);
+		if (buddy.freeOrder[buddySlot] != order)
+			break;
+		removeFreeBlock(buddy, buddySlot);
+		slot = min(slot, buddySlot);
+		order++;
+	}
+	pushFreeBlock(buddy, slot, order);
+}
+
+uint32_t largestFreeBlock(const BuddyAllocator& buddy)
+{
+	for (int order = buddy.orderCount - 1; order >= 0; order--) {
+		if (!buddy.freeBlocks[order].empty())
+			return heapMinBlock << order;
+	}
+	return 0;
+}
+
+struct MeshHeapPage {
+	GLuint vao;           // 0 once the page is released; its slot is reused by the next page
+	GLuint vbo;           // 11 float vertices
+	GLuint quantizedVbo;  // the same vertices as QuantizedVertex
+	GLuint ebo;
+	BuddyAllocator vertices;
+	BuddyAllocator indices;
+};
+
+// Where a mesh lives; the Mesh's vao, baseVertex and indexOffset point at the same place
+struct HeapMesh {
+	Mesh* mesh;
+	size_t page;
+	uint32_t firstVertex;
+	uint32_t firstIndexUnit;
+};
+
+struct MeshHeap {
+	vector<MeshHeapPage> pages;
+	vector<HeapMesh> meshes;
+	bool isQuantized;         // which vertex buffer the page VAOs read
+	GLuint scratchBuffer;     // a page's old contents while defragmentation moves its blocks
+	GLsizeiptr scratchSize;
+	int defragmentations;
+	size_t movedBytes;
+};
+
+MeshHeap meshHeap;
+
+uint32_t heapIndexUnits(const Mesh& mesh)
+{
+	return (uint32_t)((mesh.indexCount * indexTypeSize(mesh.indexType) + 3) / 4);
+}
+
+uint32_t heapPageSize(uint32_t minimum, uint32_t units)
+{
+	uint32_t size = minimum;
+	while (size < units)
+		size *= 2;
+	return size;
+}
+
+void copyBufferRange(GLuint source, GLintptr sourceOffset, GLuint target, GLintptr targetOffset, GLsizeiptr size)
+{
+	glBindBuffer(GL_COPY_READ_BUFFER, source);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, targetOffset, size);
+}
+
+// Copy a mesh's vertices (both formats) and indices between two heap locations
+void copyHeapMesh(const Mesh& mesh, const MeshHeapPage& source, uint32_t sourceVertex, uint32_t sourceIndexUnit,
+	const MeshHeapPage& target, uint32_t targetVertex, uint32_t targetIndexUnit)
+{
+	copyBufferRange(source.vbo, sourceVertex * 11 * sizeof(GLfloat), target.vbo, targetVertex * 11 * sizeof(GLfloat),
+		mesh.vertexCount * 11 * sizeof(GLfloat));
+	copyBufferRange(source.quantizedVbo, sourceVertex * sizeof(QuantizedVertex), target.quantizedVbo, targetVertex * sizeof(QuantizedVertex),
+		mesh.vertexCount * sizeof(QuantizedVertex));
+	copyBufferRange(source.ebo, sourceIndexUnit * 4, target.ebo, targetIndexUnit * 4, mesh.indexCount * indexTypeSize(mesh.indexType));
+	meshHeap.movedBytes += mesh.vertexCount * (11 * sizeof(GLfloat) + sizeof(QuantizedVertex)) + mesh.indexCount * indexTypeSize(mesh.indexType);
+}
+
+// New page with room for at least the given units, in a released slot if there is one
+size_t createHeapPage(uint32_t vertexUnits, uint32_t indexUnits)
+{
+	size_t index = 0;
+	while (index < meshHeap.pages.size() && meshHeap.pages[index].vao != 0)
+		index++;
+	if (index == meshHeap.pages.size())
+		meshHeap.pages.push_back(MeshHeapPage());
+
+	MeshHeapPage& page = meshHeap.pages[index];
+	initBuddy(page.vertices, heapPageSize(heapPageVertices, vertexUnits));
+	initBuddy(page.indices, heapPageSize(heapPageIndexUnits, indexUnits));
+	glGenVertexArrays(1, &page.vao);
+	glGenBuffers(1, &page.vbo);
+	glGenBuffers(1, &page.quantizedVbo);
+	glGenBuffers(1, &page.ebo);
+
+	glBindVertexArray(page.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)page.indices.size * 4, nullptr, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)page.vertices.size * 11 * sizeof(GLfloat), nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, page.quantizedVbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)page.vertices.size * sizeof(QuantizedVertex), nullptr, GL_STATIC_DRAW);
+	setVertexFormat(page.vao, page.vbo, page.quantizedVbo, meshHeap.isQuantized);
+	return index;
+}
+
+void releaseHeapPage(MeshHeapPage& page)
+{
+	glDeleteVertexArrays(1, &page.vao);
+	glDeleteBuffers(1, &page.vbo);
+	glDeleteBuffers(1, &page.quantizedVbo);
+	glDeleteBuffers(1, &page.ebo);
+	page.vao = 0;
+}
+
+// Reserve both blocks of a mesh in one page (the first with room, else a new one); false leaves the heap untouched
+bool allocateInPage(size_t index, uint32_t vertexUnits, uint32_t indexUnits, uint32_t& firstVertex, uint32_t& firstIndexUnit)
+{
+	MeshHeapPage& page = meshHeap.pages[index];
+	if (page.vao == 0 || !allocateBuddy(page.vertices, vertexUnits, firstVertex))
+		return false;
+	if (!allocateBuddy(page.indices, indexUnits, firstIndexUnit)) {
+		freeBuddy(page.vertices, firstVertex, vertexUnits);
+		return false;
+	}
+	return true;
+}
+
+void pointMeshAt(HeapMesh& placed)
+{
+	placed.mesh->vao = meshHeap.pages[placed.page].vao;
+	placed.mesh->baseVertex = (GLint)placed.firstVertex;
+	placed.mesh->indexOffset = (GLsizeiptr)placed.firstIndexUnit * 4;
+}
+
+// Find room for a mesh (its counts and index type set) and point it there; the data is written separately
+HeapMesh& allocateHeapMesh(Mesh& mesh)
+{
+	uint32_t vertexUnits = (uint32_t)mesh.vertexCount;
+	uint32_t indexUnits = heapIndexUnits(mesh);
+	HeapMesh placed = { &mesh, 0, 0, 0 };
+	while (placed.page < meshHeap.pages.size() && !allocateInPage(placed.page, vertexUnits, indexUnits, placed.firstVertex, placed.firstIndexUnit))
+		placed.page++;
+	if (placed.page == meshHeap.pages.size()) {
+		placed.page = createHeapPage(vertexUnits, indexUnits);
+		allocateInPage(placed.page, vertexUnits, indexUnits, placed.firstVertex, placed.firstIndexUnit);
+	}
+	meshHeap.meshes.push_back(placed);
+	pointMeshAt(meshHeap.meshes.back());
+	return meshHeap.meshes.back();
+}
+
+// Upload a mesh's data from the CPU (the quantized vertices are optional)
+void writeHeapMesh(const Mesh& mesh, const GLfloat* vertices, const QuantizedVertex* quantized, const GLvoid* indices)
+{
+	for (const HeapMesh& placed : meshHeap.meshes) {
+		if (placed.mesh != &mesh)
+			continue;
+		const MeshHeapPage& page = meshHeap.pages[placed.page];
+		glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, placed.firstVertex * 11 * sizeof(GLfloat), mesh.vertexCount * 11 * sizeof(GLfloat), vertices);
+		if (quantized) {
+			glBindBuffer(GL_ARRAY_BUFFER, page.quantizedVbo);
+			glBufferSubData(GL_ARRAY_BUFFER, placed.firstVertex * sizeof(QuantizedVertex), mesh.vertexCount * sizeof(QuantizedVertex), quantized);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, page.ebo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, placed.firstIndexUnit * 4, mesh.indexCount * indexTypeSize(mesh.indexType), indices);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Move every mesh of an uploaded and quantized arena into the heap with GPU side copies, then drop the
+// arena's own buffers; the arena keeps its CPU copies and UV range
+void moveArenaToHeap(MeshArena& arena, const vector<Mesh*>& meshes)
+{
+	MeshHeapPage staging = { arena.vao, arena.vbo, arena.quantizedVbo, arena.ebo };
+	for (Mesh* mesh : meshes) {
+		uint32_t sourceVertex = (uint32_t)mesh->baseVertex;
+		GLsizeiptr sourceOffset = mesh->indexOffset;
+		HeapMesh& placed = allocateHeapMesh(*mesh);
+		copyBufferRange(arena.vbo, sourceVertex * 11 * sizeof(GLfloat), meshHeap.pages[placed.page].vbo, placed.firstVertex * 11 * sizeof(GLfloat),
+			mesh->vertexCount * 11 * sizeof(GLfloat));
+		copyBufferRange(arena.quantizedVbo, sourceVertex * sizeof(QuantizedVertex), meshHeap.pages[placed.page].quantizedVbo,
+			placed.firstVertex * sizeof(QuantizedVertex), mesh->vertexCount * sizeof(QuantizedVertex));
+		copyBufferRange(arena.ebo, sourceOffset, meshHeap.pages[placed.page].ebo, placed.firstIndexUnit * 4, mesh->indexCount * indexTypeSize(mesh->indexType));
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	releaseHeapPage(staging);
+	arena.vao = arena.vbo = arena.quantizedVbo = arena.ebo = 0;
+}
+
+// Give a mesh's blocks back, releasing its page once nothing is left in it
+void freeHeapMesh(Mesh& mesh)
+{
+	for (size_t i = 0; i < meshHeap.meshes.size(); i++) {
+		HeapMesh& placed = meshHeap.meshes[i];
+		if (placed.mesh != &mesh)
+			continue;
+		MeshHeapPage& page = meshHeap.pages[placed.page];
+		freeBuddy(page.vertices, placed.firstVertex, (uint32_t)mesh.vertexCount);
+		freeBuddy(page.indices, placed.firstIndexUnit, heapIndexUnits(mesh));
+		if (page.vertices.allocatedUnits == 0 && page.indices.allocatedUnits == 0)
+			releaseHeapPage(page);
+		meshHeap.meshes[i] = meshHeap.meshes.back();
+		meshHeap.meshes.pop_back();
+		mesh.vao = 0;
+		return;
+	}
+}
+
+// Repack every page: meshes from later pages move into free space of earlier ones (emptied pages are
+// released), then each page is rebuilt largest block first, which leaves no holes between blocks.
+// Returns the meshes moved; draw state built from their vao, baseVertex or indexOffset (the GPU culling
+// commands and VAOs) has to be rebuilt after
+int defragmentMeshHeap()
+{
+	vector<char> isMoved(meshHeap.meshes.size(), 0);
+	vector<HeapMesh*> order;
+	for (HeapMesh& placed : meshHeap.meshes)
+		order.push_back(&placed);
+	sort(order.begin(), order.end(), [](const HeapMesh* a, const HeapMesh* b) {
+		return a->mesh->vertexCount > b->mesh->vertexCount;
+	});
+
+	for (HeapMesh* placed : order) {
+		Mesh& mesh = *placed->mesh;
+		uint32_t vertexUnits = (uint32_t)mesh.vertexCount;
+		uint32_t indexUnits = heapIndexUnits(mesh);
+		uint32_t firstVertex, firstIndexUnit;
+		for (size_t target = 0; target < placed->page; target++) {
+			if (!allocateInPage(target, vertexUnits, indexUnits, firstVertex, firstIndexUnit))
+				continue;
+			MeshHeapPage& source = meshHeap.pages[placed->page];
+			copyHeapMesh(mesh, source, placed->firstVertex, placed->firstIndexUnit, meshHeap.pages[target], firstVertex, firstIndexUnit);
+			freeBuddy(source.vertices, placed->firstVertex, vertexUnits);
+			freeBuddy(source.indices, placed->firstIndexUnit, indexUnits);
+			if (source.vertices.allocatedUnits == 0 && source.indices.allocatedUnits == 0)
+				releaseHeapPage(source);
+			placed->page = target;
+			placed->firstVertex = firstVertex;
+			placed->firstIndexUnit = firstIndexUnit;
+			pointMeshAt(*placed);
+			isMoved[placed - meshHeap.meshes.data()] = 1;
+			break;
+		}
+	}
+
+	for (size_t index = 0; index < meshHeap.pages.size(); index++) {
+		MeshHeapPage& page = meshHeap.pages[index];
+		if (page.vao == 0)
+			continue;
+
+		// Both allocators restart empty and take the page's blocks again in descending size
+		vector<HeapMesh*> byVertices, byIndices;
+		for (HeapMesh* placed : order) {
+			if (placed->page == index) {
+				byVertices.push_back(placed);
+				byIndices.push_back(placed);
+			}
+		}
+		stable_sort(byIndices.begin(), byIndices.end(), [](const HeapMesh* a, const HeapMesh* b) {
+			return heapIndexUnits(*a->mesh) > heapIndexUnits(*b->mesh);
+		});
+		vector<uint32_t> firstVertices(meshHeap.meshes.size()), firstIndexUnits(meshHeap.meshes.size());
+		initBuddy(page.vertices, page.vertices.size);
+		initBuddy(page.indices, page.indices.size);
+		for (HeapMesh* placed : byVertices)
+			allocateBuddy(page.vertices, (uint32_t)placed->mesh->vertexCount, firstVertices[placed - meshHeap.meshes.data()]);
+		for (HeapMesh* placed : byIndices)
+			allocateBuddy(page.indices, heapIndexUnits(*placed->mesh), firstIndexUnits[placed - meshHeap.meshes.data()]);
+
+		bool isMoving = false;
+		for (HeapMesh* placed : byVertices) {
+			size_t i = placed - meshHeap.meshes.data();
+			isMoving = isMoving || firstVertices[i] != placed->firstVertex || firstIndexUnits[i] != placed->firstIndexUnit;
+		}
+		if (!isMoving)
+			continue;
+
+		// Blocks can overlap their old place, so each buffer is copied aside first and the blocks come back from there
+		GLuint pageBuffers[3] = { page.vbo, page.quantizedVbo, page.ebo };
+		GLsizeiptr strides[3] = { 11 * sizeof(GLfloat), sizeof(QuantizedVertex), 4 };
+		GLsizeiptr pageBytes[3] = { page.vertices.size * strides[0], page.vertices.size * strides[1], page.indices.size * strides[2] };
+		if (meshHeap.scratchBuffer == 0)
+			glGenBuffers(1, &meshHeap.scratchBuffer);
+		if (meshHeap.scratchSize < pageBytes[0] || meshHeap.scratchSize < pageBytes[2]) {
+			meshHeap.scratchSize = max(pageBytes[0], pageBytes[2]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, meshHeap.scratchBuffer);
+			glBufferData(GL_COPY_WRITE_BUFFER, meshHeap.scratchSize, nullptr, GL_STREAM_COPY);
+		}
+		for (int b = 0; b < 3; b++) {
+			copyBufferRange(pageBuffers[b], 0, meshHeap.scratchBuffer, 0, pageBytes[b]);
+			for (HeapMesh* placed : byVertices) {
+				size_t i = placed - meshHeap.meshes.data();
+				uint32_t from = b < 2 ? placed->firstVertex : placed->firstIndexUnit;
+				uint32_t to = b < 2 ? firstVertices[i] : firstIndexUnits[i];
+				GLsizeiptr size = b < 2 ? placed->mesh->vertexCount * strides[b] : placed->mesh->indexCount * indexTypeSize(placed->mesh->indexType);
+				if (from != to) {
+					copyBufferRange(meshHeap.scratchBuffer, from * strides[b], pageBuffers[b], to * strides[b], size);
+					meshHeap.movedBytes += size;
+				}
+			}
+		}
+		for (HeapMesh* placed : byVertices) {
+			size_t i = placed - meshHeap.meshes.data();
+			isMoved[i] |= firstVertices[i] != placed->firstVertex || firstIndexUnits[i] != placed->firstIndexUnit ? 1 : 0;
+			placed->firstVertex = firstVertices[i];
+			placed->firstIndexUnit = firstIndexUnits[i];
+			pointMeshAt(*placed);
+		}
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	meshHeap.defragmentations++;
+	return (int)count(isMoved.begin(), isMoved.end(), 1);
+}
+
+// Point every page's VAO at the full or the quantized vertex buffer
+void setMeshHeapFormat(bool isQuantized)
+{
+	meshHeap.isQuantized = isQuantized;
+	for (const MeshHeapPage& page : meshHeap.pages) {
+		if (page.vao != 0)
+			setVertexFormat(page.vao, page.vbo, page.quantizedVbo, isQuantized);
+	}
+}
+
+void destroyMeshHeap()
+{
+	for (MeshHeapPage& page : meshHeap.pages) {
+		if (page.vao != 0)
+			releaseHeapPage(page);
+	}
+	glDeleteBuffers(1, &meshHeap.scratchBuffer);
+	meshHeap.pages.clear();
+	meshHeap.meshes.clear();
+	meshHeap.scratchBuffer = 0;
+	meshHeap.scratchSize = 0;
+}
+
+// Live pages and bytes across them: capacity, handed out in blocks, asked for, and the largest free block
+struct MeshHeapStats {
+	int pages;
+	size_t capacityBytes;
+	size_t allocatedBytes;
+	size_t requestedBytes;
+	size_t largestFreeBytes;
+	size_t freeBytes;
+};
+
+MeshHeapStats measureMeshHeap()
+{
+	MeshHeapStats stats = {};
+	const size_t vertexBytes = 11 * sizeof(GLfloat) + sizeof(QuantizedVertex);
+	for (const MeshHeapPage& page : meshHeap.pages) {
+		if (page.vao == 0)
+			continue;
+		stats.pages++;
+		stats.capacityBytes += (size_t)page.vertices.size * vertexBytes + (size_t)page.indices.size * 4;
+		stats.allocatedBytes += (size_t)page.vertices.allocatedUnits * vertexBytes + (size_t)page.indices.allocatedUnits * 4;
+		stats.requestedBytes += (size_t)page.vertices.requestedUnits * vertexBytes + (size_t)page.indices.requestedUnits * 4;
+		stats.largestFreeBytes = max(stats.largestFreeBytes, (size_t)largestFreeBlock(page.vertices) * vertexBytes);
+	}
+	stats.freeBytes = stats.capacityBytes - stats.allocatedBytes;
+	return stats;
+}
+
+void printMeshHeap(const char* label)
+{
+	MeshHeapStats stats = measureMeshHeap();
+	cout << label << meshHeap.meshes.size() << " meshes in " << stats.pages << " pages, " << stats.allocatedBytes / 1048576.0 << " of "
+		<< stats.capacityBytes / 1048576.0 << " MB in blocks (" << stats.requestedBytes / 1048576.0 << " MB asked for), largest free vertex block "
+		<< stats.largestFreeBytes / 1048576.0 << " MB" << endl;
+}
+
+// "--mesh-heap-benchmark [count]": allocate count random meshes, free every other one, refill part of the
+// holes, defragment and check that every surviving mesh still reads back its own data
+void runMeshHeapBenchmark(int count)
+{
+	uint32_t noise = 12345;
+	auto random = [&noise](uint32_t range) {
+		noise = noise * 1664525u + 1013904223u;
+		return (noise >> 8) % range;
+	};
+	vector<Mesh> meshes;
+	meshes.reserve(count + count / 4);
+	vector<GLfloat> vertices(2048 * 11);
+	vector<GLushort> indices(2048 * 3);
+	auto addMesh = [&]() {
+		Mesh mesh = {};
+		mesh.mode = GL_TRIANGLES;
+		mesh.vertexCount = 16 + (GLsizei)random(2032);
+		mesh.indexCount = 3 * (1 + (GLsizei)random(mesh.vertexCount));
+		mesh.indexType = GL_UNSIGNED_SHORT;
+		meshes.push_back(mesh);
+		Mesh& added = meshes.back();
+		allocateHeapMesh(added);
+
+		// Every mesh is tagged with its place in the list so a read back shows whose data it holds
+		vertices[0] = vertices[11 * (added.vertexCount - 1)] = (GLfloat)meshes.size();
+		indices[0] = indices[added.indexCount - 1] = (GLushort)meshes.size();
+		writeHeapMesh(added, vertices.data(), nullptr, indices.data());
+	};
+
+	cout << "Mesh heap benchmark: " << count << " meshes of 16 to 2048 vertices" << endl;
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		addMesh();
+	glFinish();
+	double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	cout << "  allocated and uploaded in " << ms << " ms (" << ms * 1000.0 / count << " us per mesh)" << endl;
+	printMeshHeap("  after allocation: ");
+
+	start = chrono::high_resolution_clock::now();
+	int index = 0;
+	for (Mesh& mesh : meshes) {
+		if (index++ % 2 == 0)
+			freeHeapMesh(mesh);
+	}
+	ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	cout << "  freed every other mesh in " << ms << " ms" << endl;
+	printMeshHeap("  after freeing: ");
+
+	for (int i = 0; i < count / 4; i++)
+		addMesh();
+	printMeshHeap("  after refilling a quarter: ");
+
+	start = chrono::high_resolution_clock::now();
+	size_t movedBefore = meshHeap.movedBytes;
+	int moved = defragmentMeshHeap();
+	glFinish();
+	ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	cout << "  defragmented in " << ms << " ms, " << moved << " meshes moved (" << (meshHeap.movedBytes - movedBefore) / 1048576.0 << " MB copied)" << endl;
+	printMeshHeap("  after defragmenting: ");
+
+	int checked = 0, wrong = 0;
+	index = 0;
+	for (Mesh& mesh : meshes) {
+		index++;
+		if (mesh.vao == 0)
+			continue;
+		const HeapMesh* placed = nullptr;
+		for (const HeapMesh& candidate : meshHeap.meshes) {
+			if (candidate.mesh == &mesh)
+				placed = &candidate;
+		}
+		GLfloat vertexTags[2] = {};
+		GLushort indexTags[2] = {};
+		const MeshHeapPage& page = meshHeap.pages[placed->page];
+		glBindBuffer(GL_COPY_READ_BUFFER, page.vbo);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.baseVertex * 11 * sizeof(GLfloat), sizeof(GLfloat), &vertexTags[0]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, (mesh.baseVertex + mesh.vertexCount - 1) * 11 * sizeof(GLfloat), sizeof(GLfloat), &vertexTags[1]);
+		glBindBuffer(GL_COPY_READ_BUFFER, page.ebo);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.indexOffset, sizeof(GLushort), &indexTags[0]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.indexOffset + (mesh.indexCount - 1) * sizeof(GLushort), sizeof(GLushort), &indexTags[1]);
+		checked++;
+		wrong += vertexTags[0] != index || vertexTags[1] != index || indexTags[0] != (GLushort)index || indexTags[1] != (GLushort)index ? 1 : 0;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	cout << "  " << checked << " meshes read back, " << wrong << " with the wrong data" << endl;
+
+	for (Mesh& mesh : meshes) {
+		if (mesh.vao != 0)
+			freeHeapMesh(mesh);
+	}
+	printMeshHeap("  after freeing everything: ");
+	destroyMeshHeap();
+}
+
+// MESH HEAP END *******************************************************
+
+// OCCLUSION CULLING START *******************************************************
+
+// Low resolution depth buffer split into tiles that are rasterized in parallel
+const int occlusionWidth = 256;
+const int occlusionHeight = 192;
+const int occlusionTileSize = 32; // multiple of 8 so every tile row is whole AVX2 lanes
+const int occlusionTilesX = occlusionWidth / occlusionTileSize;
+const int occlusionTilesY = occlusionHeight / occlusionTileSize;
+
+vector<float> occlusionDepth(occlusionWidth * occlusionHeight, 1.0f);
+
+// Screen space occluder triangle with its edge and depth plane equations
+struct OccluderTriangle {
+	float edgeA[3], edgeB[3], edgeC[3];
+	float depthA, depthB, depthC;
+	int minX, minY, maxX, maxY;
+};
+
+vector<OccluderTriangle> occluderTriangles;
+vector<int> occlusionBins[occlusionTilesX * occlusionTilesY];
+
+// Per frame occlusion statistics
+struct OcclusionStats {
+	int objectsTested;
+	int objectsOccluded;
+	int objectsOutside;
+	int occluderTriangles;
+	double rasterMs;
+	double testMs;
+};
+
+OcclusionStats occlusionStats;
+
+// Project a point to occlusion buffer pixels and [0, 1] depth, false if behind the near plane
+bool projectToOcclusionBuffer(const glm::mat4& viewProjection, const glm::vec3& point, glm::vec3& screen)
+{
+	glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+	if (clip.w <= 1e-5f)
+		return false;
+
+	screen.x = (clip.x / clip.w * 0.5f + 0.5f) * occlusionWidth;
+	screen.y = (clip.y / clip.w * 0.5f + 0.5f) * occlusionHeight;
+	screen.z = clip.z / clip.w * 0.5f + 0.5f;
+	return true;
+}
+
+// Set up one occluder triangle, skipping ones that cross the near plane or cover no pixel centers
+void setupOccluderTriangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+	glm::vec3 v[3] = { p0, p1, p2 };
+
+	float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+	if (fabs(area) < 1e-8f)
+		return;
+
+	// Planes are drawn without face culling, so wind every triangle counter-clockwise
+	if (area < 0.0f) {
+		swap(v[1], v[2]);
+		area = -area;
+	}
+
+	OccluderTriangle tri;
+	tri.minX = max(0, (int)floor(min(v[0].x, min(v[1].x, v[2].x))));
+	tri.minY = max(0, (int)floor(min(v[0].y, min(v[1].y, v[2].y))));
+	tri.maxX = min(occlusionWidth - 1, (int)ceil(max(v[0].x, max(v[1].x, v[2].x))));
+	tri.maxY = min(occlusionHeight - 1, (int)ceil(max(v[0].y, max(v[1].y, v[2].y))));
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return;
+
+	// Edge i is opposite vertex i: e(x, y) = A * x + B * y + C, positive inside
+	for (int i = 0; i < 3; i++) {
+		const glm::vec3& a = v[(i + 1) % 3];
+		const glm::vec3& b = v[(i + 2) % 3];
+		tri.edgeA[i] = a.y - b.y;
+		tri.edgeB[i] = b.x - a.x;
+		tri.edgeC[i] = a.x * b.y - b.x * a.y;
+	}
+
+	// Depth plane from barycentric weights (edge value / area)
+	tri.depthA = (tri.edgeA[0] * v[0].z + tri.edgeA[1] * v[1].z + tri.edgeA[2] * v[2].z) / area;
+	tri.depthB = (tri.edgeB[0] * v[0].z + tri.edgeB[1] * v[1].z + tri.edgeB[2] * v[2].z) / area;
+	tri.depthC = (tri.edgeC[0] * v[0].z + tri.edgeC[1] * v[1].z + tri.edgeC[2] * v[2].z) / area;
+
+	occluderTriangles.push_back(tri);
+}
+
+// Rasterize one triangle into the part of the depth buffer covered by a tile
+void rasterizeTriangleInTile(const OccluderTriangle& tri, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY)
+{
+	int minY = max(tri.minY, tileMinY);
+	int maxY = min(tri.maxY, tileMaxY);
+	int minX = max(tri.minX, tileMinX) & ~7; // whole lanes, still inside the tile
+	int maxX = min(tri.maxX, tileMaxX);
+
+	for (int y = minY; y <= maxY; y++) {
+		float py = y + 0.5f;
+		float* row = &occlusionDepth[y * occlusionWidth];
+
+#if defined(__AVX2__)
+		__m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 rowE0 = _mm256_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+		__m256 rowE1 = _mm256_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+		__m256 rowE2 = _mm256_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+		__m256 rowZ = _mm256_set1_ps(tri.depthB * py + tri.depthC);
+
+		for (int x = minX; x <= maxX; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets);
+			__m256 e0 = _mm256_fmadd_ps(_mm256_set1_ps(tri.edgeA[0]), px, rowE0);
+			__m256 e1 = _mm256_fmadd_ps(_mm256_set1_ps(tri.edgeA[1]), px, rowE1);
+			__m256 e2 = _mm256_fmadd_ps(_mm256_set1_ps(tri.edgeA[2]), px, rowE2);
+
+			__m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+				_mm256_and_ps(_mm256_cmp_ps(e1, zero, _CMP_GE_OQ), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ)));
+			if (_mm256_movemask_ps(inside) == 0)
+				continue;
+
+			__m256 z = _mm256_fmadd_ps(_mm256_set1_ps(tri.depthA), px, rowZ);
+			__m256 depth = _mm256_loadu_ps(row + x);
+			depth = _mm256_blendv_ps(depth, _mm256_min_ps(depth, z), inside);
+			_mm256_storeu_ps(row + x, depth);
+		}
+#else
+		for (int x = minX; x <= maxX; x++) {
+			float px = x + 0.5f;
+			float e0 = tri.edgeA[0] * px + tri.edgeB[0] * py + tri.edgeC[0];
+			float e1 = tri.edgeA[1] * px + tri.edgeB[1] * py + tri.edgeC[1];
+			float e2 = tri.edgeA[2] * px + tri.edgeB[2] * py + tri.edgeC[2];
+			if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f)
+				continue;
+
+			float z = tri.depthA * px + tri.depthB * py + tri.depthC;
+			row[x] = min(row[x], z);
+		}
+#endif
+	}
+}
+
+// Transform every occluder and bin its triangles by the tiles they touch
+void binOccluders(const FrameVector<SceneObject*>& objects, const glm::mat4& viewProjection)
+{
+	occluderTriangles.clear();
+	for (vector<int>& bin : occlusionBins)
+		bin.clear();
+
+	for (const SceneObject* object : objects) {
+		if (!object->isOccluder)
+			continue;
+
+		const Mesh* mesh = coarsestMesh(*object);
+		for (const glm::mat4& part : object->parts) {
+			glm::mat4 modelViewProjection = viewProjection * part;
+
+			for (GLsizei i = 0; i + 2 < mesh->indexCount; i += 3) {
+				glm::vec3 screen[3];
+				bool isVisible = true;
+
+				for (int k = 0; k < 3; k++) {
+					const GLfloat* position = mesh->vertices + meshIndex(*mesh, i + k) * 11;
+					isVisible = isVisible && projectToOcclusionBuffer(modelViewProjection, glm::vec3(position[0], position[1], position[2]), screen[k]);
+				}
+
+				// Dropping an occluder triangle is always conservative
+				if (isVisible)
+					setupOccluderTriangle(screen[0], screen[1], screen[2]);
+			}
+		}
+	}
+
+	// Bin triangles into every tile their bounds touch
+	for (int t = 0; t < (int)occluderTriangles.size(); t++) {
+		const OccluderTriangle& tri = occluderTriangles[t];
+		for (int ty = tri.minY / occlusionTileSize; ty <= tri.maxY / occlusionTileSize; ty++)
+			for (int tx = tri.minX / occlusionTileSize; tx <= tri.maxX / occlusionTileSize; tx++)
+				occlusionBins[ty * occlusionTilesX + tx].push_back(t);
+	}
+
+	occlusionStats.occluderTriangles = (int)occluderTriangles.size();
+}
+
+// Clear and rasterize a range of tiles, each from its own bin
+struct OcclusionTileRange {
+	void operator()(int begin, int end) const
+	{
+		for (int tile = begin; tile < end; tile++) {
+			int tileMinX = (tile % occlusionTilesX) * occlusionTileSize;
+			int tileMinY = (tile / occlusionTilesX) * occlusionTileSize;
+			int tileMaxX = tileMinX + occlusionTileSize - 1;
+			int tileMaxY = tileMinY + occlusionTileSize - 1;
+
+			for (int y = tileMinY; y <= tileMaxY; y++)
+				fill_n(&occlusionDepth[y * occlusionWidth + tileMinX], occlusionTileSize, 1.0f);
+
+			for (int t : occlusionBins[tile])
+				rasterizeTriangleInTile(occluderTriangles[t], tileMinX, tileMinY, tileMaxX, tileMaxY);
+		}
+	}
+};
+
+// Conservative test of an object's bounding box against the occlusion depth buffer
+bool isObjectOccluded(const SceneObject& object, const glm::mat4& viewProjection, bool& isOutside)
+{
+	isOutside = false;
+
+	float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1e30f;
+
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 point(
+			corner & 1 ? object.boundsMax.x : object.boundsMin.x,
+			corner & 2 ? object.boundsMax.y : object.boundsMin.y,
+			corner & 4 ? object.boundsMax.z : object.boundsMin.z);
+
+		// Boxes that reach behind the camera are always drawn
+		glm::vec3 screen;
+		if (!projectToOcclusionBuffer(viewProjection, point, screen))
+			return false;
+
+		minX = min(minX, screen.x);
+		minY = min(minY, screen.y);
+		maxX = max(maxX, screen.x);
+		maxY = max(maxY, screen.y);
+		nearest = min(nearest, screen.z);
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX > occlusionWidth || minY > occlusionHeight || nearest > 1.0f) {
+		isOutside = true;
+		return true;
+	}
+
+	int x0 = max(0, (int)floor(minX));
+	int y0 = max(0, (int)floor(minY));
+	int x1 = min(occlusionWidth - 1, (int)ceil(maxX));
+	int y1 = min(occlusionHeight - 1, (int)ceil(maxY));
+
+	// Visible as soon as one covered pixel is farther than the nearest point of the box
+	for (int y = y0; y <= y1; y++) {
+		const float* row = &occlusionDepth[y * occlusionWidth];
+
+#if defined(__AVX2__)
+		__m256 laneIndex = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		__m256 boxDepth = _mm256_set1_ps(nearest);
+		__m256 first = _mm256_set1_ps((float)x0);
+		__m256 last = _mm256_set1_ps((float)x1);
+
+		for (int x = x0 & ~7; x <= x1; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneIndex);
+			__m256 inRect = _mm256_and_ps(_mm256_cmp_ps(px, first, _CMP_GE_OQ), _mm256_cmp_ps(px, last, _CMP_LE_OQ));
+			__m256 behind = _mm256_cmp_ps(_mm256_loadu_ps(row + x), boxDepth, _CMP_GE_OQ);
+			if (_mm256_movemask_ps(_mm256_and_ps(inRect, behind)) != 0)
+				return false;
+		}
+#else
+		for (int x = x0; x <= x1; x++) {
+			if (row[x] >= nearest)
+				return false;
+		}
+#endif
+	}
+
+	return true;
+}
+
+// Test a range of objects against the finished occlusion buffer: 0 visible, 1 outside the view, 2 occluded
+struct OcclusionTestRange {
+	const FrameVector<SceneObject*>* objects;
+	glm::mat4 viewProjection;
+	char* results;
+
+	void operator()(int begin, int end) const
+	{
+		for (int i = begin; i < end; i++) {
+			bool isOutside;
+			results[i] = isObjectOccluded(*(*objects)[i], viewProjection, isOutside) ? (isOutside ? 1 : 2) : 0;
+		}
+	}
+};
+
+// The tile jobs and the object tests as one job graph: the tiles' counter continues with the tests
+struct OcclusionPass {
+	OcclusionTileRange tileRange;
+	OcclusionTestRange testRange;
+	ParallelLoop<OcclusionTileRange> tiles;
+	ParallelLoop<OcclusionTestRange> tests;
+	mutable chrono::high_resolution_clock::time_point testStart;  // set by the continuation when the tiles are done
+};
+
+void startOcclusionTests(const void* data, int begin, int end)
+{
+	const OcclusionPass& pass = *static_cast<const OcclusionPass*>(data);
+	pass.testStart = chrono::high_resolution_clock::now();
+	runParallelRange<OcclusionTestRange>(&pass.tests, begin, end);
+}
+
+// Build the occlusion buffer and return only the objects that may be visible
+void cullOccludedObjects(const FrameVector<SceneObject*>& objects, const glm::mat4& viewProjection, FrameVector<SceneObject*>& visibleObjects)
+{
+	auto rasterStart = chrono::high_resolution_clock::now();
+	binOccluders(objects, viewProjection);
+
+	FrameVector<char> results(objects.size());
+	JobCounter tilesDone, testsDone;
+	OcclusionPass pass;
+	pass.testRange.objects = &objects;
+	pass.testRange.viewProjection = viewProjection;
+	pass.testRange.results = results.data();
+	pass.tiles.body = &pass.tileRange;
+	pass.tiles.grain = 1;
+	pass.tiles.counter = &tilesDone;
+	pass.tests.body = &pass.testRange;
+	pass.tests.grain = 16;
+	pass.tests.counter = &testsDone;
+	pass.testStart = rasterStart;
+
+	testsDone.pending = 1;
+	Job tests = { startOcclusionTests, &pass, 0, (int)objects.size(), &testsDone };
+	tilesDone.continuation = tests;
+	executeJob(parallelJob(pass.tiles, occlusionTilesX * occlusionTilesY));
+	waitForJobs(testsDone);
+	auto testEnd = chrono::high_resolution_clock::now();
+
+	visibleObjects.clear();
+	occlusionStats.objectsTested = (int)objects.size();
+	occlusionStats.objectsOccluded = 0;
+	occlusionStats.objectsOutside = 0;
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (results[i] == 0)
+			visibleObjects.push_back(objects[i]);
+		else if (results[i] == 1)
+			occlusionStats.objectsOutside++;
+		else
+			occlusionStats.objectsOccluded++;
+	}
+
+	occlusionStats.rasterMs = chrono::duration<double, milli>(pass.testStart - rasterStart).count();
+	occlusionStats.testMs = chrono::duration<double, milli>(testEnd - pass.testStart).count();
+}
+
+// OCCLUSION CULLING END *******************************************************
+
+// MESH SIMPLIFICATION START *******************************************************
+
+// Reduced copy of a mesh in the 11 float layout, unused source vertices dropped
+struct SimplifiedMesh {
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+	float error; // largest collapse error, as a distance relative to the bounding box diagonal
+};
+
+// Symmetric 4x4 error quadric, upper triangle stored row by row
+struct Quadric {
+	double q[10];
+};
+
+// Add the plane ax + by + cz + d = 0 (unit normal)
+void addPlaneQuadric(Quadric& quadric, double a, double b, double c, double d)
+{
+	quadric.q[0] += a * a; quadric.q[1] += a * b; quadric.q[2] += a * c; quadric.q[3] += a * d;
+	quadric.q[4] += b * b; quadric.q[5] += b * c; quadric.q[6] += b * d;
+	quadric.q[7] += c * c; quadric.q[8] += c * d;
+	quadric.q[9] += d * d;
+}
+
+// Sum of squared distances from a point to every plane folded into the two quadrics
+double quadricError(const Quadric& a, const Quadric& b, const glm::vec3& point)
+{
+	double q[10];
+	for (int i = 0; i < 10; i++)
+		q[i] = a.q[i] + b.q[i];
+	double x = point.x, y = point.y, z = point.z;
+	return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+		+ q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+		+ q[7] * z * z + 2.0 * q[8] * z
+		+ q[9];
+}
+
+// Quadric error metric simplification by half edge collapses: a vertex only ever moves onto a
+// neighbour, so every surviving vertex keeps its own UV and normal. Vertices on UV/normal seams
+// (several vertices at one position) and on open borders are locked, which keeps seams intact.
+// Stops at targetIndexCount or when the next collapse would exceed maxError (relative to the
+// bounding box diagonal), whichever comes first.
+SimplifiedMesh simplifyMesh(const GLfloat* vertices, GLsizei vertexCount, const vector<GLuint>& sourceIndices,
+	size_t targetIndexCount, float maxError)
+{
+	SimplifiedMesh result;
+	result.error = 0.0f;
+
+	auto position = [vertices](GLuint v) { return glm::vec3(vertices[v * 11], vertices[v * 11 + 1], vertices[v * 11 + 2]); };
+	auto normal = [vertices](GLuint v) { return glm::vec3(vertices[v * 11 + 8], vertices[v * 11 + 9], vertices[v * 11 + 10]); };
+
+	// Group vertices that share a position
+	vector<GLuint> order(vertexCount);
+	for (GLsizei v = 0; v < vertexCount; v++)
+		order[v] = v;
+	sort(order.begin(), order.end(), [&](GLuint a, GLuint b) {
+		const GLfloat* pa = vertices + a * 11;
+		const GLfloat* pb = vertices + b * 11;
+		return pa[0] != pb[0] ? pa[0] < pb[0] : pa[1] != pb[1] ? pa[1] < pb[1] : pa[2] < pb[2];
+	});
+
+	vector<GLuint> positionId(vertexCount);
+	vector<bool> isLocked(vertexCount, false);
+	for (size_t i = 0; i < order.size(); ) {
+		size_t end = i + 1;
+		while (end < order.size() && position(order[end]) == position(order[i]))
+			end++;
+		for (size_t k = i; k < end; k++) {
+			positionId[order[k]] = order[i];
+			isLocked[order[k]] = end - i > 1;
+		}
+		i = end;
+	}
+
+	// Edges used by a single triangle are open borders
+	vector<pair<GLuint, GLuint>> edges;
+	for (size_t t = 0; t + 2 < sourceIndices.size(); t += 3) {
+		for (int k = 0; k < 3; k++) {
+			GLuint a = positionId[sourceIndices[t + k]], b = positionId[sourceIndices[t + (k + 1) % 3]];
+			edges.push_back(make_pair(min(a, b), max(a, b)));
+		}
+	}
+	sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); ) {
+		size_t end = i + 1;
+		while (end < edges.size() && edges[end] == edges[i])
+			end++;
+		if (end - i == 1) {
+			isLocked[edges[i].first] = true;
+			isLocked[edges[i].second] = true;
+		}
+		i = end;
+	}
+	for (GLsizei v = 0; v < vertexCount; v++)
+		isLocked[v] = isLocked[v] || isLocked[positionId[v]];
+
+	// Plane of every triangle folded into its corners' quadrics
+	glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+	for (GLsizei v = 0; v < vertexCount; v++) {
+		boundsMin = glm::min(boundsMin, position(v));
+		boundsMax = glm::max(boundsMax, position(v));
+	}
+	float diagonal = max(glm::length(boundsMax - boundsMin), 1e-6f);
+	double maxCost = (double)maxError * diagonal * maxError * diagonal;
+
+	vector<Quadric> quadrics(vertexCount);
+	for (Quadric& quadric : quadrics) {
+		for (double& value : quadric.q)
+			value = 0.0;
+	}
+	for (size_t t = 0; t + 2 < sourceIndices.size(); t += 3) {
+		glm::vec3 p0 = position(sourceIndices[t]), p1 = position(sourceIndices[t + 1]), p2 = position(sourceIndices[t + 2]);
+		glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(faceNormal);
+		if (length <= 0.0f)
+			continue;
+		faceNormal /= length;
+		for (int k = 0; k < 3; k++)
+			addPlaneQuadric(quadrics[positionId[sourceIndices[t + k]]], faceNormal.x, faceNormal.y, faceNormal.z, -glm::dot(faceNormal, p0));
+	}
+
+	vector<GLuint> indices = sourceIndices;
+	vector<GLuint> triangleOffsets(vertexCount + 1), triangleList;
+	vector<bool> isTouched(vertexCount);
+
+	struct Collapse {
+		GLuint from, to;
+		double cost;
+	};
+	vector<Collapse> bestCollapse(vertexCount), collapses;
+	vector<GLuint> collapseTarget(vertexCount);
+	vector<GLuint> neighbours, sharedNeighbours;
+
+	while (indices.size() > targetIndexCount) {
+		// Triangles around each vertex
+		fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (GLuint v : indices)
+			triangleOffsets[v + 1]++;
+		for (GLsizei v = 0; v < vertexCount; v++)
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		triangleList.resize(indices.size());
+		vector<GLuint> fillPosition(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			triangleList[fillPosition[indices[i]]++] = (GLuint)(i / 3);
+
+		// Cheapest collapse out of every movable vertex
+		for (GLsizei v = 0; v < vertexCount; v++)
+			bestCollapse[v].cost = -1.0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			for (int k = 0; k < 3; k++) {
+				for (int other = 1; other <= 2; other++) {
+					GLuint from = indices[t + k], to = indices[t + (k + other) % 3];
+					if (isLocked[from])
+						continue;
+					double cost = quadricError(quadrics[positionId[from]], quadrics[positionId[to]], position(to));
+					if (bestCollapse[from].cost < 0.0 || cost < bestCollapse[from].cost) {
+						Collapse collapse = { from, to, cost };
+						bestCollapse[from] = collapse;
+					}
+				}
+			}
+		}
+
+		collapses.clear();
+		for (GLsizei v = 0; v < vertexCount; v++) {
+			if (bestCollapse[v].cost >= 0.0 && bestCollapse[v].cost <= maxCost)
+				collapses.push_back(bestCollapse[v]);
+		}
+		sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// Apply the cheapest independent collapses of this pass
+		fill(isTouched.begin(), isTouched.end(), false);
+		for (GLsizei v = 0; v < vertexCount; v++)
+			collapseTarget[v] = v;
+
+		size_t remainingIndices = indices.size();
+		int collapseCount = 0;
+		for (const Collapse& collapse : collapses) {
+			if (remainingIndices <= targetIndexCount)
+				break;
+			if (isTouched[collapse.from] || isTouched[collapse.to])
+				continue;
+
+			// Keep shading: skip collapses between strongly differing normals
+			if (glm::dot(normal(collapse.from), normal(collapse.to)) < 0.7f)
+				continue;
+
+			// Reject collapses that flip or squash a surviving triangle, or turn it away from the moved normal
+			bool isValid = true;
+			int removedTriangles = 0;
+			for (GLuint i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1] && isValid; i++) {
+				const GLuint* triangle = &indices[triangleList[i] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+					removedTriangles++;
+					continue;
+				}
+				glm::vec3 before[3], after[3];
+				for (int k = 0; k < 3; k++) {
+					before[k] = position(triangle[k]);
+					after[k] = triangle[k] == collapse.from ? position(collapse.to) : before[k];
+				}
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+				isValid = lengths > 0.0f && glm::dot(normalBefore, normalAfter) >= 0.2f * lengths
+					&& glm::dot(normalAfter, normal(collapse.to)) > 0.0f;
+			}
+			if (!isValid)
+				continue;
+
+			// Link condition: the two ends may only share the vertices opposite the collapsed edge,
+			// otherwise the collapse would pinch the surface into a non-manifold fold
+			neighbours.clear();
+			for (GLuint i = triangleOffsets[collapse.to]; i < triangleOffsets[collapse.to + 1]; i++) {
+				for (int k = 0; k < 3; k++)
+					neighbours.push_back(indices[triangleList[i] * 3 + k]);
+			}
+			sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+			sharedNeighbours.clear();
+			for (GLuint i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++) {
+				for (int k = 0; k < 3; k++) {
+					GLuint v = indices[triangleList[i] * 3 + k];
+					if (v != collapse.from && v != collapse.to && binary_search(neighbours.begin(), neighbours.end(), v))
+						sharedNeighbours.push_back(v);
+				}
+			}
+			sort(sharedNeighbours.begin(), sharedNeighbours.end());
+			sharedNeighbours.erase(unique(sharedNeighbours.begin(), sharedNeighbours.end()), sharedNeighbours.end());
+			if ((int)sharedNeighbours.size() != removedTriangles)
+				continue;
+
+			collapseTarget[collapse.from] = collapse.to;
+			for (int i = 0; i < 10; i++)
+				quadrics[positionId[collapse.to]].q[i] += quadrics[positionId[collapse.from]].q[i];
+			result.error = max(result.error, (float)sqrt(max(collapse.cost, 0.0)) / diagonal);
+
+			// Everything around the moved vertex is stale until the next pass
+			isTouched[collapse.from] = true;
+			isTouched[collapse.to] = true;
+			for (GLuint i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++) {
+				for (int k = 0; k < 3; k++)
+					isTouched[indices[triangleList[i] * 3 + k]] = true;
+			}
+
+			remainingIndices -= removedTriangles * 3;
+			collapseCount++;
+		}
+
+		if (collapseCount == 0)
+			break;
+
+		// Rewrite triangles and drop the ones that collapsed to a line
+		size_t kept = 0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			GLuint a = collapseTarget[indices[t]], b = collapseTarget[indices[t + 1]], c = collapseTarget[indices[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+	}
+
+	// Compact the surviving vertices
+	vector<GLint> newIndex(vertexCount, -1);
+	for (GLuint& v : indices) {
+		if (newIndex[v] < 0) {
+			newIndex[v] = (GLint)(result.vertices.size() / 11);
+			result.vertices.insert(result.vertices.end(), vertices + v * 11, vertices + v * 11 + 11);
+		}
+		result.indices.push_back((GLuint)newIndex[v]);
+	}
+
+	return result;
+}
+
+// Source mesh and the fractions of its triangles each reduced level should keep
+struct SimplifyJob {
+	const Mesh* source;
+	vector<float> ratios;
+	vector<SimplifiedMesh> levels;
+	double milliseconds;
+};
+
+// Simplify every job's levels, one mesh per worker at a time (job workers must be running)
+void simplifyMeshes(vector<SimplifyJob>& jobs, float maxError)
+{
+	atomic<int> nextJob(0);
+
+	runOnAllThreads([&] {
+		for (int j = nextJob++; j < (int)jobs.size(); j = nextJob++) {
+			SimplifyJob& job = jobs[j];
+			auto start = chrono::high_resolution_clock::now();
+
+			vector<GLuint> indices(job.source->indexCount);
+			for (GLsizei i = 0; i < job.source->indexCount; i++)
+				indices[i] = meshIndex(*job.source, i);
+
+			job.levels.clear();
+			for (float ratio : job.ratios) {
+				size_t target = (size_t)(job.source->indexCount * ratio) / 3 * 3;
+				job.levels.push_back(simplifyMesh(job.source->vertices, job.source->vertexCount, indices, target, maxError));
+			}
+
+			job.milliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		}
+	});
+}
+
+// Copy a simplified mesh into an arena that was sized for it
+Mesh addSimplifiedMesh(MeshArena& arena, const SimplifiedMesh& simplified)
+{
+	MeshSize size = { (GLsizei)(simplified.vertices.size() / 11), (GLsizei)simplified.indices.size() };
+	Mesh mesh = beginArenaMesh(arena, size);
+	copy(simplified.vertices.begin(), simplified.vertices.end(), arena.vertices.begin() + mesh.baseVertex * 11);
+	copy(simplified.indices.begin(), simplified.indices.end(), arena.indices.begin() + mesh.indexOffset / sizeof(GLuint));
+	return mesh;
+}
+
+// MESH SIMPLIFICATION END *******************************************************
+
+// MESH OPTIMIZATION START *******************************************************
+
+// Post transform cache behaviour of an index order: average cache misses per triangle (ACMR)
+// and per vertex (ATVR, 1.0 is ideal), simulated with a FIFO cache
+struct CacheStats {
+	float acmr;
+	float atvr;
+};
+
+const int fifoCacheSize = 16;
+
+CacheStats simulateVertexCache(const GLuint* indices, size_t indexCount, size_t vertexCount)
+{
+	vector<size_t> insertedAt(vertexCount, 0); // miss counter when the vertex entered the cache, 0 = never
+	size_t misses = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		size_t& stamp = insertedAt[indices[i]];
+		if (stamp == 0 || misses - stamp >= fifoCacheSize) {
+			misses++;
+			stamp = misses;
+		}
+	}
+
+	CacheStats stats = { (float)misses / max((size_t)1, indexCount / 3), (float)misses / max((size_t)1, vertexCount) };
+	return stats;
+}
+
+// Forsyth's linear speed vertex cache optimization: greedily emit the triangle whose vertices score
+// best against a simulated LRU cache, favouring recently used vertices and ones with few triangles left
+void optimizeVertexCache(GLuint* indices, size_t indexCount, size_t vertexCount)
+{
+	const int cacheSize = 32;
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	auto vertexScore = [](int cachePosition, int remaining) {
+		if (remaining == 0)
+			return -1.0f;
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			// The last triangle's vertices get a fixed score, so it is not simply repeated
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+		}
+		// Boost vertices with few triangles left, so they are finished and leave no stragglers
+		return score + 2.0f * pow((float)remaining, -0.5f);
+	};
+
+	// Triangles around each vertex
+	vector<int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		remaining[indices[i]]++;
+	vector<size_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	vector<size_t> vertexTriangles(indexCount);
+	vector<size_t> fillPosition(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indexCount; i++)
+		vertexTriangles[fillPosition[indices[i]]++] = i / 3;
+
+	vector<int> cachePosition(vertexCount, -1);
+	vector<float> scores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		scores[v] = vertexScore(-1, remaining[v]);
+
+	vector<float> triangleScores(triangleCount);
+	vector<bool> isEmitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+
+	vector<GLuint> output;
+	output.reserve(indexCount);
+	vector<GLuint> cache, nextCache;
+	size_t scanCursor = 0;
+
+	size_t best = 0;
+	for (size_t t = 1; t < triangleCount; t++) {
+		if (triangleScores[t] > triangleScores[best])
+			best = t;
+	}
+
+	while (true) {
+		isEmitted[best] = true;
+		const GLuint* triangle = indices + best * 3;
+
+		// Emitted triangle's vertices go to the front of the cache
+		nextCache.assign(triangle, triangle + 3);
+		for (GLuint v : cache) {
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				nextCache.push_back(v);
+		}
+		for (int k = 0; k < 3; k++) {
+			output.push_back(triangle[k]);
+			remaining[triangle[k]]--;
+		}
+
+		// Vertices pushed out of the cache lose their cache score
+		for (size_t i = cacheSize; i < nextCache.size(); i++) {
+			cachePosition[nextCache[i]] = -1;
+			scores[nextCache[i]] = vertexScore(-1, remaining[nextCache[i]]);
+		}
+		if (nextCache.size() > (size_t)cacheSize)
+			nextCache.resize(cacheSize);
+		cache.swap(nextCache);
+
+		for (size_t i = 0; i < cache.size(); i++) {
+			cachePosition[cache[i]] = (int)i;
+			scores[cache[i]] = vertexScore((int)i, remaining[cache[i]]);
+		}
+
+		// Only triangles touching the cache changed score; the best of them is the next one
+		float bestScore = -1.0f;
+		for (GLuint v : cache) {
+			for (size_t i = offsets[v]; i < offsets[v + 1]; i++) {
+				size_t t = vertexTriangles[i];
+				if (isEmitted[t])
+					continue;
+				triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+				if (triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					best = t;
+				}
+			}
+		}
+
+		// Nothing next to the cache: continue with any triangle that is left
+		if (bestScore < 0.0f) {
+			while (scanCursor < triangleCount && isEmitted[scanCursor])
+				scanCursor++;
+			if (scanCursor == triangleCount)
+				break;
+			best = scanCursor;
+		}
+	}
+
+	copy(output.begin(), output.end(), indices);
+}
+
+// Reorder runs of a cache optimized index buffer so clusters facing away from the mesh center come
+// first; they tend to hide the rest of the mesh, cutting overdraw. Runs are cut where the cache
+// order already restarts, or where starting a fresh cache costs at most `threshold` in ACMR.
+void optimizeOverdraw(GLuint* indices, size_t indexCount, const GLfloat* vertices, float threshold)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+
+	auto position = [vertices](GLuint v) { return glm::vec3(vertices[v * 11], vertices[v * 11 + 1], vertices[v * 11 + 2]); };
+
+	// Per triangle cache misses (FIFO) to find where the order restarts
+	vector<int> triangleMisses(triangleCount, 0);
+	{
+		vector<GLuint> fifo;
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				GLuint v = indices[t * 3 + k];
+				if (find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+					triangleMisses[t]++;
+					fifo.push_back(v);
+					if (fifo.size() > (size_t)fifoCacheSize)
+						fifo.erase(fifo.begin());
+				}
+			}
+		}
+	}
+
+	// Hard cuts where all three vertices missed, soft cuts inside those runs when affordable
+	vector<size_t> clusterStarts;
+	for (size_t start = 0; start < triangleCount; ) {
+		size_t end = start + 1;
+		while (end < triangleCount && triangleMisses[end] < 3)
+			end++;
+
+		int runMisses = 0;
+		for (size_t t = start; t < end; t++)
+			runMisses += triangleMisses[t];
+		float runAcmr = (float)runMisses / (end - start);
+
+		clusterStarts.push_back(start);
+		int misses = 0;
+		for (size_t t = start; t < end; t++) {
+			misses += triangleMisses[t];
+			if (t + 1 < end && t + 1 - clusterStarts.back() >= 8 && (float)(misses + 3) / (t + 1 - start) <= runAcmr * threshold) {
+				clusterStarts.push_back(t + 1);
+				misses += 3; // a fresh cache misses the next triangle completely
+			}
+		}
+		start = end;
+	}
+	clusterStarts.push_back(triangleCount);
+
+	// Area weighted center and normal of the mesh and of each cluster
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	struct Cluster {
+		size_t start, end;
+		float sortKey;
+	};
+	vector<Cluster> clusters;
+	vector<glm::vec3> clusterCenters, clusterNormals;
+
+	for (size_t c = 0; c + 1 < clusterStarts.size(); c++) {
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+			glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+			glm::vec3 crossed = glm::cross(p1 - p0, p2 - p0);
+			float triangleArea = glm::length(crossed) * 0.5f;
+			center += (p0 + p1 + p2) / 3.0f * triangleArea;
+			normal += crossed;
+			area += triangleArea;
+		}
+		meshCenter += center;
+		meshArea += area;
+		clusterCenters.push_back(area > 0.0f ? center / area : position(indices[clusterStarts[c] * 3]));
+		clusterNormals.push_back(glm::length(normal) > 0.0f ? glm::normalize(normal) : normal);
+		Cluster cluster = { clusterStarts[c], clusterStarts[c + 1], 0.0f };
+		clusters.push_back(cluster);
+	}
+	if (meshArea > 0.0f)
+		meshCenter /= meshArea;
+
+	for (size_t c = 0; c < clusters.size(); c++)
+		clusters[c].sortKey = glm::dot(clusterCenters[c] - meshCenter, clusterNormals[c]);
+
+	stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	vector<GLuint> output;
+	output.reserve(indexCount);
+	for (const Cluster& cluster : clusters)
+		output.insert(output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+	copy(output.begin(), output.end(), indices);
+}
+
+// Renumber vertices in the order the indices first use them, so vertex fetch walks memory forward
+void optimizeVertexFetch(GLuint* indices, size_t indexCount, GLfloat* vertices, size_t vertexCount)
+{
+	vector<int> remap(vertexCount, -1);
+	int next = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		if (remap[indices[i]] < 0)
+			remap[indices[i]] = next++;
+		indices[i] = (GLuint)remap[indices[i]];
+	}
+	// Unreferenced vertices keep their relative order at the end
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (remap[v] < 0)
+			remap[v] = next++;
+	}
+
+	vector<GLfloat> reordered(vertexCount * 11);
+	for (size_t v = 0; v < vertexCount; v++)
+		copy(vertices + v * 11, vertices + v * 11 + 11, reordered.begin() + remap[v] * 11);
+	copy(reordered.begin(), reordered.end(), vertices);
+}
+
+// Run all three passes on a mesh in place in its arena and return its cache behaviour before and after.
+// Small meshes that are already near ideal can come out marginally worse; those keep their order.
+void optimizeArenaMesh(MeshArena& arena, const Mesh& mesh, CacheStats& before, CacheStats& after)
+{
+	GLuint* indices = arena.indices.data() + mesh.indexOffset / sizeof(GLuint);
+	GLfloat* vertices = arena.vertices.data() + mesh.baseVertex * 11;
+	vector<GLuint> originalIndices(indices, indices + mesh.indexCount);
+	vector<GLfloat> originalVertices(vertices, vertices + mesh.vertexCount * 11);
+
+	before = simulateVertexCache(indices, mesh.indexCount, mesh.vertexCount);
+	optimizeVertexCache(indices, mesh.indexCount, mesh.vertexCount);
+	optimizeOverdraw(indices, mesh.indexCount, vertices, 1.05f);
+	optimizeVertexFetch(indices, mesh.indexCount, vertices, mesh.vertexCount);
+	after = simulateVertexCache(indices, mesh.indexCount, mesh.vertexCount);
+
+	if (after.acmr > before.acmr) {
+		copy(originalIndices.begin(), originalIndices.end(), indices);
+		copy(originalVertices.begin(), originalVertices.end(), vertices);
+		after = before;
+	}
+}
+
+// MESH OPTIMIZATION END *******************************************************
+
+// MESHLETS START *******************************************************
+
+// Large meshes are cut into clusters of consecutive triangles, small enough that a cluster's
+// bounding sphere and normal cone are tight: clusters outside the frustum or facing away from the
+// camera are skipped and the rest are drawn with one multi draw per part
+const int meshletMaxVertices = 64;
+const int meshletMaxTriangles = 124;
+const int meshletMinMeshTriangles = 1024; // smaller meshes are drawn whole
+
+// Clusters visible in the last frame, refreshed by buildDrawList
+struct MeshletStats {
+	int tested;
+	int frustumCulled;
+	int backfaceCulled;
+	long long trianglesTested;
+	long long trianglesCulled;
+};
+
+MeshletStats meshletStats;
+
+// Boolean to toggle cluster culling
+bool isMeshletCulling = true;
+
+// Grow clusters across shared vertices, always taking the adjacent triangle that adds the fewest new
+// vertices (then the one nearest the cluster), and rewrite the mesh's indices cluster by cluster so
+// every cluster is a contiguous index range. The vertex cache order is rebuilt inside each cluster and
+// the vertices are renumbered for fetch; the overdraw order is traded for tight clusters.
+void buildMeshlets(GLuint* indices, GLsizei indexCount, GLfloat* vertices, GLsizei vertexCount, vector<Meshlet>& meshlets)
+{
+	auto position = [vertices](GLuint v) { return glm::vec3(vertices[v * 11], vertices[v * 11 + 1], vertices[v * 11 + 2]); };
+	auto triangleCenter = [&](GLsizei t) { return (position(indices[t * 3]) + position(indices[t * 3 + 1]) + position(indices[t * 3 + 2])) / 3.0f; };
+	GLsizei triangleCount = indexCount / 3;
+
+	// Triangles around every vertex
+	vector<GLsizei> adjacencyOffsets(vertexCount + 1, 0), adjacency(indexCount);
+	for (GLsizei i = 0; i < indexCount; i++)
+		adjacencyOffsets[indices[i] + 1]++;
+	for (GLsizei v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	vector<GLsizei> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (GLsizei i = 0; i < indexCount; i++)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	vector<bool> isEmitted(triangleCount, false);
+	vector<int> meshletOfVertex(vertexCount, -1);
+	vector<GLuint> clusterVertices, order;
+	order.reserve(indexCount);
+	GLsizei nextSeed = 0;
+	size_t firstMeshlet = meshlets.size();
+
+	while (nextSeed < triangleCount) {
+		if (isEmitted[nextSeed]) {
+			nextSeed++;
+			continue;
+		}
+
+		int clusterId = (int)(meshlets.size() - firstMeshlet);
+		Meshlet meshlet;
+		meshlet.firstIndex = (GLsizei)order.size();
+		clusterVertices.clear();
+		glm::vec3 centerSum(0.0f);
+		int clusterTriangles = 0;
+
+		GLsizei next = nextSeed;
+		while (next >= 0) {
+			isEmitted[next] = true;
+			for (int k = 0; k < 3; k++) {
+				GLuint v = indices[next * 3 + k];
+				order.push_back(v);
+				if (meshletOfVertex[v] != clusterId) {
+					meshletOfVertex[v] = clusterId;
+					clusterVertices.push_back(v);
+				}
+			}
+			centerSum += triangleCenter(next);
+			clusterTriangles++;
+			if (clusterTriangles >= meshletMaxTriangles)
+				break;
+
+			glm::vec3 center = centerSum / (float)clusterTriangles;
+			int bestNew = 4;
+			float bestDistance = 1e30f;
+			next = -1;
+			for (GLuint v : clusterVertices) {
+				for (GLsizei a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++) {
+					GLsizei t = adjacency[a];
+					if (isEmitted[t])
+						continue;
+					int newVertices = 0;
+					for (int k = 0; k < 3; k++)
+						newVertices += meshletOfVertex[indices[t * 3 + k]] != clusterId ? 1 : 0;
+					if ((int)clusterVertices.size() + newVertices > meshletMaxVertices || newVertices > bestNew)
+						continue;
+					float distance = glm::length(triangleCenter(t) - center);
+					if (newVertices < bestNew || distance < bestDistance) {
+						bestNew = newVertices;
+						bestDistance = distance;
+						next = t;
+					}
+				}
+			}
+		}
+
+		meshlet.indexCount = (GLsizei)order.size() - meshlet.firstIndex;
+		meshlets.push_back(meshlet);
+	}
+
+	copy(order.begin(), order.end(), indices);
+	for (size_t m = firstMeshlet; m < meshlets.size(); m++)
+		optimizeVertexCache(indices + meshlets[m].firstIndex, meshlets[m].indexCount, vertexCount);
+	optimizeVertexFetch(indices, indexCount, vertices, vertexCount);
+
+	// Bounding sphere and normal cone of every cluster
+	for (size_t m = firstMeshlet; m < meshlets.size(); m++) {
+		Meshlet& meshlet = meshlets[m];
+		const GLuint* clusterIndices = indices + meshlet.firstIndex;
+
+		glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+		for (GLsizei i = 0; i < meshlet.indexCount; i++) {
+			boundsMin = glm::min(boundsMin, position(clusterIndices[i]));
+			boundsMax = glm::max(boundsMax, position(clusterIndices[i]));
+		}
+		meshlet.center = (boundsMin + boundsMax) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (GLsizei i = 0; i < meshlet.indexCount; i++)
+			meshlet.radius = max(meshlet.radius, glm::length(position(clusterIndices[i]) - meshlet.center));
+
+		vector<glm::vec3> normals;
+		glm::vec3 axis(0.0f);
+		for (GLsizei i = 0; i < meshlet.indexCount; i += 3) {
+			glm::vec3 a = position(clusterIndices[i]), b = position(clusterIndices[i + 1]), c = position(clusterIndices[i + 2]);
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			if (glm::length(normal) > 0.0f) {
+				normals.push_back(glm::normalize(normal));
+				axis += normals.back();
+			}
+		}
+		float axisLength = glm::length(axis);
+		meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 1.0f, 0.0f);
+		float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+		for (const glm::vec3& normal : normals)
+			minDot = min(minDot, glm::dot(normal, meshlet.coneAxis));
+		// Past about 84 degrees from the axis the cone test would almost never pass anyway
+		meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : sqrt(1.0f - minDot * minDot);
+	}
+}
+
+// Cluster every large triangle list of the arena (before packing, while the indices are 32 bit)
+// and point the meshes at their clusters
+void buildArenaMeshlets(MeshArena& arena, const vector<Mesh*>& meshes)
+{
+	vector<size_t> firstMeshlet;
+	for (Mesh* mesh : meshes) {
+		firstMeshlet.push_back(arena.meshlets.size());
+		if (mesh->mode != GL_TRIANGLES || mesh->indexCount / 3 < meshletMinMeshTriangles)
+			continue;
+		buildMeshlets(arena.indices.data() + mesh->indexOffset / sizeof(GLuint), mesh->indexCount,
+			arena.vertices.data() + mesh->baseVertex * 11, mesh->vertexCount, arena.meshlets);
+	}
+
+	// Pointers are taken once the vector has stopped growing
+	for (size_t m = 0; m < meshes.size(); m++) {
+		size_t end = m + 1 < meshes.size() ? firstMeshlet[m + 1] : arena.meshlets.size();
+		meshes[m]->meshletCount = (GLsizei)(end - firstMeshlet[m]);
+		meshes[m]->meshlets = meshes[m]->meshletCount ? arena.meshlets.data() + firstMeshlet[m] : nullptr;
+	}
+}
+
+// Multi draw ranges of the clusters that survived culling, for every draw item of the frame
+struct ClusterDraws {
+	FrameVector<GLsizei> counts;
+	FrameVector<const GLvoid*> offsets;
+	FrameVector<GLint> baseVertices;
+};
+
+ClusterDraws clusterDraws;
+
+// Cull a mesh's clusters against the frustum and the camera in mesh space and append the survivors,
+// merging neighbours into one range. Returns the number of ranges appended.
+int cullMeshlets(const Mesh& mesh, const glm::mat4& viewProjection, const glm::mat4& model, const glm::vec3& cameraPosition, bool isPerspective,
+	ClusterDraws& draws, MeshletStats& stats)
+{
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection * model, planes);
+	glm::vec3 camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+	GLsizeiptr indexSize = indexTypeSize(mesh.indexType);
+
+	int ranges = 0;
+	GLsizei rangeEnd = -1;
+	for (GLsizei m = 0; m < mesh.meshletCount; m++) {
+		const Meshlet& meshlet = mesh.meshlets[m];
+		stats.tested++;
+		stats.trianglesTested += meshlet.indexCount / 3;
+
+		bool isOutside = false;
+		for (int p = 0; p < 6 && !isOutside; p++)
+			isOutside = glm::dot(glm::vec3(planes[p]), meshlet.center) + planes[p].w < -meshlet.radius;
+		if (isOutside) {
+			stats.frustumCulled++;
+			stats.trianglesCulled += meshlet.indexCount / 3;
+			continue;
+		}
+
+		// Every triangle faces away when the camera is outside the cone's mirror around the sphere
+		glm::vec3 toCenter = meshlet.center - camera;
+		if (isPerspective && glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius) {
+			stats.backfaceCulled++;
+			stats.trianglesCulled += meshlet.indexCount / 3;
+			continue;
+		}
+
+		if (meshlet.firstIndex == rangeEnd) {
+			draws.counts.back() += meshlet.indexCount;
+		}
+		else {
+			draws.counts.push_back(meshlet.indexCount);
+			draws.offsets.push_back((const GLvoid*)(mesh.indexOffset + meshlet.firstIndex * indexSize));
+			draws.baseVertices.push_back(mesh.baseVertex);
+			ranges++;
+		}
+		rangeEnd = meshlet.firstIndex + meshlet.indexCount;
+	}
+	return ranges;
+}
+
+// MESHLETS END *******************************************************
+
+// MESH IMPORT START *******************************************************
+
+// Mesh read from an OBJ, glTF or cooked file, in the 11 float layout (white color) with deduplicated vertices
+struct ImportedMesh {
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+// Where an import spent its time, for throughput reports
+struct ImportTimings {
+	size_t bytes;
+	double readMs;
+	double parseMs;  // text or binary to positions, UVs, normals and corners
+	double buildMs;  // corners to deduplicated vertices and indices
+};
+
+// Files are read with zero padding past the end so the parsers can always look eight bytes ahead
+const size_t importPadding = 16;
+
+bool readImportFile(const string& path, vector<char>& bytes, size_t& size)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file)
+		return false;
+	size = (size_t)file.tellg();
+	file.seekg(0);
+	bytes.assign(size + importPadding, 0);
+	return (bool)file.read(bytes.data(), size);
+}
+
+double millisecondsSince(chrono::high_resolution_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// Eight ASCII digits at once within a 64 bit register (little endian); false if any of them is not a digit
+bool parseEightDigits(const char* p, uint32_t& value)
+{
+	uint64_t chunk;
+	memcpy(&chunk, p, sizeof(chunk));
+	if (((chunk & 0xF0F0F0F0F0F0F0F0ull) | (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) != 0x3333333333333333ull)
+		return false;
+	chunk = (chunk & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+	chunk = (chunk & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+	value = (uint32_t)((chunk & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+	return true;
+}
+
+// Decimal number with optional sign, fraction and exponent. Significant digits past 19 are dropped,
+// far below float precision; long fractions are taken eight digits at a time.
+const char* parseFloat(const char* p, float& value)
+{
+	static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool isNegative = *p == '-';
+	if (*p == '-' || *p == '+')
+		p++;
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa ? 1 : 0;
+		}
+		else {
+			exponent++;
+		}
+	}
+	if (*p == '.') {
+		p++;
+		uint32_t eight;
+		while (digits <= 11 && parseEightDigits(p, eight)) {
+			mantissa = mantissa * 100000000u + eight;
+			digits += mantissa ? 8 : 0;
+			exponent -= 8;
+			p += 8;
+		}
+		for (; *p >= '0' && *p <= '9'; p++) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa ? 1 : 0;
+				exponent--;
+			}
+		}
+	}
+	if (*p == 'e' || *p == 'E') {
+		p++;
+		bool isNegativeExponent = *p == '-';
+		if (*p == '-' || *p == '+')
+			p++;
+		int written = 0;
+		for (; *p >= '0' && *p <= '9'; p++)
+			written = min(written * 10 + (*p - '0'), 10000);
+		exponent += isNegativeExponent ? -written : written;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0)
+		result = exponent >= -22 ? result / powersOfTen[-exponent] : result * pow(10.0, exponent);
+	else if (exponent > 0)
+		result = exponent <= 22 ? result * powersOfTen[exponent] : result * pow(10.0, exponent);
+	value = (float)(isNegative ? -result : result);
+	return p;
+}
+
+const char* parseInt(const char* p, int& value)
+{
+	bool isNegative = *p == '-';
+	if (*p == '-' || *p == '+')
+		p++;
+	int result = 0;
+	for (; *p >= '0' && *p <= '9'; p++)
+		result = result * 10 + (*p - '0');
+	value = isNegative ? -result : result;
+	return p;
+}
+
+// Vertices are merged when all 11 floats match bit for bit, through an open addressing table sized
+// for one vertex per corner, so it never gets more than half full
+struct VertexDeduplicator {
+	vector<GLuint> slots; // vertex + 1, 0 when empty
+	size_t mask;
+	ImportedMesh* mesh;
+};
+
+void beginDeduplication(VertexDeduplicator& dedup, ImportedMesh& mesh, size_t cornerCount)
+{
+	size_t capacity = 64;
+	while (capacity < cornerCount * 2)
+		capacity *= 2;
+	dedup.slots.assign(capacity, 0);
+	dedup.mask = capacity - 1;
+	dedup.mesh = &mesh;
+}
+
+GLuint addVertex(VertexDeduplicator& dedup, const GLfloat* vertex)
+{
+	vector<GLfloat>& vertices = dedup.mesh->vertices;
+
+	uint64_t hash = 0x9E3779B97F4A7C15ull;
+	for (int k = 0; k < 11; k++) {
+		uint32_t bits;
+		memcpy(&bits, &vertex[k], sizeof(bits));
+		hash = (hash ^ bits) * 0xFF51AFD7ED558CCDull;
+	}
+	hash ^= hash >> 32;
+
+	for (size_t slot = hash & dedup.mask;; slot = (slot + 1) & dedup.mask) {
+		GLuint stored = dedup.slots[slot];
+		if (stored == 0) {
+			GLuint index = (GLuint)(vertices.size() / 11);
+			vertices.insert(vertices.end(), vertex, vertex + 11);
+			dedup.slots[slot] = index + 1;
+			return index;
+		}
+		if (memcmp(&vertices[(stored - 1) * 11], vertex, 11 * sizeof(GLfloat)) == 0)
+			return stored - 1;
+	}
+}
+
+void computeImportBounds(ImportedMesh& mesh)
+{
+	mesh.boundsMin = glm::vec3(1e30f);
+	mesh.boundsMax = glm::vec3(-1e30f);
+	for (size_t v = 0; v < mesh.vertices.size(); v += 11) {
+		glm::vec3 position(mesh.vertices[v], mesh.vertices[v + 1], mesh.vertices[v + 2]);
+		mesh.boundsMin = glm::min(mesh.boundsMin, position);
+		mesh.boundsMax = glm::max(mesh.boundsMax, position);
+	}
+}
+
+// OBJ text is cut into line aligned chunks parsed on the worker threads. Face corners keep OBJ's
+// indices: absolute ones become 0 based, relative (negative) ones are kept relative to the chunk's
+// own element count and resolved once every chunk's counts are known.
+const int64_t objMissing = INT64_MIN;
+const int64_t objRelative = 1LL << 40;
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+	vector<float> positions;  // xyz
+	vector<float> texCoords;  // uv
+	vector<float> normals;    // xyz
+	vector<int64_t> corners;  // position, texture coordinate and normal per face corner
+	vector<int> faceSizes;
+	size_t positionBase, texCoordBase, normalBase;
+};
+
+const char* skipSpaces(const char* p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+int64_t objIndex(int written, size_t localCount)
+{
+	if (written > 0)
+		return written - 1;
+	if (written < 0)
+		return (int64_t)localCount + written - objRelative;
+	return objMissing;
+}
+
+void parseObjChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		p = skipSpaces(p);
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			float value;
+			p += 2;
+			for (int k = 0; k < 3; k++) {
+				p = parseFloat(skipSpaces(p), value);
+				chunk.positions.push_back(value);
+			}
+		}
+		else if (p[0] == 'v' && p[1] == 't') {
+			float value;
+			p = skipSpaces(p + 2);
+			for (int k = 0; k < 2; k++) {
+				p = parseFloat(skipSpaces(p), value);
+				chunk.texCoords.push_back(value);
+			}
+		}
+		else if (p[0] == 'v' && p[1] == 'n') {
+			float value;
+			p += 2;
+			for (int k = 0; k < 3; k++) {
+				p = parseFloat(skipSpaces(p), value);
+				chunk.normals.push_back(value);
+			}
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			p = skipSpaces(p + 2);
+			int corners = 0;
+			while (*p == '-' || (*p >= '0' && *p <= '9')) {
+				int position = 0, texCoord = 0, normal = 0;
+				p = parseInt(p, position);
+				if (*p == '/') {
+					p++;
+					if (*p != '/')
+						p = parseInt(p, texCoord);
+					if (*p == '/')
+						p = parseInt(p + 1, normal);
+				}
+				chunk.corners.push_back(objIndex(position, chunk.positions.size() / 3));
+				chunk.corners.push_back(objIndex(texCoord, chunk.texCoords.size() / 2));
+				chunk.corners.push_back(objIndex(normal, chunk.normals.size() / 3));
+				corners++;
+				p = skipSpaces(p);
+			}
+			chunk.faceSizes.push_back(corners);
+		}
+
+		// Comments, groups, materials and anything else are skipped to the end of the line
+		while (p < chunk.end && *p != '\n')
+			p++;
+		p++;
+	}
+}
+
+bool importObj(const char* text, size_t size, bool isParallel, ImportedMesh& mesh, ImportTimings& timings, string& error)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	// A few chunks per thread, cut at line ends
+	size_t chunkCount = isParallel ? (jobSystem.threads.size() + 1) * 4 : 1;
+	chunkCount = max((size_t)1, min(chunkCount, size / 4096 + 1));
+	vector<ObjChunk> chunks(chunkCount);
+	const char* cut = text;
+	for (size_t c = 0; c < chunkCount; c++) {
+		chunks[c].begin = cut;
+		cut = c + 1 == chunkCount ? text + size : max(cut, text + size * (c + 1) / chunkCount);
+		while (cut < text + size && cut[-1] != '\n')
+			cut++;
+		chunks[c].end = cut;
+	}
+
+	if (isParallel) {
+		atomic<size_t> nextChunk(0);
+		runOnAllThreads([&] {
+			for (size_t c = nextChunk++; c < chunkCount; c = nextChunk++)
+				parseObjChunk(chunks[c]);
+		});
+	}
+	else {
+		parseObjChunk(chunks[0]);
+	}
+
+	size_t positionCount = 0, texCoordCount = 0, normalCount = 0, cornerCount = 0;
+	for (ObjChunk& chunk : chunks) {
+		chunk.positionBase = positionCount;
+		chunk.texCoordBase = texCoordCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positions.size() / 3;
+		texCoordCount += chunk.texCoords.size() / 2;
+		normalCount += chunk.normals.size() / 3;
+		cornerCount += chunk.corners.size() / 3;
+	}
+	timings.parseMs = millisecondsSince(start);
+	start = chrono::high_resolution_clock::now();
+
+	// Resolve every corner to global 0 based indices, -1 where a texture coordinate or normal is missing
+	bool isMissingNormals = false;
+	for (ObjChunk& chunk : chunks) {
+		size_t bases[3] = { chunk.positionBase, chunk.texCoordBase, chunk.normalBase };
+		size_t counts[3] = { positionCount, texCoordCount, normalCount };
+		for (size_t i = 0; i < chunk.corners.size(); i++) {
+			int64_t& corner = chunk.corners[i];
+			int k = i % 3;
+			if (corner == objMissing && k == 0) {
+				error = "face corner without a position";
+				return false;
+			}
+			if (corner == objMissing) {
+				corner = -1;
+				isMissingNormals |= k == 2;
+				continue;
+			}
+			if (corner < 0)
+				corner += objRelative + (int64_t)bases[k];
+			if (corner < 0 || corner >= (int64_t)counts[k]) {
+				error = "face index out of range";
+				return false;
+			}
+		}
+	}
+
+	// Flatten the element arrays so corners index them directly
+	vector<float> positions, texCoords, normals;
+	positions.reserve(positionCount * 3);
+	texCoords.reserve(texCoordCount * 2);
+	normals.reserve(normalCount * 3);
+	for (const ObjChunk& chunk : chunks) {
+		positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+		normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+	}
+
+	// Corners without a normal take the area weighted average of the faces around their position
+	vector<glm::vec3> positionNormals;
+	if (isMissingNormals) {
+		positionNormals.assign(positionCount, glm::vec3(0.0f));
+		for (const ObjChunk& chunk : chunks) {
+			const int64_t* corner = chunk.corners.data();
+			for (int faceSize : chunk.faceSizes) {
+				glm::vec3 first(positions[corner[0] * 3], positions[corner[0] * 3 + 1], positions[corner[0] * 3 + 2]);
+				for (int k = 1; k + 1 < faceSize; k++) {
+					const float* b = &positions[corner[k * 3] * 3];
+					const float* c = &positions[corner[(k + 1) * 3] * 3];
+					glm::vec3 normal = glm::cross(glm::vec3(b[0], b[1], b[2]) - first, glm::vec3(c[0], c[1], c[2]) - first);
+					positionNormals[corner[0]] += normal;
+					positionNormals[corner[k * 3]] += normal;
+					positionNormals[corner[(k + 1) * 3]] += normal;
+				}
+				corner += faceSize * 3;
+			}
+		}
+	}
+
+	VertexDeduplicator dedup;
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	beginDeduplication(dedup, mesh, cornerCount);
+	GLfloat vertex[11] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+	vector<GLuint> face;
+	for (const ObjChunk& chunk : chunks) {
+		const int64_t* corner = chunk.corners.data();
+		for (int faceSize : chunk.faceSizes) {
+			face.clear();
+			for (int k = 0; k < faceSize; k++, corner += 3) {
+				memcpy(vertex, &positions[corner[0] * 3], 3 * sizeof(GLfloat));
+				vertex[6] = corner[1] >= 0 ? texCoords[corner[1] * 2] : 0.0f;
+				vertex[7] = corner[1] >= 0 ? texCoords[corner[1] * 2 + 1] : 0.0f;
+				glm::vec3 normal = corner[2] >= 0 ? glm::vec3(normals[corner[2] * 3], normals[corner[2] * 3 + 1], normals[corner[2] * 3 + 2])
+					: positionNormals[corner[0]];
+				float length = glm::length(normal);
+				normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+				vertex[8] = normal.x;
+				vertex[9] = normal.y;
+				vertex[10] = normal.z;
+				face.push_back(addVertex(dedup, vertex));
+			}
+			// Polygons become fans
+			for (int k = 1; k + 1 < faceSize; k++) {
+				mesh.indices.push_back(face[0]);
+				mesh.indices.push_back(face[k]);
+				mesh.indices.push_back(face[k + 1]);
+			}
+		}
+	}
+
+	computeImportBounds(mesh);
+	timings.buildMs = millisecondsSince(start);
+	if (mesh.indices.empty()) {
+		error = "no faces";
+		return false;
+	}
+	return true;
+}
+
+// Just enough JSON for glTF: objects keep their keys beside the values in items
+struct JsonValue {
+	enum Type { Null, Boolean, Number, String, Array, Object };
+	Type type = Null;
+	bool boolean = false;
+	double number = 0.0;
+	string text;
+	vector<string> keys;
+	vector<JsonValue> items;
+};
+
+const JsonValue* jsonMember(const JsonValue& object, const char* key)
+{
+	for (size_t i = 0; i < object.keys.size(); i++) {
+		if (object.keys[i] == key)
+			return &object.items[i];
+	}
+	return nullptr;
+}
+
+double jsonNumber(const JsonValue& object, const char* key, double fallback)
+{
+	const JsonValue* member = jsonMember(object, key);
+	return member && member->type == JsonValue::Number ? member->number : fallback;
+}
+
+const JsonValue* jsonItem(const JsonValue& root, const char* key, double index)
+{
+	const JsonValue* array = jsonMember(root, key);
+	if (!array || index < 0 || index >= array->items.size())
+		return nullptr;
+	return &array->items[(size_t)index];
+}
+
+const char* skipJsonSpace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+// Returns null on malformed input; \u escapes outside ASCII become '?', glTF only needs them in names
+const char* parseJsonString(const char* p, const char* end, string& text)
+{
+	p++;
+	while (p < end && *p != '"') {
+		if (*p == '\\' && p + 1 < end) {
+			p++;
+			switch (*p) {
+			case 'n': text += '\n'; break;
+			case 't': text += '\t'; break;
+			case 'r': text += '\r'; break;
+			case 'b': text += '\b'; break;
+			case 'f': text += '\f'; break;
+			case 'u': {
+				int code = 0;
+				for (int k = 1; k <= 4 && p + k < end; k++)
+					code = code * 16 + (isdigit((unsigned char)p[k]) ? p[k] - '0' : (tolower(p[k]) - 'a' + 10) & 15);
+				text += code < 128 ? (char)code : '?';
+				p += 4;
+				break;
+			}
+			default: text += *p; break;
+			}
+			p++;
+		}
+		else {
+			text += *p++;
+		}
+	}
+	return p < end ? p + 1 : nullptr;
+}
+
+const char* parseJson(const char* p, const char* end, JsonValue& value, int depth)
+{
+	p = skipJsonSpace(p, end);
+	if (p >= end || depth > 64)
+		return nullptr;
+
+	if (*p == '{' || *p == '[') {
+		bool isObject = *p == '{';
+		char close = isObject ? '}' : ']';
+		value.type = isObject ? JsonValue::Object : JsonValue::Array;
+		p = skipJsonSpace(p + 1, end);
+		if (p < end && *p == close)
+			return p + 1;
+		while (p < end) {
+			if (isObject) {
+				value.keys.push_back(string());
+				p = skipJsonSpace(p, end);
+				if (p >= end || *p != '"' || !(p = parseJsonString(p, end, value.keys.back())))
+					return nullptr;
+				p = skipJsonSpace(p, end);
+				if (p >= end || *p != ':')
+					return nullptr;
+				p++;
+			}
+			value.items.push_back(JsonValue());
+			if (!(p = parseJson(p, end, value.items.back(), depth + 1)))
+				return nullptr;
+			p = skipJsonSpace(p, end);
+			if (p < end && *p == ',') {
+				p++;
+				continue;
+			}
+			return p < end && *p == close ? p + 1 : nullptr;
+		}
+		return nullptr;
+	}
+	if (*p == '"') {
+		value.type = JsonValue::String;
+		return parseJsonString(p, end, value.text);
+	}
+	if (end - p >= 4 && strncmp(p, "true", 4) == 0) {
+		value.type = JsonValue::Boolean;
+		value.boolean = true;
+		return p + 4;
+	}
+	if (end - p >= 5 && strncmp(p, "false", 5) == 0) {
+		value.type = JsonValue::Boolean;
+		return p + 5;
+	}
+	if (end - p >= 4 && strncmp(p, "null", 4) == 0)
+		return p + 4;
+	if (*p == '-' || (*p >= '0' && *p <= '9')) {
+		// Accessor offsets and counts go past float precision, so numbers are read as doubles
+		char* numberEnd;
+		value.type = JsonValue::Number;
+		value.number = strtod(p, &numberEnd);
+		return numberEnd;
+	}
+	return nullptr;
+}
+
+bool decodeBase64(const char* p, const char* end, vector<char>& bytes)
+{
+	uint32_t bits = 0;
+	int bitCount = 0;
+	for (; p < end && *p != '='; p++) {
+		const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		const char* found = strchr(alphabet, *p);
+		if (!found || !*p)
+			return false;
+		bits = (bits << 6) | (uint32_t)(found - alphabet);
+		bitCount += 6;
+		if (bitCount >= 8) {
+			bitCount -= 8;
+			bytes.push_back((char)((bits >> bitCount) & 0xFF));
+		}
+	}
+	return true;
+}
+
+// One primitive to convert, with the world transform of the node that instances it
+struct GltfPrimitive {
+	const JsonValue* primitive;
+	glm::mat4 transform;
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+	string error;
+};
+
+struct GltfAsset {
+	JsonValue root;
+	vector<vector<char>> buffers;
+};
+
+// Where an accessor's elements sit in its buffer, once checked to lie inside it
+struct GltfAccessorData {
+	const char* data;  // null for an accessor without a buffer view, which is all zeros
+	size_t count;
+	size_t stride;
+	size_t componentSize;
+	int componentType;
+	bool isNormalized;
+};
+
+bool locateGltfAccessor(const GltfAsset& asset, double accessorIndex, int components, GltfAccessorData& located, string& error)
+{
+	const JsonValue* accessor = jsonItem(asset.root, "accessors", accessorIndex);
+	if (!accessor) {
+		error = "missing accessor";
+		return false;
+	}
+	if (jsonMember(*accessor, "sparse")) {
+		error = "sparse accessors are not supported";
+		return false;
+	}
+
+	located.data = nullptr;
+	located.count = (size_t)jsonNumber(*accessor, "count", 0);
+	located.componentType = (int)jsonNumber(*accessor, "componentType", 0);
+	const JsonValue* normalized = jsonMember(*accessor, "normalized");
+	located.isNormalized = normalized && normalized->boolean;
+	int componentType = located.componentType;
+	located.componentSize = componentType == 5126 || componentType == 5125 ? 4 : (componentType == 5122 || componentType == 5123 ? 2 : 1);
+	size_t elementSize = located.componentSize * components;
+	located.stride = elementSize;
+
+	const JsonValue* view = jsonItem(asset.root, "bufferViews", jsonNumber(*accessor, "bufferView", -1));
+	if (!view)
+		return true;
+	size_t bufferIndex = (size_t)jsonNumber(*view, "buffer", 0);
+	if (bufferIndex >= asset.buffers.size()) {
+		error = "missing buffer";
+		return false;
+	}
+
+	located.stride = (size_t)jsonNumber(*view, "byteStride", (double)elementSize);
+	size_t offset = (size_t)jsonNumber(*view, "byteOffset", 0) + (size_t)jsonNumber(*accessor, "byteOffset", 0);
+	const vector<char>& buffer = asset.buffers[bufferIndex];
+	if (located.count > 0 && offset + located.stride * (located.count - 1) + elementSize > buffer.size()) {
+		error = "accessor outside its buffer";
+		return false;
+	}
+	located.data = buffer.data() + offset;
+	return true;
+}
+
+// Copy an accessor out as floats, converting normalized integer components, honouring the view's stride
+bool readGltfAccessor(const GltfAsset& asset, double accessorIndex, int components, vector<float>& values, string& error)
+{
+	GltfAccessorData located;
+	if (!locateGltfAccessor(asset, accessorIndex, components, located, error))
+		return false;
+	values.assign(located.count * components, 0.0f);
+	if (!located.data)
+		return true;
+
+	bool isNormalized = located.isNormalized;
+	for (size_t i = 0; i < located.count; i++) {
+		const char* element = located.data + located.stride * i;
+		for (int k = 0; k < components; k++) {
+			const char* component = element + k * located.componentSize;
+			float value;
+			switch (located.componentType) {
+			case 5126: memcpy(&value, component, 4); break;
+			case 5125: { uint32_t v; memcpy(&v, component, 4); value = (float)v; break; }
+			case 5123: { uint16_t v; memcpy(&v, component, 2); value = isNormalized ? v / 65535.0f : v; break; }
+			case 5122: { int16_t v; memcpy(&v, component, 2); value = isNormalized ? max(v / 32767.0f, -1.0f) : v; break; }
+			case 5121: { uint8_t v = (uint8_t)*component; value = isNormalized ? v / 255.0f : v; break; }
+			case 5120: { int8_t v = (int8_t)*component; value = isNormalized ? max(v / 127.0f, -1.0f) : v; break; }
+			default:
+				error = "unknown component type";
+				return false;
+			}
+			values[i * components + k] = value;
+		}
+	}
+	return true;
+}
+
+// Copy an index accessor out as integers (a float holds them exactly only up to 2^24), each checked
+// against the vertex count
+bool readGltfIndices(const GltfAsset& asset, double accessorIndex, size_t vertexCount, vector<GLuint>& indices, string& error)
+{
+	GltfAccessorData located;
+	if (!locateGltfAccessor(asset, accessorIndex, 1, located, error))
+		return false;
+	if (located.componentType != 5121 && located.componentType != 5123 && located.componentType != 5125) {
+		error = "indices are not unsigned integers";
+		return false;
+	}
+
+	indices.reserve(indices.size() + located.count);
+	for (size_t i = 0; i < located.count; i++) {
+		uint32_t index = 0;
+		if (located.data) {
+			const char* element = located.data + located.stride * i;
+			switch (located.componentType) {
+			case 5125: memcpy(&index, element, 4); break;
+			case 5123: { uint16_t v; memcpy(&v, element, 2); index = v; break; }
+			default: index = (uint8_t)*element; break;
+			}
+		}
+		if (index >= vertexCount) {
+			error = "index out of range";
+			return false;
+		}
+		indices.push_back(index);
+	}
+	return true;
+}
+
+// Triangles of one primitive, transformed into the model's space, with V flipped to OpenGL's convention
+void convertGltfPrimitive(const GltfAsset& asset, GltfPrimitive& job)
+{
+	const JsonValue& primitive = *job.primitive;
+	if ((int)jsonNumber(primitive, "mode", 4) != 4)
+		return; // points, lines and strips are skipped
+
+	const JsonValue* attributes = jsonMember(primitive, "attributes");
+	const JsonValue* positionAccessor = attributes ? jsonMember(*attributes, "POSITION") : nullptr;
+	if (!positionAccessor) {
+		job.error = "primitive without positions";
+		return;
+	}
+
+	vector<float> positions, normals, texCoords;
+	if (!readGltfAccessor(asset, positionAccessor->number, 3, positions, job.error))
+		return;
+	size_t vertexCount = positions.size() / 3;
+	const JsonValue* normalAccessor = jsonMember(*attributes, "NORMAL");
+	if (normalAccessor && !readGltfAccessor(asset, normalAccessor->number, 3, normals, job.error))
+		return;
+	const JsonValue* texCoordAccessor = jsonMember(*attributes, "TEXCOORD_0");
+	if (texCoordAccessor && !readGltfAccessor(asset, texCoordAccessor->number, 2, texCoords, job.error))
+		return;
+
+	const JsonValue* indexAccessor = jsonMember(primitive, "indices");
+	if (indexAccessor) {
+		if (!readGltfIndices(asset, indexAccessor->number, vertexCount, job.indices, job.error))
+			return;
+	}
+	else {
+		for (size_t v = 0; v < vertexCount; v++)
+			job.indices.push_back((GLuint)v);
+	}
+	job.indices.resize(job.indices.size() / 3 * 3);
+
+	// Without normals, average the faces around each vertex
+	if (normals.size() != vertexCount * 3) {
+		normals.assign(vertexCount * 3, 0.0f);
+		for (size_t i = 0; i < job.indices.size(); i += 3) {
+			const GLuint* t = &job.indices[i];
+			glm::vec3 a(positions[t[0] * 3], positions[t[0] * 3 + 1], positions[t[0] * 3 + 2]);
+			glm::vec3 b(positions[t[1] * 3], positions[t[1] * 3 + 1], positions[t[1] * 3 + 2]);
+			glm::vec3 c(positions[t[2] * 3], positions[t[2] * 3 + 1], positions[t[2] * 3 + 2]);
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			for (int k = 0; k < 3; k++) {
+				normals[t[k] * 3] += normal.x;
+				normals[t[k] * 3 + 1] += normal.y;
+				normals[t[k] * 3 + 2] += normal.z;
+			}
+		}
+	}
+
+	glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(job.transform)));
+	job.vertices.resize(vertexCount * 11);
+	for (size_t v = 0; v < vertexCount; v++) {
+		glm::vec3 position = glm::vec3(job.transform * glm::vec4(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2], 1.0f));
+		glm::vec3 normal = normalMatrix * glm::vec3(normals[v * 3], normals[v * 3 + 1], normals[v * 3 + 2]);
+		float length = glm::length(normal);
+		normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::vec2 uv = texCoords.size() == vertexCount * 2 ? glm::vec2(texCoords[v * 2], 1.0f - texCoords[v * 2 + 1]) : glm::vec2(0.0f);
+		writeVertex(&job.vertices[v * 11], position, uv, normal);
+	}
+}
+
+// Node transform from its matrix or its translation, rotation (quaternion) and scale
+glm::mat4 gltfNodeTransform(const JsonValue& node)
+{
+	glm::mat4 transform;
+	const JsonValue* matrix = jsonMember(node, "matrix");
+	if (matrix && matrix->items.size() == 16) {
+		for (int i = 0; i < 16; i++)
+			transform[i / 4][i % 4] = (float)matrix->items[i].number;
+		return transform;
+	}
+
+	const JsonValue* translation = jsonMember(node, "translation");
+	const JsonValue* rotation = jsonMember(node, "rotation");
+	const JsonValue* scale = jsonMember(node, "scale");
+	if (translation && translation->items.size() == 3)
+		transform = glm::translate(transform, glm::vec3(translation->items[0].number, translation->items[1].number, translation->items[2].number));
+	if (rotation && rotation->items.size() == 4) {
+		float x = (float)rotation->items[0].number, y = (float)rotation->items[1].number;
+		float z = (float)rotation->items[2].number, w = (float)rotation->items[3].number;
+		glm::mat4 rotationMatrix;
+		rotationMatrix[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w), 2.0f * (x * z - y * w), 0.0f);
+		rotationMatrix[1] = glm::vec4(2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + x * w), 0.0f);
+		rotationMatrix[2] = glm::vec4(2.0f * (x * z + y * w), 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + y * y), 0.0f);
+		transform = transform * rotationMatrix;
+	}
+	if (scale && scale->items.size() == 3)
+		transform = glm::scale(transform, glm::vec3(scale->items[0].number, scale->items[1].number, scale->items[2].number));
+	return transform;
+}
+
+void collectGltfNode(const JsonValue& root, double nodeIndex, const glm::mat4& parent, vector<GltfPrimitive>& jobs, int depth)
+{
+	const JsonValue* node = jsonItem(root, "nodes", nodeIndex);
+	if (!node || depth > 64)
+		return;
+	glm::mat4 transform = parent * gltfNodeTransform(*node);
+
+	const JsonValue* mesh = jsonItem(root, "meshes", jsonNumber(*node, "mesh", -1));
+	const JsonValue* primitives = mesh ? jsonMember(*mesh, "primitives") : nullptr;
+	if (primitives) {
+		for (const JsonValue& primitive : primitives->items) {
+			GltfPrimitive job;
+			job.primitive = &primitive;
+			job.transform = transform;
+			jobs.push_back(job);
+		}
+	}
+
+	const JsonValue* children = jsonMember(*node, "children");
+	if (children) {
+		for (const JsonValue& child : children->items)
+			collectGltfNode(root, child.number, transform, jobs, depth + 1);
+	}
+}
+
+// glTF 2.0 as .gltf (with data URIs or .bin files beside it) or binary .glb
+bool importGltf(const char* data, size_t size, const string& directory, bool isParallel, ImportedMesh& mesh, ImportTimings& timings, string& error)
+{
+	auto start = chrono::high_resolution_clock::now();
+	GltfAsset asset;
+	const char* json = data;
+	size_t jsonSize = size;
+	vector<char> glbBuffer;
+
+	uint32_t header[3];
+	if (size >= 12 && memcpy(header, data, 12) && header[0] == 0x46546C67u) {
+		// GLB: header, then a JSON chunk and an optional binary chunk
+		jsonSize = 0;
+		for (size_t offset = 12; offset + 8 <= min(size, (size_t)header[2]);) {
+			uint32_t chunk[2];
+			memcpy(chunk, data + offset, 8);
+			if (offset + 8 + chunk[0] > size) {
+				error = "truncated GLB chunk";
+				return false;
+			}
+			if (chunk[1] == 0x4E4F534Au && jsonSize == 0) {
+				json = data + offset + 8;
+				jsonSize = chunk[0];
+			}
+			else if (chunk[1] == 0x004E4942u && glbBuffer.empty()) {
+				glbBuffer.assign(data + offset + 8, data + offset + 8 + chunk[0]);
+			}
+			offset += 8 + chunk[0];
+		}
+	}
+
+	if (!parseJson(json, json + jsonSize, asset.root, 0) || asset.root.type != JsonValue::Object) {
+		error = "malformed glTF JSON";
+		return false;
+	}
+
+	const JsonValue* buffers = jsonMember(asset.root, "buffers");
+	if (buffers) {
+		for (const JsonValue& buffer : buffers->items) {
+			asset.buffers.push_back(vector<char>());
+			const JsonValue* uri = jsonMember(buffer, "uri");
+			if (!uri) {
+				asset.buffers.back() = glbBuffer;
+				continue;
+			}
+			const string& text = uri->text;
+			if (text.compare(0, 5, "data:") == 0) {
+				size_t comma = text.find(";base64,");
+				if (comma == string::npos || !decodeBase64(text.c_str() + comma + 8, text.c_str() + text.size(), asset.buffers.back())) {
+					error = "unsupported data URI";
+					return false;
+				}
+				continue;
+			}
+			size_t bufferSize;
+			if (!readImportFile(directory + text, asset.buffers.back(), bufferSize)) {
+				error = "cannot read buffer " + text;
+				return false;
+			}
+			asset.buffers.back().resize(bufferSize);
+		}
+	}
+
+	// Primitives of the default scene's node tree, or of every mesh untransformed when there are no nodes
+	vector<GltfPrimitive> jobs;
+	const JsonValue* scene = jsonItem(asset.root, "scenes", jsonNumber(asset.root, "scene", 0));
+	const JsonValue* sceneNodes = scene ? jsonMember(*scene, "nodes") : nullptr;
+	if (sceneNodes) {
+		for (const JsonValue& node : sceneNodes->items)
+			collectGltfNode(asset.root, node.number, glm::mat4(), jobs, 0);
+	}
+	else if (const JsonValue* meshes = jsonMember(asset.root, "meshes")) {
+		for (const JsonValue& gltfMesh : meshes->items) {
+			const JsonValue* primitives = jsonMember(gltfMesh, "primitives");
+			for (size_t i = 0; primitives && i < primitives->items.size(); i++) {
+				GltfPrimitive job;
+				job.primitive = &primitives->items[i];
+				jobs.push_back(job);
+			}
+		}
+	}
+
+	if (isParallel) {
+		atomic<size_t> nextJob(0);
+		runOnAllThreads([&] {
+			for (size_t j = nextJob++; j < jobs.size(); j = nextJob++)
+				convertGltfPrimitive(asset, jobs[j]);
+		});
+	}
+	else {
+		for (GltfPrimitive& job : jobs)
+			convertGltfPrimitive(asset, job);
+	}
+	timings.parseMs = millisecondsSince(start);
+	start = chrono::high_resolution_clock::now();
+
+	size_t cornerCount = 0;
+	for (const GltfPrimitive& job : jobs) {
+		if (!job.error.empty()) {
+			error = job.error;
+			return false;
+		}
+		cornerCount += job.indices.size();
+	}
+
+	VertexDeduplicator dedup;
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.indices.reserve(cornerCount);
+	beginDeduplication(dedup, mesh, cornerCount);
+	for (const GltfPrimitive& job : jobs) {
+		for (GLuint index : job.indices)
+			mesh.indices.push_back(addVertex(dedup, &job.vertices[index * 11]));
+	}
+
+	computeImportBounds(mesh);
+	timings.buildMs = millisecondsSince(start);
+	if (mesh.indices.empty()) {
+		error = "no triangles";
+		return false;
+	}
+	return true;
+}
+
+// Cooked mesh file: this header, then vertexCount * 11 floats and indexCount 32 bit indices, little endian.
+// Loading it is one read with no parsing.
+struct CookedMeshHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+const uint32_t cookedMeshVersion = 1;
+
+void cookMeshBytes(const ImportedMesh& mesh, vector<char>& bytes)
+{
+	CookedMeshHeader header = { { 'M', 'S', 'H', '1' }, cookedMeshVersion, (uint32_t)(mesh.vertices.size() / 11), (uint32_t)mesh.indices.size(),
+		{ mesh.boundsMin.x, mesh.boundsMin.y, mesh.boundsMin.z }, { mesh.boundsMax.x, mesh.boundsMax.y, mesh.boundsMax.z } };
+	bytes.clear();
+	appendBytes(bytes, &header, 1);
+	appendBytes(bytes, mesh.vertices.data(), mesh.vertices.size());
+	appendBytes(bytes, mesh.indices.data(), mesh.indices.size());
+}
+
+bool writeCookedMesh(const string& path, const ImportedMesh& mesh)
+{
+	vector<char> bytes;
+	cookMeshBytes(mesh, bytes);
+	ofstream file(path, ios::binary);
+	file.write(bytes.data(), bytes.size());
+	return (bool)file;
+}
+
+bool readCookedMesh(const char* data, size_t size, ImportedMesh& mesh, string& error)
+{
+	CookedMeshHeader header;
+	if (size < sizeof(header) || memcpy(&header, data, sizeof(header)) == nullptr || memcmp(header.magic, "MSH1", 4) != 0) {
+		error = "not a cooked mesh";
+		return false;
+	}
+	size_t vertexBytes = (size_t)header.vertexCount * 11 * sizeof(GLfloat), indexBytes = (size_t)header.indexCount * sizeof(GLuint);
+	if (header.version != cookedMeshVersion || sizeof(header) + vertexBytes + indexBytes != size) {
+		error = "cooked mesh version or size mismatch";
+		return false;
+	}
+	const GLfloat* vertices = (const GLfloat*)(data + sizeof(header));
+	const GLuint* indices = (const GLuint*)(data + sizeof(header) + vertexBytes);
+	mesh.vertices.assign(vertices, vertices + header.vertexCount * 11);
+	mesh.indices.assign(indices, indices + header.indexCount);
+	for (GLuint index : mesh.indices) {
+		if (index >= header.vertexCount) {
+			error = "cooked mesh index out of range";
+			return false;
+		}
+	}
+	mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	return true;
+}
+
+// Lower case extension with its dot, empty if there is none
+string fileExtension(const string& path)
+{
+	size_t dot = path.find_last_of('.');
+	string extension = dot == string::npos ? string() : path.substr(dot);
+	transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension;
+}
+
+// Import by extension: .obj, .gltf, .glb or a cooked .mesh
+bool importMesh(const string& path, bool isParallel, ImportedMesh& mesh, ImportTimings& timings, string& error)
+{
+	auto start = chrono::high_resolution_clock::now();
+	vector<char> bytes;
+	size_t size;
+	if (!readImportFile(path, bytes, size)) {
+		error = "cannot read " + path;
+		return false;
+	}
+	timings = ImportTimings();
+	timings.bytes = size;
+	timings.readMs = millisecondsSince(start);
+
+	string extension = fileExtension(path);
+	if (extension == ".obj")
+		return importObj(bytes.data(), size, isParallel, mesh, timings, error);
+	if (extension == ".gltf" || extension == ".glb") {
+		size_t slash = path.find_last_of("/\\");
+		return importGltf(bytes.data(), size, slash == string::npos ? string() : path.substr(0, slash + 1), isParallel, mesh, timings, error);
+	}
+	if (extension == ".mesh") {
+		start = chrono::high_resolution_clock::now();
+		bool isRead = readCookedMesh(bytes.data(), size, mesh, error);
+		timings.parseMs = millisecondsSince(start);
+		return isRead;
+	}
+	error = "unknown model format " + extension;
+	return false;
+}
+
+// Import through the asset cache, keyed by the model file's bytes. A .gltf can pull in buffers that
+// are not part of the key, so only the self contained .obj and .glb are cached.
+bool importCachedMesh(const string& path, ImportedMesh& mesh, ImportTimings& timings, string& error)
+{
+	string extension = fileExtension(path);
+	vector<char> source, cooked;
+	if ((extension != ".obj" && extension != ".glb") || !readAssetFile(path, source))
+		return importMesh(path, true, mesh, timings, error);
+
+	auto start = chrono::high_resolution_clock::now();
+	string cachePath = assetCachePath("mesh", hashBytes(source.data(), source.size(), 0));
+	if (readAssetFile(cachePath, cooked) && readCookedMesh(cooked.data(), cooked.size(), mesh, error)) {
+		assetCache.hits++;
+		timings = ImportTimings();
+		timings.bytes = cooked.size();
+		timings.parseMs = millisecondsSince(start);
+		return true;
+	}
+	if (!importMesh(path, true, mesh, timings, error))
+		return false;
+	assetCache.misses++;
+	cookMeshBytes(mesh, cooked);
+	writeAssetFile(cachePath, cooked);
+	return true;
+}
+
+void printImportTimings(const char* label, const ImportedMesh& mesh, const ImportTimings& timings)
+{
+	double megabytes = timings.bytes / (1024.0 * 1024.0);
+	cout << label << ": " << megabytes << " MB, " << mesh.vertices.size() / 11 << " vertices, " << mesh.indices.size() / 3
+		<< " triangles; parse " << timings.parseMs << " ms (" << megabytes / max(timings.parseMs, 1e-3) * 1000.0 << " MB/s), build "
+		<< timings.buildMs << " ms, total " << megabytes / max(timings.parseMs + timings.buildMs, 1e-3) * 1000.0 << " MB/s" << endl;
+}
+
+// Command line cook step: import a model and write it as a cooked .mesh
+bool cookModel(const string& inputPath, const string& outputPath)
+{
+	ImportedMesh mesh;
+	ImportTimings timings;
+	string error;
+	if (!importMesh(inputPath, true, mesh, timings, error)) {
+		cout << "Import of " << inputPath << " failed: " << error << endl;
+		return false;
+	}
+	printImportTimings(inputPath.c_str(), mesh, timings);
+	if (!writeCookedMesh(outputPath, mesh)) {
+		cout << "Cannot write " << outputPath << endl;
+		return false;
+	}
+	cout << "Cooked " << outputPath << ": " << sizeof(CookedMeshHeader) + mesh.vertices.size() * sizeof(GLfloat) + mesh.indices.size() * sizeof(GLuint)
+		<< " bytes" << endl;
+	return true;
+}
+
+// Importer throughput on a large generated model (a sphere with this many segments and half as many rings),
+// written as OBJ and as GLB in memory, parsed on one thread and on every worker
+void runImportBenchmark(int segments)
+{
+	int rings = segments / 2;
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+	for (int r = 0; r <= rings; r++) {
+		for (int s = 0; s <= segments; s++) {
+			float theta = glm::pi<float>() * r / rings, phi = 2.0f * glm::pi<float>() * s / segments;
+			glm::vec3 normal(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+			vertices.resize(vertices.size() + 11);
+			writeVertex(&vertices[vertices.size() - 11], normal, glm::vec2((float)s / segments, 1.0f - (float)r / rings), normal);
+		}
+	}
+	for (int r = 0; r < rings; r++) {
+		for (int s = 0; s < segments; s++) {
+			GLuint a = r * (segments + 1) + s, b = a + segments + 1;
+			GLuint triangles[6] = { a, b, a + 1, a + 1, b, b + 1 };
+			indices.insert(indices.end(), triangles, triangles + 6);
+		}
+	}
+	size_t vertexCount = vertices.size() / 11;
+
+	string obj;
+	char line[128];
+	for (size_t v = 0; v < vertexCount; v++) {
+		const GLfloat* p = &vertices[v * 11];
+		obj.append(line, snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", p[0], p[1], p[2]));
+		obj.append(line, snprintf(line, sizeof(line), "vt %.6f %.6f\n", p[6], p[7]));
+		obj.append(line, snprintf(line, sizeof(line), "vn %.6f %.6f %.6f\n", p[8], p[9], p[10]));
+	}
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		GLuint a = indices[i] + 1, b = indices[i + 1] + 1, c = indices[i + 2] + 1;
+		obj.append(line, snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c));
+	}
+	obj.append(importPadding, '\0');
+
+	// GLB with interleaved position, normal and UV, then 32 bit indices
+	vector<char> bin;
+	for (size_t v = 0; v < vertexCount; v++) {
+		const GLfloat* p = &vertices[v * 11];
+		GLfloat interleaved[8] = { p[0], p[1], p[2], p[8], p[9], p[10], p[6], 1.0f - p[7] };
+		bin.insert(bin.end(), (const char*)interleaved, (const char*)(interleaved + 8));
+	}
+	size_t indexOffset = bin.size();
+	bin.insert(bin.end(), (const char*)indices.data(), (const char*)(indices.data() + indices.size()));
+	string json = "{\"asset\":{\"version\":\"2.0\"},\"buffers\":[{\"byteLength\":" + to_string(bin.size()) + "}],"
+		"\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + to_string(indexOffset) + ",\"byteStride\":32},"
+		"{\"buffer\":0,\"byteOffset\":" + to_string(indexOffset) + ",\"byteLength\":" + to_string(bin.size() - indexOffset) + "}],"
+		"\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" + to_string(vertexCount) + ",\"type\":\"VEC3\"},"
+		"{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" + to_string(vertexCount) + ",\"type\":\"VEC3\"},"
+		"{\"bufferView\":0,\"byteOffset\":24,\"componentType\":5126,\"count\":" + to_string(vertexCount) + ",\"type\":\"VEC2\"},"
+		"{\"bufferView\":1,\"componentType\":5125,\"count\":" + to_string(indices.size()) + ",\"type\":\"SCALAR\"}],"
+		"\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},\"indices\":3}]}],"
+		"\"nodes\":[{\"mesh\":0}],\"scenes\":[{\"nodes\":[0]}],\"scene\":0}";
+	json.append((4 - json.size() % 4) % 4, ' ');
+	uint32_t glbHeader[5] = { 0x46546C67u, 2, (uint32_t)(12 + 8 + json.size() + 8 + bin.size()), (uint32_t)json.size(), 0x4E4F534Au };
+	uint32_t binHeader[2] = { (uint32_t)bin.size(), 0x004E4942u };
+	vector<char> glb((const char*)glbHeader, (const char*)(glbHeader + 5));
+	glb.insert(glb.end(), json.begin(), json.end());
+	glb.insert(glb.end(), (const char*)binHeader, (const char*)(binHeader + 2));
+	glb.insert(glb.end(), bin.begin(), bin.end());
+	size_t glbSize = glb.size();
+	glb.resize(glbSize + importPadding, 0);
+
+	cout << "Import benchmark: " << vertexCount << " vertices, " << indices.size() / 3 << " triangles, "
+		<< jobSystem.threads.size() + 1 << " threads" << endl;
+	for (int parallel = 0; parallel < 2; parallel++) {
+		ImportedMesh mesh;
+		ImportTimings timings = ImportTimings();
+		string error;
+
+		timings.bytes = obj.size() - importPadding;
+		if (!importObj(obj.data(), timings.bytes, parallel != 0, mesh, timings, error))
+			cout << "OBJ import failed: " << error << endl;
+		printImportTimings(parallel ? "OBJ, all threads" : "OBJ, one thread", mesh, timings);
+
+		timings.bytes = glbSize;
+		if (!importGltf(glb.data(), glbSize, string(), parallel != 0, mesh, timings, error))
+			cout << "GLB import failed: " << error << endl;
+		printImportTimings(parallel ? "GLB, all threads" : "GLB, one thread", mesh, timings);
+	}
+}
+
+// MESH IMPORT END *******************************************************
+
+// RENDER QUEUE START *******************************************************
+
+// One draw call: a single part of a visible object, at the level of detail chosen for it
+struct DrawItem {
+	const SceneObject* object;
+	const glm::mat4* model;
+	float viewDepth;
+	const Mesh* mesh;
+	int firstClusterDraw;  // surviving cluster ranges in clusterDraws, none to draw the whole mesh
+	int clusterDrawCount;
+};
+
+// Triangles drawn against what the finest levels would have cost, refreshed every frame
+struct LodStats {
+	long long trianglesDrawn;
+	long long trianglesFinest;
+	int partsPerLevel[maxLodLevels];
+	int switches; // level changes since the last stats print, popping shows up here
+};
+
+LodStats lodStats;
+
+// Pick a part's level from its on screen diameter, only leaving the current level once the size is
+// past the threshold by the hysteresis fraction, so parts sitting on a threshold do not flicker
+int selectLod(const MeshLods& lods, float screenSize, int current)
+{
+	int level = min(current, lods.levelCount - 1);
+	while (level > 0 && screenSize > lods.minScreenSize[level - 1] * (1.0f + lodHysteresis))
+		level--;
+	while (level < lods.levelCount - 1 && screenSize < lods.minScreenSize[level] * (1.0f - lodHysteresis))
+		level++;
+	return level;
+}
+
+// What one chunk of the visible objects adds to the frame, built on whichever thread runs the chunk
+// (in that thread's frame arena) and merged in object order afterwards
+struct DrawListChunk {
+	FrameVector<DrawItem> items;
+	ClusterDraws clusters;
+	MeshletStats meshlets;
+	LodStats lods;
+	FrameVector<float> coverage;  // largest on screen size per material layer, negative when not drawn
+};
+
+const int drawListChunkObjects = 16;
+
+// Flatten visible objects into draw items, optionally sorted front to back by view space depth.
+// Parts of objects with LODs get the level matching their projected size in a viewport this tall,
+// and parts drawn with a clustered mesh only keep their visible clusters. Every part also tells texture
+// streaming how large its material is on screen. Chunks of objects are transformed, LOD selected and
+// cluster culled in parallel, then appended in order, so the list is the same on any thread count.
+void buildDrawList(const FrameVector<SceneObject*>& visibleObjects, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix,
+	int viewportHeight, bool isFrontToBack, FrameVector<DrawItem>& drawItems)
+{
+	drawItems.clear();
+	clusterDraws = ClusterDraws();
+	meshletStats = MeshletStats();
+	glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+	glm::vec3 cameraPosition = glm::vec3(glm::inverse(viewMatrix)[3]);
+
+	// Pixels per world unit at view depth 1 (perspective) or anywhere (orthographic)
+	bool isPerspective = projectionMatrix[3][3] == 0.0f;
+	float pixelScale = projectionMatrix[1][1] * 0.5f * viewportHeight;
+
+	int chunkCount = ((int)visibleObjects.size() + drawListChunkObjects - 1) / drawListChunkObjects;
+	FrameVector<DrawListChunk> chunks(chunkCount);
+	size_t layerCount = textureStreamer.textures.size();
+
+	parallelFor(chunkCount, 1, [&](int firstChunk, int endChunk) {
+		for (int c = firstChunk; c < endChunk; c++) {
+			DrawListChunk& chunk = chunks[c];
+			chunk = DrawListChunk();
+			chunk.coverage.assign(layerCount, -1.0f);
+
+			size_t end = min(visibleObjects.size(), (size_t)(c + 1) * drawListChunkObjects);
+			for (size_t o = (size_t)c * drawListChunkObjects; o < end; o++) {
+				SceneObject* object = visibleObjects[o];
+				for (size_t i = 0; i < object->parts.size(); i++) {
+					float viewDepth = -(viewMatrix * glm::vec4(object->partCenters[i], 1.0f)).z;
+					const Mesh* mesh = object->mesh;
+
+					float screenSize = 2.0f * object->partRadii[i] * pixelScale / (isPerspective ? max(viewDepth, 0.1f) : 1.0f);
+					if (object->materialLayer >= 0 && object->materialLayer < (GLint)layerCount)
+						chunk.coverage[object->materialLayer] = max(chunk.coverage[object->materialLayer], screenSize);
+
+					if (object->lods) {
+						if (isLod) {
+							int level = selectLod(*object->lods, screenSize, object->partLods[i]);
+							if (level != object->partLods[i])
+								chunk.lods.switches++;
+							object->partLods[i] = level;
+						}
+						else {
+							object->partLods[i] = 0;
+						}
+
+						mesh = object->lods->levels[object->partLods[i]];
+						chunk.lods.partsPerLevel[object->partLods[i]]++;
+					}
+
+					chunk.lods.trianglesDrawn += mesh->indexCount / 3;
+					chunk.lods.trianglesFinest += object->mesh->indexCount / 3;
+
+					DrawItem item = { object, &object->parts[i], viewDepth, mesh, 0, 0 };
+					if (isMeshletCulling && mesh->meshletCount > 0) {
+						item.firstClusterDraw = (int)chunk.clusters.counts.size();
+						item.clusterDrawCount = cullMeshlets(*mesh, viewProjection, object->parts[i], cameraPosition, isPerspective,
+							chunk.clusters, chunk.meshlets);
+						if (item.clusterDrawCount == 0)
+							continue;
+					}
+					chunk.items.push_back(item);
+				}
+			}
+		}
+	});
+
+	lodStats.trianglesDrawn = 0;
+	lodStats.trianglesFinest = 0;
+	for (int& count : lodStats.partsPerLevel)
+		count = 0;
+
+	FrameVector<float> coverage(layerCount, -1.0f);
+	for (const DrawListChunk& chunk : chunks) {
+		int clusterBase = (int)clusterDraws.counts.size();
+		clusterDraws.counts.insert(clusterDraws.counts.end(), chunk.clusters.counts.begin(), chunk.clusters.counts.end());
+		clusterDraws.offsets.insert(clusterDraws.offsets.end(), chunk.clusters.offsets.begin(), chunk.clusters.offsets.end());
+		clusterDraws.baseVertices.insert(clusterDraws.baseVertices.end(), chunk.clusters.baseVertices.begin(), chunk.clusters.baseVertices.end());
+		for (DrawItem item : chunk.items) {
+			item.firstClusterDraw += clusterBase;
+			drawItems.push_back(item);
+		}
+
+		meshletStats.tested += chunk.meshlets.tested;
+		meshletStats.frustumCulled += chunk.meshlets.frustumCulled;
+		meshletStats.backfaceCulled += chunk.meshlets.backfaceCulled;
+		meshletStats.trianglesTested += chunk.meshlets.trianglesTested;
+		meshletStats.trianglesCulled += chunk.meshlets.trianglesCulled;
+		lodStats.trianglesDrawn += chunk.lods.trianglesDrawn;
+		lodStats.trianglesFinest += chunk.lods.trianglesFinest;
+		lodStats.switches += chunk.lods.switches;
+		for (int level = 0; level < maxLodLevels; level++)
+			lodStats.partsPerLevel[level] += chunk.lods.partsPerLevel[level];
+		for (size_t layer = 0; layer < layerCount; layer++)
+			coverage[layer] = max(coverage[layer], chunk.coverage[layer]);
+	}
+
+	// The largest size a material was drawn at decides its level, as if every part had reported itself.
+	// Only the separate textures stream, and bindless handles point at them too; the texture array is
+	// complete from startup, so while it is the one sampled the streamed levels get no coverage and
+	// do not take budget from anything
+	for (size_t layer = 0; layer < layerCount; layer++) {
+		if (coverage[layer] >= 0.0f && materialMode != 1)
+			noteTextureCoverage((GLint)layer, coverage[layer]);
+	}
+
+	if (isFrontToBack) {
+		sort(drawItems.begin(), drawItems.end(), [](const DrawItem& a, const DrawItem& b) { return a.viewDepth < b.viewDepth; });
+	}
+}
+
+// Submit draw items, only rebinding VAO, texture and color when they change. With the material array
+// a material change is a layer uniform; objects outside it (layer -1) bind their own texture.
+void drawItemList(const FrameVector<DrawItem>& drawItems, GLint modelLoc, GLint objectColorLoc, GLint materialLayerLoc, bool isDepthOnly)
+{
+	GLuint boundVao = 0;
+	const SceneObject* boundObject = nullptr;
+	GLuint boundTexture = 0;
+	GLint boundLayer = -2;
+
+	for (const DrawItem& item : drawItems) {
+		if (item.object != boundObject && !isDepthOnly) {
+			boundObject = item.object;
+			glUniform3f(objectColorLoc, item.object->objectColor.x, item.object->objectColor.y, item.object->objectColor.z);
+
+			GLint layer = materialMode != 0 ? item.object->materialLayer : -1;
+			if (layer != boundLayer) {
+				boundLayer = layer;
+				glUniform1f(materialLayerLoc, (GLfloat)layer);
+				materialStats.layerChanges++;
+			}
+			// Streaming replaces material textures, so those are looked up by layer
+			GLuint texture = item.object->materialLayer >= 0 ? materials.textures[item.object->materialLayer] : item.object->texture;
+			if (layer < 0 && texture != boundTexture) {
+				boundTexture = texture;
+				glBindTexture(GL_TEXTURE_2D, boundTexture);
+				materialStats.textureBinds++;
+			}
+		}
+
+		// Generated meshes and their levels share one VAO
+		if (item.mesh->vao != boundVao) {
+			boundVao = item.mesh->vao;
+			glBindVertexArray(boundVao);
+		}
+
+		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(*item.model));
+		if (item.clusterDrawCount > 0) {
+			glMultiDrawElementsBaseVertex(item.mesh->mode, &clusterDraws.counts[item.firstClusterDraw], item.mesh->indexType,
+				&clusterDraws.offsets[item.firstClusterDraw], item.clusterDrawCount, &clusterDraws.baseVertices[item.firstClusterDraw]);
+		}
+		else {
+			drawMesh(*item.mesh);
+		}
+	}
+
+	glBindVertexArray(0);
+}
+
+// Samples passed and GPU time of the scene passes, read back one frame late to avoid stalls
+struct PassQueries {
+	GLuint samplesPassed[2];
+	GLuint lateSamplesPassed[2];  // GPU culling's late draws, counted apart from the pyramid build before them
+	bool isLateCounted[2];
+	GLuint timeElapsed[2];
+	int frame;
+	GLuint64 lastSamples;
+	GLuint64 lastNanoseconds;
+};
+
+PassQueries passQueries;
+
+void beginPassTimer()
+{
+	glBeginQuery(GL_TIME_ELAPSED, passQueries.timeElapsed[passQueries.frame & 1]);
+}
+
+void endPassTimer()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Samples that pass the depth test, i.e. how often the lighting shader really runs
+void beginSampleCount()
+{
+	glBeginQuery(GL_SAMPLES_PASSED, passQueries.samplesPassed[passQueries.frame & 1]);
+}
+
+void beginLateSampleCount()
+{
+	glBeginQuery(GL_SAMPLES_PASSED, passQueries.lateSamplesPassed[passQueries.frame & 1]);
+	passQueries.isLateCounted[passQueries.frame & 1] = true;
+}
+
+void endSampleCount()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+// Collect the previous frame's results, which are ready by now
+void collectPassQueries()
+{
+	int previous = (passQueries.frame + 1) & 1;
+	if (passQueries.frame > 0) {
+		glGetQueryObjectui64v(passQueries.samplesPassed[previous], GL_QUERY_RESULT, &passQueries.lastSamples);
+		glGetQueryObjectui64v(passQueries.timeElapsed[previous], GL_QUERY_RESULT, &passQueries.lastNanoseconds);
+	}
+	if (passQueries.isLateCounted[previous]) {
+		GLuint64 lateSamples;
+		glGetQueryObjectui64v(passQueries.lateSamplesPassed[previous], GL_QUERY_RESULT, &lateSamples);
+		passQueries.lastSamples += lateSamples;
+		passQueries.isLateCounted[previous] = false;
+	}
+	passQueries.frame++;
+}
+
+// RENDER QUEUE END *******************************************************
+
+// SHADOW MAPS START *******************************************************
+
+// Omnidirectional shadows for the two scene lights: one depth cube map each, storing distance to the light
+const int shadowMapSize = 512;
+const float shadowFar = 25.0f; // light range, casters beyond it are ignored
+
+// Shadow filter: 0 off, 1 hard (one tap), 2 PCF (20 taps)
+int shadowFilter = 2;
+bool isShadowCaching = true;
+bool isAnimatingLight = false;
+
+// Cube map and where its faces were last rendered from, so unchanged faces are reused
+struct ShadowLight {
+	GLuint cubeMap;
+	glm::vec3 position;
+	bool isPlaced;                  // position and the face frusta below are set
+	glm::mat4 faceViewProjections[6];
+	glm::vec4 facePlanes[6][6];
+	int faceCasterCounts[6];        // casters found in each face, so one leaving the caster list is noticed
+	bool isFaceValid[6];
+};
+
+struct ShadowMaps {
+	ShadowLight lights[2];
+	GLuint framebuffer;
+	GLuint program;
+	GLuint timeElapsed[2];
+	int frame;
+	int update;           // updateShadowMaps calls, to spot casters that were not in the last one
+	GLuint64 lastNanoseconds;
+	int facesRendered;    // since the last stats print
+	int facesConsidered;
+	double cpuMs;
+};
+
+ShadowMaps shadowMaps;
+
+// The shadow shaders' ShadowFace uniform block (std140), one per rendered face in the dynamic ring
+struct ShadowFaceBlock {
+	glm::mat4 lightViewProjection;
+	glm::vec4 lightPos; // xyz
+};
+
+const GLuint shadowFaceBlockBinding = 2;
+
+// Box against frustum planes, false when it is fully outside one of them
+bool isBoxInFrustum(const glm::vec4 planes[6], const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	for (int i = 0; i < 6; i++) {
+		glm::vec3 farthest(planes[i].x >= 0.0f ? boundsMax.x : boundsMin.x,
+			planes[i].y >= 0.0f ? boundsMax.y : boundsMin.y,
+			planes[i].z >= 0.0f ? boundsMax.z : boundsMin.z);
+		if (glm::dot(glm::vec3(planes[i]), farthest) + planes[i].w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+void createShadowMaps()
+{
+	for (ShadowLight& light : shadowMaps.lights) {
+		glGenTextures(1, &light.cubeMap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, light.cubeMap);
+		allocateTexture(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, shadowMapSize, shadowMapSize, GL_DEPTH_COMPONENT, GL_FLOAT);
+		for (int face = 0; face < 6; face++)
+			light.isFaceValid[face] = false;
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	// PCF taps near a face edge read across into the neighbouring face
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	glGenFramebuffers(1, &shadowMaps.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadowMaps.framebuffer);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenQueries(2, shadowMaps.timeElapsed);
+}
+
+// Shadow samplers live on units 3 and 4, clear of the material and G-buffer textures
+void setShadowSamplerUnits(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "shadowMap"), 3);
+	glUniform1i(glGetUniformLocation(program, "shadowMap1"), 4);
+	glUseProgram(0);
+}
+
+void bindShadowMaps(GLuint program)
+{
+	glUniform1i(glGetUniformLocation(program, "shadowFilter"), shadowFilter);
+	glUniform1f(glGetUniformLocation(program, "shadowFar"), shadowFar);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMaps.lights[0].cubeMap);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMaps.lights[1].cubeMap);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Re-render the cube faces whose light moved or whose casters changed (every face when caching is off).
+// A caster is only tested against the faces again when computeBounds flagged it, it joined the caster
+// list or its light moved; the rest just count towards the faces they were last found in.
+void updateShadowMaps(const FrameVector<SceneObject*>& casters, const glm::vec3 lightPositions[2])
+{
+	static const glm::vec3 faceDirections[6] = {
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+	};
+	static const glm::vec3 faceUps[6] = {
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+	};
+
+	auto start = chrono::high_resolution_clock::now();
+
+	glBeginQuery(GL_TIME_ELAPSED, shadowMaps.timeElapsed[shadowMaps.frame & 1]);
+
+	// A moved light invalidates all of its faces and needs every caster placed in them again
+	glm::mat4 faceProjection = glm::perspective(90.0f * toRadians, 1.0f, 0.1f, shadowFar);
+	bool isLightMoved[2];
+	for (int i = 0; i < 2; i++) {
+		ShadowLight& light = shadowMaps.lights[i];
+		isLightMoved[i] = !light.isPlaced || light.position != lightPositions[i];
+		if (isLightMoved[i]) {
+			light.position = lightPositions[i];
+			light.isPlaced = true;
+			for (int face = 0; face < 6; face++) {
+				light.faceViewProjections[face] = faceProjection * glm::lookAt(light.position, light.position + faceDirections[face], faceUps[face]);
+				extractFrustumPlanes(light.faceViewProjections[face], light.facePlanes[face]);
+				light.isFaceValid[face] = false;
+			}
+		}
+		if (!isShadowCaching) {
+			for (int face = 0; face < 6; face++)
+				light.isFaceValid[face] = false;
+		}
+	}
+
+	// A caster that moved or joined invalidates the faces it was in and the faces it is in now
+	shadowMaps.update++;
+	int faceCasterCounts[2][6] = {};
+	for (SceneObject* object : casters) {
+		bool isChanged = object->isShadowDirty || object->shadowUpdate != shadowMaps.update - 1;
+		for (int i = 0; i < 2; i++) {
+			ShadowLight& light = shadowMaps.lights[i];
+			if (isChanged || isLightMoved[i]) {
+				int faces = 0;
+				for (int face = 0; face < 6; face++) {
+					if (isBoxInFrustum(light.facePlanes[face], object->boundsMin, object->boundsMax))
+						faces |= 1 << face;
+				}
+				int touched = isChanged ? faces | ((object->shadowFaces >> (i * 6)) & 63) : 0;
+				for (int face = 0; face < 6; face++) {
+					if (touched & (1 << face))
+						light.isFaceValid[face] = false;
+				}
+				object->shadowFaces = (object->shadowFaces & ~(63 << (i * 6))) | (faces << (i * 6));
+			}
+			for (int face = 0; face < 6; face++)
+				faceCasterCounts[i][face] += (object->shadowFaces >> (i * 6 + face)) & 1;
+		}
+		object->isShadowDirty = false;
+		object->shadowUpdate = shadowMaps.update;
+	}
+
+	bool isBound = false;
+
+	for (int i = 0; i < 2; i++) {
+		ShadowLight& light = shadowMaps.lights[i];
+
+		for (int face = 0; face < 6; face++) {
+			// Fewer casters than last time means one left the list without touching its faces
+			if (light.faceCasterCounts[face] != faceCasterCounts[i][face])
+				light.isFaceValid[face] = false;
+			light.faceCasterCounts[face] = faceCasterCounts[i][face];
+
+			shadowMaps.facesConsidered++;
+			if (light.isFaceValid[face])
+				continue;
+
+			if (!isBound) {
+				glBindFramebuffer(GL_FRAMEBUFFER, shadowMaps.framebuffer);
+				glViewport(0, 0, shadowMapSize, shadowMapSize);
+				glUseProgram(shadowMaps.program);
+				glUniform1f(glGetUniformLocation(shadowMaps.program, "shadowFar"), shadowFar);
+				isBound = true;
+			}
+
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, light.cubeMap, 0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			DynamicAllocation allocation = allocateDynamic(sizeof(ShadowFaceBlock), dynamicRing.uniformAlignment);
+			ShadowFaceBlock* block = static_cast<ShadowFaceBlock*>(allocation.data);
+			block->lightViewProjection = light.faceViewProjections[face];
+			block->lightPos = glm::vec4(light.position, 1.0f);
+			commitDynamic(allocation);
+			glBindBufferRange(GL_UNIFORM_BUFFER, shadowFaceBlockBinding, allocation.buffer, allocation.offset, allocation.size);
+
+			GLint modelLoc = glGetUniformLocation(shadowMaps.program, "model");
+			int faceBit = 1 << (i * 6 + face);
+			for (const SceneObject* object : casters) {
+				if (!(object->shadowFaces & faceBit))
+					continue;
+				glBindVertexArray(object->mesh->vao);
+				for (const glm::mat4& part : object->parts) {
+					glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(part));
+					drawMesh(*object->mesh);
+				}
+			}
+
+			light.isFaceValid[face] = true;
+			shadowMaps.facesRendered++;
+		}
+	}
+
+	if (isBound) {
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	glEndQuery(GL_TIME_ELAPSED);
+
+	// Previous frame's GPU time is ready by now
+	if (shadowMaps.frame > 0)
+		glGetQueryObjectui64v(shadowMaps.timeElapsed[(shadowMaps.frame + 1) & 1], GL_QUERY_RESULT, &shadowMaps.lastNanoseconds);
+	shadowMaps.frame++;
+
+	shadowMaps.cpuMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// SHADOW MAPS END *******************************************************
+
+// DEFERRED SHADING START *******************************************************
+
+// Extra point light with a finite range, shaded by both the forward and deferred paths
+struct PointLight {
+	glm::vec3 position;
+	float radius;
+	glm::vec3 color;
+};
+
+const int maxPointLights = 64; // size of the forward shader's uniform block arrays
+vector<PointLight> pointLights;
+
+// Scatter a repeatable set of colored lights above the desk
+void setPointLightCount(int count)
+{
+	count = max(0, min(count, maxPointLights));
+	pointLights.clear();
+
+	unsigned int seed = 12345u;
+	auto random01 = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / 16777216.0f;
+	};
+
+	for (int i = 0; i < count; i++) {
+		PointLight light;
+		light.position = glm::vec3(-4.5f + 9.0f * random01(), -2.8f + 1.8f * random01(), -4.5f + 9.0f * random01());
+		light.radius = 1.5f + random01();
+		light.color = glm::vec3(0.2f + 0.8f * random01(), 0.2f + 0.8f * random01(), 0.2f + 0.8f * random01());
+		pointLights.push_back(light);
+	}
+}
+
+// Geometry buffer: albedo, normal and depth, plus the lit image the light passes accumulate into
+struct GBuffer {
+	GLuint framebuffer;
+	GLuint albedo;   // RGBA8, texture color * object color
+	GLuint normal;   // RGBA16F, world space normal
+	GLuint lit;      // RGBA8, lighting result (lamps are drawn on top of it)
+	GLuint depth;    // DEPTH_COMPONENT32F, world position is rebuilt from it
+	GLuint geometryProgram;
+	GLuint lightProgram;
+	int width;
+	int height;
+};
+
+GBuffer gBuffer;
+
+// Full screen triangle is generated from gl_VertexID, but core profile still needs a VAO bound
+GLuint fullScreenVAO;
+
+GLuint createRenderTexture(GLenum internalFormat, GLenum format, GLenum type, int textureWidth, int textureHeight)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	allocateTexture(GL_TEXTURE_2D, 1, internalFormat, textureWidth, textureHeight, format, type);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+// (Re)create the G-buffer when the framebuffer size changes
+void resizeGBuffer(int newWidth, int newHeight)
+{
+	if (gBuffer.width == newWidth && gBuffer.height == newHeight)
+		return;
+
+	if (gBuffer.framebuffer) {
+		glDeleteFramebuffers(1, &gBuffer.framebuffer);
+		GLuint textures[] = { gBuffer.albedo, gBuffer.normal, gBuffer.lit, gBuffer.depth };
+		glDeleteTextures(4, textures);
+	}
+
+	gBuffer.width = newWidth;
+	gBuffer.height = newHeight;
+
+	gBuffer.albedo = createRenderTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, newWidth, newHeight);
+	gBuffer.normal = createRenderTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, newWidth, newHeight);
+	gBuffer.lit = createRenderTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, newWidth, newHeight);
+	gBuffer.depth = createRenderTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, newWidth, newHeight);
+
+	glGenFramebuffers(1, &gBuffer.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gBuffer.albedo, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gBuffer.normal, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gBuffer.lit, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gBuffer.depth, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Bind the G-buffer, clear every attachment and leave albedo and normal as the geometry pass targets
+void beginGeometryPass()
+{
+	GLenum allTargets[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.framebuffer);
+	glDrawBuffers(3, allTargets);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDrawBuffers(2, allTargets);
+}
+
+// Screen rectangle covered by a light's sphere, false when it is entirely off screen
+bool computeLightScissor(const glm::mat4& viewProjection, const PointLight& light, int rect[4])
+{
+	glm::vec2 ndcMin(1e30f), ndcMax(-1e30f);
+
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 offset(corner & 1 ? light.radius : -light.radius, corner & 2 ? light.radius : -light.radius, corner & 4 ? light.radius : -light.radius);
+		glm::vec4 clip = viewProjection * glm::vec4(light.position + offset, 1.0f);
+
+		// Sphere reaches behind the camera: cover the whole screen
+		if (clip.w <= 1e-5f) {
+			rect[0] = 0;
+			rect[1] = 0;
+			rect[2] = gBuffer.width;
+			rect[3] = gBuffer.height;
+			return true;
+		}
+
+		glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+		ndcMin = glm::min(ndcMin, ndc);
+		ndcMax = glm::max(ndcMax, ndc);
+	}
+
+	int x0 = max(0, (int)floor((ndcMin.x * 0.5f + 0.5f) * gBuffer.width));
+	int y0 = max(0, (int)floor((ndcMin.y * 0.5f + 0.5f) * gBuffer.height));
+	int x1 = min(gBuffer.width, (int)ceil((ndcMax.x * 0.5f + 0.5f) * gBuffer.width));
+	int y1 = min(gBuffer.height, (int)ceil((ndcMax.y * 0.5f + 0.5f) * gBuffer.height));
+	if (x0 >= x1 || y0 >= y1)
+		return false;
+
+	rect[0] = x0;
+	rect[1] = y0;
+	rect[2] = x1 - x0;
+	rect[3] = y1 - y0;
+	return true;
+}
+
+// Accumulate lighting into the lit target: one full screen pass for the ambient and scene lights,
+// then one additive pass per point light limited to the light volume's screen rectangle.
+// Camera and scene lights come from the Frame block. Returns the number of point lights that reached the screen.
+int shadeDeferredLights(const glm::mat4& viewProjection)
+{
+	GLenum litTarget = GL_COLOR_ATTACHMENT2;
+	glDrawBuffers(1, &litTarget);
+
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+
+	GLuint program = gBuffer.lightProgram;
+	glUseProgram(program);
+	bindShadowMaps(program);
+	glUniform1i(glGetUniformLocation(program, "gAlbedo"), 0);
+	glUniform1i(glGetUniformLocation(program, "gNormal"), 1);
+	glUniform1i(glGetUniformLocation(program, "gDepth"), 2);
+	glUniformMatrix4fv(glGetUniformLocation(program, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(viewProjection)));
+
+	GLint isPointLightLoc = glGetUniformLocation(program, "isPointLight");
+	GLint pointLightLoc = glGetUniformLocation(program, "pointLight");
+	GLint pointLightColorLoc = glGetUniformLocation(program, "pointLightColor");
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.albedo);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.normal);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+
+	glBindVertexArray(fullScreenVAO);
+
+	// Ambient and the two scene lights cover every pixel
+	glUniform1i(isPointLightLoc, 0);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// Point lights add on top, each only over its own screen rectangle
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_SCISSOR_TEST);
+	glUniform1i(isPointLightLoc, 1);
+
+	int lightsShaded = 0;
+	for (const PointLight& light : pointLights) {
+		int rect[4];
+		if (!computeLightScissor(viewProjection, light, rect))
+			continue;
+
+		lightsShaded++;
+
+		glScissor(rect[0], rect[1], rect[2], rect[3]);
+		glUniform4f(pointLightLoc, light.position.x, light.position.y, light.position.z, light.radius);
+		glUniform3f(pointLightColorLoc, light.color.x, light.color.y, light.color.z);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+
+	return lightsShaded;
+}
+
+// Copy the lit image to the window
+void blitGBufferToScreen()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer.framebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT2);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, gBuffer.width, gBuffer.height, 0, 0, gBuffer.width, gBuffer.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// The forward shaders' PointLights uniform block (std140), filled once per frame in the dynamic ring
+struct PointLightBlock {
+	glm::vec4 positions[maxPointLights]; // xyz position, w radius
+	glm::vec4 colors[maxPointLights];
+	GLint count;
+	GLint padding[3];
+};
+
+// Every shader's Frame uniform block (std140): camera and scene lights, filled once per frame in the dynamic ring
+struct FrameBlock {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPos;      // xyz, each vec3 takes a vec4 slot in std140
+	glm::vec4 lightPos;
+	glm::vec4 lightColor;
+	glm::vec4 lightPos1;
+	glm::vec4 lightColor1;
+};
+
+const GLuint pointLightBlockBinding = 0;
+const GLuint frameBlockBinding = 1;
+
+// Point each uniform block the program declares at its binding (blocks all start out on binding 0)
+void setUniformBlockBindings(GLuint program)
+{
+	const pair<const char*, GLuint> blocks[] = {
+		{ "PointLights", pointLightBlockBinding }, { "Frame", frameBlockBinding }, { "ShadowFace", shadowFaceBlockBinding }
+	};
+	for (const auto& binding : blocks) {
+		GLuint block = glGetUniformBlockIndex(program, binding.first);
+		if (block != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, block, binding.second);
+	}
+}
+
+// Write this frame's camera and scene lights to the ring and bind them for every scene shader
+void setFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+	const glm::vec3 lightPositions[2], const glm::vec3 lightColors[2])
+{
+	DynamicAllocation allocation = allocateDynamic(sizeof(FrameBlock), dynamicRing.uniformAlignment);
+	FrameBlock* block = static_cast<FrameBlock*>(allocation.data);
+	block->view = view;
+	block->projection = projection;
+	block->viewPos = glm::vec4(viewPos, 1.0f);
+	block->lightPos = glm::vec4(lightPositions[0], 1.0f);
+	block->lightColor = glm::vec4(lightColors[0], 1.0f);
+	block->lightPos1 = glm::vec4(lightPositions[1], 1.0f);
+	block->lightColor1 = glm::vec4(lightColors[1], 1.0f);
+	commitDynamic(allocation);
+	glBindBufferRange(GL_UNIFORM_BUFFER, frameBlockBinding, allocation.buffer, allocation.offset, allocation.size);
+}
+
+// Write this frame's point lights to the ring and bind them for the forward shaders
+void setForwardPointLights()
+{
+	DynamicAllocation allocation = allocateDynamic(sizeof(PointLightBlock), dynamicRing.uniformAlignment);
+	PointLightBlock* block = static_cast<PointLightBlock*>(allocation.data);
+	for (size_t i = 0; i < pointLights.size(); i++) {
+		block->positions[i] = glm::vec4(pointLights[i].position, pointLights[i].radius);
+		block->colors[i] = glm::vec4(pointLights[i].color, 1.0f);
+	}
+	block->count = (GLint)pointLights.size();
+	commitDynamic(allocation);
+	glBindBufferRange(GL_UNIFORM_BUFFER, pointLightBlockBinding, allocation.buffer, allocation.offset, allocation.size);
+}
+
+// DEFERRED SHADING END *******************************************************
+
+// HI-Z PYRAMID START *******************************************************
+
+// Scene is rendered offscreen so its depth can be reduced into a max-depth pyramid
+struct HiZPyramid {
+	GLuint sceneFramebuffer;
+	GLuint sceneColor;
+	GLuint sceneDepth;
+	GLuint hiZTexture;           // R32F, each texel holds the farthest depth it covers
+	vector<GLuint> levelFramebuffers;
+	GLuint copyProgram;
+	GLuint downsampleProgram;
+	int width;
+	int height;
+	int levels;
+	bool isValid;                // pyramid holds the depth of a frame drawn at this size
+	glm::mat4 viewProjection;    // matrix the pyramid was rendered with
+};
+
+HiZPyramid hiZ;
+
+// (Re)create the offscreen scene target and pyramid when the framebuffer size changes
+void resizeHiZ(int newWidth, int newHeight)
+{
+	if (hiZ.width == newWidth && hiZ.height == newHeight)
+		return;
+
+	if (hiZ.sceneFramebuffer) {
+		glDeleteFramebuffers(1, &hiZ.sceneFramebuffer);
+		glDeleteTextures(1, &hiZ.sceneColor);
+		glDeleteTextures(1, &hiZ.sceneDepth);
+		glDeleteTextures(1, &hiZ.hiZTexture);
+		glDeleteFramebuffers((GLsizei)hiZ.levelFramebuffers.size(), hiZ.levelFramebuffers.data());
+	}
+
+	hiZ.width = newWidth;
+	hiZ.height = newHeight;
+	hiZ.levels = 1;
+	while ((max(hiZ.width, hiZ.height) >> hiZ.levels) > 0)
+		hiZ.levels++;
+	hiZ.isValid = false;
+
+	// Scene color and depth
+	glGenTextures(1, &hiZ.sceneColor);
+	glBindTexture(GL_TEXTURE_2D, hiZ.sceneColor);
+	allocateTexture(GL_TEXTURE_2D, 1, GL_RGBA8, hiZ.width, hiZ.height, GL_RGBA, GL_UNSIGNED_BYTE);
+
+	glGenTextures(1, &hiZ.sceneDepth);
+	glBindTexture(GL_TEXTURE_2D, hiZ.sceneDepth);
+	allocateTexture(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, hiZ.width, hiZ.height, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+	glGenFramebuffers(1, &hiZ.sceneFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, hiZ.sceneFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZ.sceneColor, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hiZ.sceneDepth, 0);
+
+	// Pyramid with one framebuffer per level
+	glGenTextures(1, &hiZ.hiZTexture);
+	glBindTexture(GL_TEXTURE_2D, hiZ.hiZTexture);
+	allocateTexture(GL_TEXTURE_2D, hiZ.levels, GL_R32F, hiZ.width, hiZ.height, GL_RED, GL_FLOAT);
+
+	hiZ.levelFramebuffers.assign(hiZ.levels, 0);
+	glGenFramebuffers(hiZ.levels, hiZ.levelFramebuffers.data());
+	for (int level = 0; level < hiZ.levels; level++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, hiZ.levelFramebuffers[level]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZ.hiZTexture, level);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Reduce the scene depth into the pyramid: copy level 0, then take the max of each 2x2 block
+void buildHiZ(const glm::mat4& viewProjection)
+{
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(fullScreenVAO);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, hiZ.levelFramebuffers[0]);
+	glViewport(0, 0, hiZ.width, hiZ.height);
+	glUseProgram(hiZ.copyProgram);
+	glBindTexture(GL_TEXTURE_2D, hiZ.sceneDepth);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glUseProgram(hiZ.downsampleProgram);
+	GLint previousSizeLoc = glGetUniformLocation(hiZ.downsampleProgram, "previousSize");
+	glBindTexture(GL_TEXTURE_2D, hiZ.hiZTexture);
+
+	for (int level = 1; level < hiZ.levels; level++) {
+		// Only the previous level is visible to the shader, so reads and writes never overlap
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+		glUniform2i(previousSizeLoc, max(1, hiZ.width >> (level - 1)), max(1, hiZ.height >> (level - 1)));
+
+		glBindFramebuffer(GL_FRAMEBUFFER, hiZ.levelFramebuffers[level]);
+		glViewport(0, 0, max(1, hiZ.width >> level), max(1, hiZ.height >> level));
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiZ.levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, hiZ.width, hiZ.height);
+	glEnable(GL_DEPTH_TEST);
+
+	hiZ.isValid = true;
+	hiZ.viewProjection = viewProjection;
+}
+
+// Copy the offscreen scene color to the window
+void blitSceneToScreen()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, hiZ.sceneFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, hiZ.width, hiZ.height, 0, 0, hiZ.width, hiZ.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// HI-Z PYRAMID END *******************************************************
+
+
+// GPU CULLING START *******************************************************
+
+// One part of a scene object as seen by the culling compute shader (std430 layout)
+struct GpuInstance {
+	glm::mat4 model;
+	glm::vec4 boundsMin; // w = batch index
+	glm::vec4 boundsMax; // w = object group (0 desk, 1 crowded desk, 2 stress scene)
+	glm::vec4 material;  // rgb = object color, w = material layer (-1 for the batch's own texture)
+};
+
+// Matches the layout glDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Instances sharing a mesh, texture and color are drawn by one indirect command; instances in the
+// material array carry their layer and color, so they only need to share the mesh
+struct GpuBatch {
+	const Mesh* mesh;
+	GLuint texture;
+	glm::vec3 objectColor;
+	GLuint firstInstance;
+	GLuint instanceCount;
+};
+
+struct GpuCulling {
+	GLuint instanceBuffer;  // GpuInstance array
+	GLuint commandBuffer;   // one indirect command per batch, counts filled by the compute shader
+	GLuint lateCommandBuffer;   // the same for instances the late pass found visible after all
+	GLuint visibleBuffer;   // compacted visible instance indices, read as an instanced attribute (early, then late slots)
+	GLuint recheckBuffer;       // count, then the instances the early pass rejected against last frame's pyramid
+	GLuint culledBuffer;        // instances rejected by the Hi-Z test, for the debug view
+	GLuint debugCommandBuffer;  // one indirect command drawing a box per culled instance
+	GLuint boxVAO;
+	GLuint cullProgram;
+	GLuint drawProgram;
+	GLuint debugProgram;
+	GLuint instanceCount;
+	vector<GpuBatch> batches;
+	vector<DrawElementsIndirectCommand> commandTemplate;
+	vector<DrawElementsIndirectCommand> lateCommandTemplate;
+};
+
+GpuCulling gpuCulling;
+bool isGpuCullingSupported = false;
+
+// Upload every object part as a GPU instance, grouped by batch
+void buildGpuCulling(const vector<SceneObject>& sceneObjects, const vector<SceneObject>& crowdObjects, const vector<SceneObject>& stressObjects)
+{
+	gpuCulling.batches.clear();
+
+	// Find (or add) the batch for every object, counting instances per batch
+	vector<const SceneObject*> objects;
+	vector<int> objectBatch;
+	vector<int> objectGroup;
+
+	auto addObjects = [&](const vector<SceneObject>& list, int group) {
+		for (const SceneObject& object : list) {
+			bool isArrayMaterial = object.materialLayer >= 0;
+			GLuint texture = isArrayMaterial ? 0 : object.texture;
+			glm::vec3 objectColor = isArrayMaterial ? glm::vec3(0.0f) : object.objectColor;
+			int batch = -1;
+			for (int b = 0; b < (int)gpuCulling.batches.size(); b++) {
+				const GpuBatch& existing = gpuCulling.batches[b];
+				if (existing.mesh == object.mesh && existing.texture == texture && existing.objectColor == objectColor)
+					batch = b;
+			}
+			if (batch < 0) {
+				GpuBatch added = { object.mesh, texture, objectColor, 0, 0 };
+				gpuCulling.batches.push_back(added);
+				batch = (int)gpuCulling.batches.size() - 1;
+			}
+			gpuCulling.batches[batch].instanceCount += (GLuint)object.parts.size();
+			objects.push_back(&object);
+			objectBatch.push_back(batch);
+			objectGroup.push_back(group);
+		}
+	};
+	addObjects(sceneObjects, 0);
+	addObjects(crowdObjects, 1);
+	addObjects(stressObjects, 2);
+
+	// Give each batch its own range of instances and visible slots
+	GLuint first = 0;
+	for (GpuBatch& batch : gpuCulling.batches) {
+		batch.firstInstance = first;
+		first += batch.instanceCount;
+	}
+	gpuCulling.instanceCount = first;
+
+	vector<GpuInstance> instances(gpuCulling.instanceCount);
+	vector<GLuint> nextInstance(gpuCulling.batches.size());
+	for (size_t b = 0; b < gpuCulling.batches.size(); b++)
+		nextInstance[b] = gpuCulling.batches[b].firstInstance;
+
+	for (size_t o = 0; o < objects.size(); o++) {
+		for (const glm::mat4& part : objects[o]->parts) {
+			glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+			growPartBounds(*objects[o]->mesh, part, boundsMin, boundsMax);
+
+			GpuInstance& instance = instances[nextInstance[objectBatch[o]]++];
+			instance.model = part;
+			instance.boundsMin = glm::vec4(boundsMin, (float)objectBatch[o]);
+			instance.boundsMax = glm::vec4(boundsMax, (float)objectGroup[o]);
+			instance.material = glm::vec4(objects[o]->objectColor, (float)objects[o]->materialLayer);
+		}
+	}
+
+	// Commands start with zero instances every frame; the compute shader counts them up. Late commands
+	// read their visible indices from a second range after the early ones
+	gpuCulling.commandTemplate.clear();
+	gpuCulling.lateCommandTemplate.clear();
+	for (const GpuBatch& batch : gpuCulling.batches) {
+		GLuint indexSize = (GLuint)indexTypeSize(batch.mesh->indexType);
+		DrawElementsIndirectCommand command = { (GLuint)batch.mesh->indexCount, 0, (GLuint)(batch.mesh->indexOffset / indexSize),
+			batch.mesh->baseVertex, batch.firstInstance };
+		gpuCulling.commandTemplate.push_back(command);
+		command.baseInstance += gpuCulling.instanceCount;
+		gpuCulling.lateCommandTemplate.push_back(command);
+	}
+
+	glGenBuffers(1, &gpuCulling.instanceBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(GpuInstance), instances.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &gpuCulling.commandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, gpuCulling.commandTemplate.size() * sizeof(DrawElementsIndirectCommand), gpuCulling.commandTemplate.data(), GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &gpuCulling.lateCommandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.lateCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, gpuCulling.lateCommandTemplate.size() * sizeof(DrawElementsIndirectCommand), gpuCulling.lateCommandTemplate.data(), GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &gpuCulling.visibleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.visibleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, max(1u, gpuCulling.instanceCount) * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &gpuCulling.recheckBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.recheckBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (1 + gpuCulling.instanceCount) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &gpuCulling.culledBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.culledBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, max(1u, gpuCulling.instanceCount) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	DrawElementsIndirectCommand boxCommand = { 24, 0, 0, 0, 0 };
+	glGenBuffers(1, &gpuCulling.debugCommandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.debugCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(boxCommand), &boxCommand, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Unit box drawn as lines, stretched over each culled instance's bounds in the shader
+	GLfloat boxCorners[] = {
+		0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f,  1.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  0.0f, 1.0f, 1.0f,  1.0f, 1.0f, 1.0f
+	};
+	GLubyte boxLines[] = {
+		0, 1, 2, 3, 4, 5, 6, 7, // edges along x
+		0, 2, 1, 3, 4, 6, 5, 7, // edges along y
+		0, 4, 1, 5, 2, 6, 3, 7  // edges along z
+	};
+
+	GLuint boxVBO, boxEBO;
+	glGenBuffers(1, &boxVBO);
+	glGenBuffers(1, &boxEBO);
+	glGenVertexArrays(1, &gpuCulling.boxVAO);
+	glBindVertexArray(gpuCulling.boxVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(boxCorners), boxCorners, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(boxLines), boxLines, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, gpuCulling.culledBuffer);
+	glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+	glVertexAttribDivisor(4, 1);
+	glEnableVertexAttribArray(4);
+	glBindVertexArray(0);
+
+	// Feed the visible index list to every batch's VAO as instanced attribute 4;
+	// the command's baseInstance offsets it to the batch's slot range
+	for (const GpuBatch& batch : gpuCulling.batches) {
+		glBindVertexArray(batch.mesh->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, gpuCulling.visibleBuffer);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+		glVertexAttribDivisor(4, 1);
+		glEnableVertexAttribArray(4);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Set the Hi-Z test up for a culling dispatch against the pyramid as it is now
+void bindHiZForCulling(bool useHiZ)
+{
+	glUniform1i(glGetUniformLocation(gpuCulling.cullProgram, "useHiZ"), useHiZ ? 1 : 0);
+	if (!useHiZ)
+		return;
+	glUniformMatrix4fv(glGetUniformLocation(gpuCulling.cullProgram, "hiZViewProjection"), 1, GL_FALSE, glm::value_ptr(hiZ.viewProjection));
+	glUniform2i(glGetUniformLocation(gpuCulling.cullProgram, "hiZSize"), hiZ.width, hiZ.height);
+	glUniform1i(glGetUniformLocation(gpuCulling.cullProgram, "hiZLevels"), hiZ.levels);
+	glUniform1i(glGetUniformLocation(gpuCulling.cullProgram, "hiZ"), 0);
+	glBindTexture(GL_TEXTURE_2D, hiZ.hiZTexture);
+}
+
+// Early pass: frustum cull every instance on the GPU and compact the survivors into the indirect
+// commands. With Hi-Z on, survivors are also tested against last frame's pyramid through last frame's
+// matrix; the ones it hides are only set aside for cullLateInstancesOnGpu, so a camera that moved
+// never costs an object that came into view. Returns whether there was a pyramid to test against,
+// and so a late pass to run.
+bool cullInstancesOnGpu(const glm::mat4& viewProjection, GLuint enabledGroups, bool useHiZ)
+{
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+
+	// Reset instance counts (one small upload per batch, independent of object count), copied on the
+	// GPU from the dynamic ring since the culling shader writes over them
+	size_t commandBytes = gpuCulling.commandTemplate.size() * sizeof(DrawElementsIndirectCommand);
+	DynamicAllocation commands = allocateDynamic(commandBytes, 4);
+	memcpy(commands.data, gpuCulling.commandTemplate.data(), commandBytes);
+	copyDynamic(commands, GL_SHADER_STORAGE_BUFFER, gpuCulling.commandBuffer, 0);
+	DynamicAllocation lateCommands = allocateDynamic(commandBytes, 4);
+	memcpy(lateCommands.data, gpuCulling.lateCommandTemplate.data(), commandBytes);
+	copyDynamic(lateCommands, GL_SHADER_STORAGE_BUFFER, gpuCulling.lateCommandBuffer, 0);
+	DynamicAllocation noInstances = allocateDynamic(sizeof(GLuint), 4);
+	memset(noInstances.data, 0, sizeof(GLuint));
+	copyDynamic(noInstances, GL_SHADER_STORAGE_BUFFER, gpuCulling.debugCommandBuffer, offsetof(DrawElementsIndirectCommand, instanceCount));
+	copyDynamic(noInstances, GL_SHADER_STORAGE_BUFFER, gpuCulling.recheckBuffer, 0);
+
+	glUseProgram(gpuCulling.cullProgram);
+	glUniform4fv(glGetUniformLocation(gpuCulling.cullProgram, "frustumPlanes"), 6, glm::value_ptr(planes[0]));
+	glUniform1ui(glGetUniformLocation(gpuCulling.cullProgram, "instanceCount"), gpuCulling.instanceCount);
+	glUniform1ui(glGetUniformLocation(gpuCulling.cullProgram, "enabledGroups"), enabledGroups);
+	glUniform1i(glGetUniformLocation(gpuCulling.cullProgram, "isLatePass"), 0);
+	useHiZ = useHiZ && hiZ.isValid;
+	bindHiZForCulling(useHiZ);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpuCulling.commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpuCulling.visibleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gpuCulling.debugCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, gpuCulling.culledBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, gpuCulling.recheckBuffer);
+
+	glDispatchCompute((gpuCulling.instanceCount + 63) / 64, 1, 1);
+
+	// Commands and visible indices are consumed by the following draws, the set aside instances by the late pass
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	return useHiZ;
+}
+
+// Late pass: re-test what the early pass set aside against a pyramid built from this frame's early
+// draws, through this frame's matrix. Instances it still hides are the frame's culled ones, the rest
+// go into the late commands. Bindings and uniforms other than the pass are the early pass's.
+void cullLateInstancesOnGpu()
+{
+	glUseProgram(gpuCulling.cullProgram);
+	glUniform1i(glGetUniformLocation(gpuCulling.cullProgram, "isLatePass"), 1);
+	bindHiZForCulling(true);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpuCulling.lateCommandBuffer);
+
+	glDispatchCompute((gpuCulling.instanceCount + 63) / 64, 1, 1);
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+}
+
+// Draw every batch with one indirect call from the given commands (draw program must be in use);
+// colors and layers come per instance
+void drawGpuBatches(GLuint commandBuffer)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer);
+
+	for (size_t b = 0; b < gpuCulling.batches.size(); b++) {
+		const GpuBatch& batch = gpuCulling.batches[b];
+		if (batch.texture != 0)
+			glBindTexture(GL_TEXTURE_2D, batch.texture);
+		glBindVertexArray(batch.mesh->vao);
+		glDrawElementsIndirect(GL_TRIANGLES, batch.mesh->indexType, (GLvoid*)(b * sizeof(DrawElementsIndirectCommand)));
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// Draw the bounds of every instance the Hi-Z test rejected this frame, seen through the Frame block's camera
+void drawCulledBounds()
+{
+	glUseProgram(gpuCulling.debugProgram);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulling.debugCommandBuffer);
+	glBindVertexArray(gpuCulling.boxVAO);
+	glDrawElementsIndirect(GL_LINES, GL_UNSIGNED_BYTE, (GLvoid*)0);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glUseProgram(0);
+}
+
+// Number of instances the Hi-Z test rejected (small synchronous readback, used for stats only)
+GLuint readHiZCulledCount()
+{
+	DrawElementsIndirectCommand command;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.debugCommandBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return command.instanceCount;
+}
+
+// Number of instances the early pass set aside for the late pass (readback for stats only)
+GLuint readHiZRecheckCount()
+{
+	GLuint count;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCulling.recheckBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(count), &count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return count;
+}
+
+// GPU CULLING END *******************************************************
+
+// RENDER THREAD START *******************************************************
+
+// The GL context lives on a render thread. The main thread keeps the window: it handles events and
+// input, moves the camera and animates the light, and publishes what a frame needs as a snapshot.
+// Snapshots pass through a triple buffer. The main thread fills its own slot and swaps it with the
+// ready one; the render thread swaps the ready one with its own slot whenever a newer one is there.
+// Neither side ever blocks the other, so the main thread simulates frame N+1 while frame N renders,
+// and a slow callback only makes the render thread draw its last snapshot again.
+
+// Everything keys toggle, applied to the render globals when a snapshot is taken
+struct RenderSettings {
+	bool isPerspective;
+	bool isOcclusionCulling;
+	bool isCrowdedDesk;
+	bool isGpuCulling;
+	bool isHiZCulling;
+	bool isShowingCulled;
+	bool isDepthPrepass;
+	bool isFrontToBack;
+	bool isStressScene;
+	bool isDeferred;
+	bool isLod;
+	bool isQuantizedVertices;
+	bool isMeshletCulling;
+	bool isShadowCaching;
+	int shadowFilter;
+	int materialMode;
+	int pointLightCount;
+	size_t textureBudgetBytes;
+};
+
+// What the render thread reads of the scene for one frame
+struct SceneSnapshot {
+	long long frame;
+	GLfloat time;          // when the main thread took it
+	int width, height;     // framebuffer size
+	glm::mat4 viewMatrix;
+	glm::vec3 cameraPosition;
+	GLfloat fov;
+	glm::vec3 lightPositions[2];
+	RenderSettings settings;
+};
+
+const int snapshotFreshBit = 4;
+
+struct SceneSnapshots {
+	SceneSnapshot slots[3];
+	atomic<int> ready;     // slot of the newest snapshot, with snapshotFreshBit until the render thread takes it
+	int writing = 1;       // main thread's slot
+	int reading = 2;       // render thread's slot
+	long long published = 0;
+	atomic<bool> quit;
+	int framesRendered = 0;  // since the last stats print
+	int framesRepeated = 0;  // frames that found no newer snapshot and drew the last one again
+	double ageMs = 0.0;      // summed time from taking each drawn snapshot to presenting it
+};
+
+SceneSnapshots sceneSnapshots;
+
+// The main thread's settings, the ones the key callback changes
+RenderSettings sceneSettings;
+
+// Settings as the render globals have them, to start the main thread's copy from
+RenderSettings captureRenderSettings()
+{
+	RenderSettings settings;
+	settings.isPerspective = isPerspective;
+	settings.isOcclusionCulling = isOcclusionCulling;
+	settings.isCrowdedDesk = isCrowdedDesk;
+	settings.isGpuCulling = isGpuCulling;
+	settings.isHiZCulling = isHiZCulling;
+	settings.isShowingCulled = isShowingCulled;
+	settings.isDepthPrepass = isDepthPrepass;
+	settings.isFrontToBack = isFrontToBack;
+	settings.isStressScene = isStressScene;
+	settings.isDeferred = isDeferred;
+	settings.isLod = isLod;
+	settings.isQuantizedVertices = isQuantizedVertices;
+	settings.isMeshletCulling = isMeshletCulling;
+	settings.isShadowCaching = isShadowCaching;
+	settings.shadowFilter = shadowFilter;
+	settings.materialMode = materialMode;
+	settings.pointLightCount = (int)pointLights.size();
+	settings.textureBudgetBytes = textureStreamer.budgetBytes;
+	return settings;
+}
+
+// Called by the render thread only
+void applyRenderSettings(const RenderSettings& settings)
+{
+	isPerspective = settings.isPerspective;
+	isOcclusionCulling = settings.isOcclusionCulling;
+	isCrowdedDesk = settings.isCrowdedDesk;
+	isGpuCulling = settings.isGpuCulling;
+	isHiZCulling = settings.isHiZCulling;
+	isShowingCulled = settings.isShowingCulled;
+	isDepthPrepass = settings.isDepthPrepass;
+	isFrontToBack = settings.isFrontToBack;
+	isStressScene = settings.isStressScene;
+	isDeferred = settings.isDeferred;
+	isLod = settings.isLod;
+	isQuantizedVertices = settings.isQuantizedVertices;
+	isMeshletCulling = settings.isMeshletCulling;
+	isShadowCaching = settings.isShadowCaching;
+	shadowFilter = settings.shadowFilter;
+	materialMode = settings.materialMode;
+	if ((int)pointLights.size() != settings.pointLightCount)
+		setPointLightCount(settings.pointLightCount);
+	textureStreamer.budgetBytes = settings.textureBudgetBytes;
+}
+
+// Fill the main thread's slot from the camera, lights and settings and make it the ready snapshot
+void publishSnapshot(GLFWwindow* window, GLfloat time)
+{
+	SceneSnapshot& snapshot = sceneSnapshots.slots[sceneSnapshots.writing];
+	snapshot.frame = ++sceneSnapshots.published;
+	snapshot.time = time;
+	glfwGetFramebufferSize(window, &snapshot.width, &snapshot.height);
+	snapshot.viewMatrix = glm::lookAt(cameraPosition, getTarget(), worldUp);
+	snapshot.cameraPosition = cameraPosition;
+	snapshot.fov = fov;
+	snapshot.lightPositions[0] = lightPosition;
+	snapshot.lightPositions[1] = lightPosition1;
+	snapshot.settings = sceneSettings;
+
+	// A snapshot still marked fresh was never drawn; its slot is simply written again next time
+	int previous = sceneSnapshots.ready.exchange(sceneSnapshots.writing | snapshotFreshBit, memory_order_acq_rel);
+	sceneSnapshots.writing = previous & ~snapshotFreshBit;
+}
+
+// True while the last published snapshot is waiting for the render thread
+bool isSnapshotPending()
+{
+	return (sceneSnapshots.ready.load(memory_order_acquire) & snapshotFreshBit) != 0;
+}
+
+// Render thread: swap in the newest snapshot if there is one since the last call
+bool acquireSnapshot()
+{
+	if (!isSnapshotPending())
+		return false;
+	int previous = sceneSnapshots.ready.exchange(sceneSnapshots.reading, memory_order_acq_rel);
+	sceneSnapshots.reading = previous & ~snapshotFreshBit;
+	return true;
+}
+
+// RENDER THREAD END *******************************************************
+
+
+
+
+int main(int argc, char** argv)
+{
+	// Command line tools run without a window: "--cook model.obj model.mesh" writes a cooked mesh,
+	// "--import-benchmark [segments]" measures importer throughput
+	if (argc >= 2 && (strcmp(argv[1], "--cook") == 0 || strcmp(argv[1], "--import-benchmark") == 0)) {
+		bool isCook = strcmp(argv[1], "--cook") == 0;
+		if (isCook && argc < 4) {
+			cout << "Usage: " << argv[0] << " --cook <model.obj|.gltf|.glb> <output.mesh>" << endl;
+			return -1;
+		}
+		startJobWorkers();
+		bool isDone = true;
+		if (isCook)
+			isDone = cookModel(argv[2], argv[3]);
+		else
+			runImportBenchmark(argc >= 3 ? max(atoi(argv[2]), 8) : 1024);
+		stopJobWorkers();
+		return isDone ? 0 : -1;
+	}
+
+	// "--texture-budget <MB>" sets the streamed texture budget, "--mip-filter <0|1|2>" the filter of
+	// cooked mip chains, "--mip-benchmark [size]" only compares mip generation, "--mesh-heap-benchmark
+	// [count]" only exercises the mesh heap, "--job-benchmark [parts]" only measures job system scaling;
+	// any other argument is a model to import
+	const char* modelPath = nullptr;
+	int mipBenchmarkSize = 0;
+	int meshHeapBenchmarkCount = 0;
+	int jobBenchmarkParts = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+			textureStreamer.budgetBytes = (size_t)(atof(argv[++i]) * 1048576.0);
+		else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc)
+			mipFilter = min(max(atoi(argv[++i]), 0), 2);
+		else if (strcmp(argv[i], "--mip-benchmark") == 0)
+			mipBenchmarkSize = i + 1 < argc && atoi(argv[i + 1]) > 0 ? 1 << (int)log2(max(atoi(argv[++i]), 2)) : 4096;
+		else if (strcmp(argv[i], "--mesh-heap-benchmark") == 0)
+			meshHeapBenchmarkCount = i + 1 < argc && atoi(argv[i + 1]) > 0 ? min(atoi(argv[++i]), 50000) : 4096;
+		else if (strcmp(argv[i], "--job-benchmark") == 0)
+			jobBenchmarkParts = i + 1 < argc && atoi(argv[i + 1]) > 0 ? atoi(argv[++i]) : 100000;
+		else
+			modelPath = argv[i];
+	}
+
+	if (jobBenchmarkParts > 0) {
+		runJobBenchmark(jobBenchmarkParts);
+		return 0;
+	}
+
+	GLFWwindow* window;
+
+	/* Initialize the library */
+	if (!glfwInit())
+		return -1;
+
+	/* Create a windowed mode window and its OpenGL context */
+	window = glfwCreateWindow(width, height, "Main Window", NULL, NULL);
+	if (!window)
+	{
+		glfwTerminate();
+		return -1;
+	}
+
+	// Set Input Callback Functions
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetCursorPosCallback(window, cursor_position_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+	/* Make the window's context current */
+	glfwMakeContextCurrent(window);
+
+	// Initialize GLEW
+	if (glewInit() != GLEW_OK)
+		cout << "Error!" << endl;
+
+	// Compute shaders, SSBOs and indirect draws need OpenGL 4.3
+	isGpuCullingSupported = GLEW_VERSION_4_3 != 0;
+
+	GLint programBinaryFormats = 0;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &programBinaryFormats);
+	isProgramBinarySupported = programBinaryFormats > 0;
+	isTextureStorageSupported = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+
+	if (mipBenchmarkSize > 0) {
+		startJobWorkers();
+		runMipBenchmark(mipBenchmarkSize);
+		stopJobWorkers();
+		glfwTerminate();
+		return 0;
+	}
+
+	if (meshHeapBenchmarkCount > 0) {
+		runMeshHeapBenchmark(meshHeapBenchmarkCount);
+		glfwTerminate();
+		return 0;
+	}
+
+	createSamplers();
+	createDynamicRing();
+	cout << "Textures: " << (isTextureStorageSupported ? "immutable storage" : "mutable levels (no ARB_texture_storage)")
+		<< ", trilinear material sampler with " << samplers.anisotropy << "x anisotropy" << endl;
+
+	// Enable Depth Buffer
+	glEnable(GL_DEPTH_TEST);
+
+	// Wireframe mode
+	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+	// CREATE AND BIND LAPIS START *******************************************************
+	GLfloat verticesLapis[] = {
+
+		// Triangle 1
+		-0.25, -0.5, 0.435, // index 0
+		1.0, 0.0, 0.0, // red
+		0.0, 3.0,    // Texture UV left side near top
+		0.0f, 0.0f, 1.0f, // normal positive z
+
+		0.0, 0.25, 0.0, // index 1
+		0.0, 1.0, 0.0, // green
+		0.5, 3.435,      // Texture UV top middle
+		0.0f, 0.0f, 1.0f, // normal positive z
+
+		0.25, -0.5, 0.435,  // index 2	
+		0.0, 0.0, 1.0, // blue
+		1.0, 3.0,    // Texture UV right side near top
+		0.0f, 0.0f, 1.0f, // normal positive z
+
+		// Triangle 2 and 3
+		0.25, -3.0, 0.435,  // index 3
+		1.0, 0.0, 1.0, // purple
+		1.0, 0.0,      // Texture UV bottom right
+		0.0f, 0.0f, 1.0f, // normal positive z
+
+		-0.25, -3.0, 0.435,  // index 4
+		1.0, 0.0, 1.0, // purple
+		0.0, 0.0,       // Texture UV bottom left
+		0.0f, 0.0f, 1.0f // normal positive z
+
+	};
+
+	// Define element indices
+	GLubyte indicesLapis[] = {
+		0, 1, 2,
+		2, 4, 3,
+		2, 4, 0
+	};
+
+	// Plane roations for Y axis
+	glm::float32 planeRotationsYLapis[] = {
+		0.0f,
+		60.0f,
+		120.0f,
+		180.0f,
+		240.0f,
+		300.0f
+	};
+
+
+	glm::vec3 LapisPosition(1.5f, 0.0f, 0.0f);
+
+	// CREATE AND BIND LAPIS END *******************************************************
+
+	// CREATE AND BIND PLANE START *******************************************************
+	GLfloat verticesPlane[] = {
+
+		// Triangle 1
+		-5.0, -3.0, 5.0, // index 0
+		0.57, 0.31, 0.14, // BROWN
+		0.0, 0.0,         // Texture UV bottom left
+		0.0f, 1.0f, 0.0f, // normal positive z
+
+		5.0, -3.0, -5.0, // index 1
+		0.57, 0.31, 0.14, // BROWN
+		1.0, 1.0,         // Texture UV top right
+		0.0f, 1.0f, 0.0f, // normal positive z
+
+		5.0, -3.0, 5.0,  // index 2	
+		0.57, 0.31, 0.14, // BROWN
+		1.0, 0.0,        // Texture UV bottom right
+		0.0f, 1.0f, 0.0f, // normal positive z
+
+		// Triangle 2
+		-5.0, -3.0, -5.0,  // index 3
+		0.57, 0.31, 0.14, // BROWN
+		0.0, 1.0,         // Texture UV top left
+		0.0f, 1.0f, 0.0f // normal positive z
+
+	};
+
+	// Define element indices
+	GLubyte PlaneIndices[] = {
+		0, 1, 2,
+		0, 1, 3
+	};
+
+	// CREATE AND BIND PLANE END *******************************************************
+
+	// CREATE PROCEDURAL MESHES START (CHARGER/LASER POINTER/LEGO) *******************************************************
+
+	// Tessellation of the generated round meshes per level of detail, raise for quality or lower for speed,
+	// with the smallest on screen diameter in pixels each level is drawn at
+	const int cylinderSegments[maxLodLevels] = { 48, 24, 12, 6 };
+	const float cylinderScreenSizes[maxLodLevels] = { 200.0f, 80.0f, 30.0f, 0.0f };
+
+	// Dense sphere and torus stand in for imported meshes: their coarser levels come from the simplifier,
+	// keeping these fractions of the triangles (or fewer triangles, if the error limit is reached first)
+	const float simplifiedRatios[maxLodLevels - 1] = { 0.5f, 0.25f, 0.1f };
+	const float simplifyMaxError = 0.02f;
+	const float simplifiedScreenSizes[maxLodLevels] = { 200.0f, 80.0f, 30.0f, 0.0f };
+
+	// Generation, import and simplification share the worker threads
+	startJobWorkers();
+	auto meshStart = chrono::high_resolution_clock::now();
+
+	// An optional model from the command line (.obj, .gltf, .glb or cooked .mesh) joins the arena
+	ImportedMesh importedModel;
+	bool isModelImported = false;
+	if (modelPath) {
+		ImportTimings timings;
+		string error;
+		isModelImported = importCachedMesh(modelPath, importedModel, timings, error);
+		if (isModelImported)
+			printImportTimings(modelPath, importedModel, timings);
+		else
+			cout << "Import of " << modelPath << " failed: " << error << endl;
+	}
+
+	// Every arena mesh, in the order the arena cache stores them
+	Mesh cylLevels[maxLodLevels], sphereLevels[maxLodLevels], torusLevels[maxLodLevels];
+	Mesh boxMesh, lampMesh, lapisMesh, planeMesh;
+	Mesh modelLevels[maxLodLevels] = {};
+
+	struct NamedMesh {
+		const char* name;
+		Mesh* mesh;
+	};
+	vector<NamedMesh> arenaMeshes;
+	for (int level = 0; level < maxLodLevels; level++) {
+		NamedMesh cylinder = { "cylinder", &cylLevels[level] };
+		arenaMeshes.push_back(cylinder);
+	}
+	NamedMesh box = { "box", &boxMesh };
+	arenaMeshes.push_back(box);
+	for (int level = 0; level < maxLodLevels; level++) {
+		NamedMesh sphere = { "sphere", &sphereLevels[level] };
+		NamedMesh torus = { "torus", &torusLevels[level] };
+		arenaMeshes.push_back(sphere);
+		arenaMeshes.push_back(torus);
+	}
+	if (isModelImported) {
+		for (int level = 0; level < maxLodLevels; level++) {
+			NamedMesh model = { "imported model", &modelLevels[level] };
+			arenaMeshes.push_back(model);
+		}
+	}
+
+	vector<Mesh*> packedMeshes;
+	for (const NamedMesh& named : arenaMeshes)
+		packedMeshes.push_back(named.mesh);
+	packedMeshes.push_back(&lampMesh);
+	packedMeshes.push_back(&lapisMesh);
+	packedMeshes.push_back(&planeMesh);
+
+	// The hand built meshes share the arena's buffers too
+	const GLsizei lapisVertexCount = sizeof(verticesLapis) / (11 * sizeof(GLfloat));
+	const GLsizei planeVertexCount = sizeof(verticesPlane) / (11 * sizeof(GLfloat));
+
+	// The built arena is keyed by every input above; the generators' own constants are covered by assetCookerVersion
+	MeshSize denseSizes[2] = { sphereMeshSize(64, 48), torusMeshSize(96, 32) };
+	uint64_t arenaKey = hashBytes(cylinderSegments, sizeof(cylinderSegments), 0);
+	arenaKey = hashBytes(simplifiedRatios, sizeof(simplifiedRatios), arenaKey);
+	arenaKey = hashBytes(&simplifyMaxError, sizeof(simplifyMaxError), arenaKey);
+	arenaKey = hashBytes(denseSizes, sizeof(denseSizes), arenaKey);
+	arenaKey = hashBytes(verticesLapis, sizeof(verticesLapis), arenaKey);
+	arenaKey = hashBytes(indicesLapis, sizeof(indicesLapis), arenaKey);
+	arenaKey = hashBytes(verticesPlane, sizeof(verticesPlane), arenaKey);
+	arenaKey = hashBytes(PlaneIndices, sizeof(PlaneIndices), arenaKey);
+	arenaKey = hashBytes(importedModel.vertices.data(), importedModel.vertices.size() * sizeof(GLfloat), arenaKey);
+	arenaKey = hashBytes(importedModel.indices.data(), importedModel.indices.size() * sizeof(GLuint), arenaKey);
+
+	MeshArena proceduralArena;
+	createMeshArena(proceduralArena);
+	bool isArenaCached = loadArenaCache(proceduralArena, packedMeshes, arenaKey);
+	if (isArenaCached) {
+		cout << "Mesh arena: " << packedMeshes.size() << " meshes read from the asset cache" << endl;
+	}
+	else {
+		vector<MeshSize> proceduralSizes;
+		for (int level = 0; level < maxLodLevels; level++)
+			proceduralSizes.push_back(cylinderMeshSize(cylinderSegments[level], 1.0f));
+		proceduralSizes.push_back(boxMeshSize(GL_TRIANGLES));
+		proceduralSizes.push_back(boxMeshSize(GL_TRIANGLE_STRIP));
+
+		MeshSize lapisSize = { lapisVertexCount, sizeof(indicesLapis) };
+		MeshSize planeSize = { planeVertexCount, sizeof(PlaneIndices) };
+		proceduralSizes.push_back(lapisSize);
+		proceduralSizes.push_back(planeSize);
+
+		// Simplified levels can never be larger than their source, so reserve the source size for each
+		for (const MeshSize& size : denseSizes) {
+			for (int level = 0; level < maxLodLevels; level++)
+				proceduralSizes.push_back(size);
+		}
+		if (isModelImported) {
+			MeshSize modelSize = { (GLsizei)(importedModel.vertices.size() / 11), (GLsizei)importedModel.indices.size() };
+			for (int level = 0; level < maxLodLevels; level++)
+				proceduralSizes.push_back(modelSize);
+		}
+		reserveMeshArena(proceduralArena, proceduralSizes);
+
+		for (int level = 0; level < maxLodLevels; level++)
+			cylLevels[level] = generateCylinder(proceduralArena, cylinderSegments[level], 1.0f);
+
+		boxMesh = generateBox(proceduralArena, GL_TRIANGLES);
+		lampMesh = generateBox(proceduralArena, GL_TRIANGLE_STRIP);
+		lapisMesh = addArenaMesh(proceduralArena, verticesLapis, lapisVertexCount, indicesLapis, sizeof(indicesLapis));
+		planeMesh = addArenaMesh(proceduralArena, verticesPlane, planeVertexCount, PlaneIndices, sizeof(PlaneIndices));
+		if (isModelImported) {
+			modelLevels[0] = addArenaMesh(proceduralArena, importedModel.vertices.data(), (GLsizei)(importedModel.vertices.size() / 11),
+				importedModel.indices.data(), (GLsizei)importedModel.indices.size());
+		}
+
+		sphereLevels[0] = generateSphere(proceduralArena, 64, 48);
+		torusLevels[0] = generateTorus(proceduralArena, 96, 32, 0.25f);
+
+		// Simplify the dense meshes and the imported model on the worker threads, one mesh per thread
+		vector<Mesh*> denseLevels = { sphereLevels, torusLevels };
+		vector<const char*> denseNames = { "sphere", "torus" };
+		if (isModelImported) {
+			denseLevels.push_back(modelLevels);
+			denseNames.push_back("imported model");
+		}
+		vector<SimplifyJob> simplifyJobs(denseLevels.size());
+		for (size_t m = 0; m < denseLevels.size(); m++)
+			simplifyJobs[m].source = &denseLevels[m][0];
+		for (SimplifyJob& job : simplifyJobs)
+			job.ratios.assign(simplifiedRatios, simplifiedRatios + maxLodLevels - 1);
+
+		auto simplifyStart = chrono::high_resolution_clock::now();
+		simplifyMeshes(simplifyJobs, simplifyMaxError);
+		double simplifyMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - simplifyStart).count();
+
+		for (size_t m = 0; m < simplifyJobs.size(); m++) {
+			SimplifyJob& job = simplifyJobs[m];
+			cout << "Simplified " << denseNames[m] << " (" << job.milliseconds << " ms):";
+			for (int level = 1; level < maxLodLevels; level++) {
+				const SimplifiedMesh& simplified = job.levels[level - 1];
+				denseLevels[m][level] = addSimplifiedMesh(proceduralArena, simplified);
+				cout << " " << job.source->indexCount / 3 << " -> " << simplified.indices.size() / 3 << " tris ("
+					<< 100.0 * (1.0 - (double)simplified.indices.size() / job.source->indexCount) << "% fewer, error "
+					<< simplified.error * 100.0f << "%)" << (level + 1 < maxLodLevels ? "," : "");
+			}
+			cout << endl;
+		}
+		cout << "Simplified " << simplifyJobs.size() << " meshes on " << jobSystem.threads.size() + 1 << " threads in " << simplifyMs << " ms" << endl;
+
+		// Reorder every generated and simplified mesh for the post transform cache, overdraw and vertex fetch
+		for (const NamedMesh& named : arenaMeshes) {
+			CacheStats before, after;
+			optimizeArenaMesh(proceduralArena, *named.mesh, before, after);
+			cout << "Optimized " << named.name << " (" << named.mesh->indexCount / 3 << " tris): ACMR "
+				<< before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+		}
+
+		// Cluster the large meshes while their indices are still 32 bit; packing keeps the index order
+		buildArenaMeshlets(proceduralArena, packedMeshes);
+		for (const NamedMesh& named : arenaMeshes) {
+			const Mesh& mesh = *named.mesh;
+			if (mesh.meshletCount == 0)
+				continue;
+			float radius = 0.0f;
+			int cones = 0;
+			for (GLsizei m = 0; m < mesh.meshletCount; m++) {
+				radius += mesh.meshlets[m].radius;
+				cones += mesh.meshlets[m].coneCutoff < 1.0f ? 1 : 0;
+			}
+			CacheStats cache = simulateVertexCache(proceduralArena.indices.data() + mesh.indexOffset / sizeof(GLuint), mesh.indexCount, mesh.vertexCount);
+			cout << "Meshlets for " << named.name << " (" << mesh.indexCount / 3 << " tris): " << mesh.meshletCount << " clusters, mean radius "
+				<< radius / mesh.meshletCount << ", " << cones << " with a usable normal cone, ACMR " << cache.acmr << endl;
+		}
+
+		// Pack every mesh into the shared index buffer at the narrowest type it fits
+		size_t unpackedIndexBytes = proceduralArena.indices.size() * sizeof(GLuint);
+		size_t typeBytes[3];
+		packMeshArena(proceduralArena, packedMeshes, typeBytes);
+		cout << "Index buffer: " << packedMeshes.size() << " meshes in " << proceduralArena.packedIndices.size() << " bytes ("
+			<< typeBytes[0] << " 8 bit, " << typeBytes[1] << " 16 bit, " << typeBytes[2] << " 32 bit), "
+			<< unpackedIndexBytes << " bytes as 32 bit" << endl;
+
+		storeArenaCache(proceduralArena, packedMeshes, arenaKey);
+	}
+
+	MeshLods cylinderLods, sphereLods, torusLods, modelLods;
+	for (int level = 0; level < maxLodLevels; level++) {
+		cylinderLods.levels[level] = &cylLevels[level];
+		cylinderLods.minScreenSize[level] = cylinderScreenSizes[level];
+		sphereLods.levels[level] = &sphereLevels[level];
+		sphereLods.minScreenSize[level] = simplifiedScreenSizes[level];
+		torusLods.levels[level] = &torusLevels[level];
+		torusLods.minScreenSize[level] = simplifiedScreenSizes[level];
+		modelLods.levels[level] = &modelLevels[level];
+		modelLods.minScreenSize[level] = simplifiedScreenSizes[level];
+	}
+	cylinderLods.levelCount = sphereLods.levelCount = torusLods.levelCount = modelLods.levelCount = maxLodLevels;
+	Mesh& cylMesh = cylLevels[0];
+
+	uploadMeshArena(proceduralArena);
+
+	// Quantize the arena's vertices and report the worst error against the float copy
+	QuantizationStats quantization = quantizeMeshArena(proceduralArena);
+	size_t arenaVertexCount = proceduralArena.vertices.size() / 11;
+	cout << "Vertex format: " << 11 * sizeof(GLfloat) << " -> " << sizeof(QuantizedVertex) << " bytes per vertex, "
+		<< arenaVertexCount * 11 * sizeof(GLfloat) << " -> " << arenaVertexCount * sizeof(QuantizedVertex) << " bytes; max error position "
+		<< quantization.positionError << ", normal " << quantization.normalErrorDegrees << " degrees, UV "
+		<< quantization.texCoordError << ", color " << quantization.colorError << endl;
+	bool isArenaQuantized = isQuantizedVertices;
+
+	// The arena's meshes move into the mesh heap, which keeps them from here on
+	meshHeap.isQuantized = isArenaQuantized;
+	moveArenaToHeap(proceduralArena, packedMeshes);
+	printMeshHeap("Mesh heap: ");
+	assetCache.meshMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - meshStart).count();
+
+	// The generated meshes are unit sized; these fits place them where the old hand built cylinder
+	// (radius 0.5, y from -3 to -0.5) and prism (1 x 0.5 x 1) sat, so object transforms stay the same
+	glm::mat4 cylinderFit;
+	cylinderFit = glm::translate(cylinderFit, glm::vec3(0.0f, -3.0f, 0.0f));
+	cylinderFit = glm::scale(cylinderFit, glm::vec3(0.5f, 2.5f, 0.5f));
+
+	glm::mat4 boxFit;
+	boxFit = glm::scale(boxFit, glm::vec3(1.0f, 0.5f, 1.0f));
+
+	glm::vec3 chargerPosition(-1.5f, 0.0f, 0.0f);
+
+	// CREATE PROCEDURAL MESHES END *******************************************************
+
+	// Load textures (decoded and mipmapped once, then read back from the asset cache), each also a
+	// layer of the material array; the separate textures start coarse and stream in finer levels
+	const char* materialPaths[] = { "lapis.jpg", "wood.png", "grey.png", "tan.jpg", "gold.png" };
+	loadMaterials(materials, materialPaths, 5, streamingStartSize);
+	startTextureStreaming(materials);
+	GLuint lapisTexture = materials.textures[0];
+	GLuint woodTexture = materials.textures[1];
+	GLuint blackTexture = materials.textures[2];
+	GLuint tanTexture = materials.textures[3];
+	GLuint goldTexture = materials.textures[4];
+
+	// BUILD SCENE OBJECTS START *******************************************************
+
+	// Lapis: six planes rotated around Y
+	auto makeLapis = [&](glm::vec3 position) {
+		SceneObject lapis = { &lapisMesh, lapisTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+		for (GLuint i = 0; i < 6; i++) {
+			glm::mat4 modelMatrix;
+			modelMatrix = glm::translate(modelMatrix, position);
+			modelMatrix = glm::rotate(modelMatrix, planeRotationsYLapis[i] * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
+			lapis.parts.push_back(modelMatrix);
+		}
+		lapis.isOccluder = true;
+		return lapis;
+	};
+
+	// Charger: one generated cylinder
+	auto makeCharger = [&](glm::vec3 position) {
+		SceneObject charger = { &cylMesh, blackTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+		glm::mat4 modelMatrix;
+		modelMatrix = glm::translate(modelMatrix, position);
+		charger.parts.push_back(modelMatrix * cylinderFit);
+		charger.isOccluder = true;
+		charger.lods = &cylinderLods;
+		return charger;
+	};
+
+	// Lego nub (cylinder) and body (box), base is the bottom center of the body
+	auto makeLego = [&](glm::vec3 base, vector<SceneObject>& objects) {
+		SceneObject nub = { &cylMesh, tanTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+		glm::mat4 nubMatrix;
+		nubMatrix = glm::translate(nubMatrix, base + glm::vec3(0.0f, 0.15f, 0.0f));
+		nubMatrix = glm::scale(nubMatrix, glm::vec3(.15f, .03f, .15f));
+		nub.parts.push_back(nubMatrix * cylinderFit);
+		nub.isOccluder = false;
+		nub.lods = &cylinderLods;
+		objects.push_back(nub);
+
+		SceneObject body = { &boxMesh, tanTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+		glm::mat4 bodyMatrix;
+		bodyMatrix = glm::translate(bodyMatrix, base);
+		bodyMatrix = glm::scale(bodyMatrix, glm::vec3(.2f, .2f, .2f));
+		body.parts.push_back(bodyMatrix * boxFit);
+		body.isOccluder = false;
+		objects.push_back(body);
+	};
+
+	vector<SceneObject> sceneObjects;
+
+	sceneObjects.push_back(makeLapis(LapisPosition));
+	sceneObjects.push_back(makeCharger(chargerPosition));
+
+	// Laser pointer: cylinder laid on its side
+	SceneObject laserPointer = { &cylMesh, goldTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+	glm::mat4 laserMatrix;
+	laserMatrix = glm::translate(laserMatrix, glm::vec3(0.0f, -2.835f, 0.0f));
+	laserMatrix = glm::rotate(laserMatrix, 90.0f * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
+	laserMatrix = glm::rotate(laserMatrix, 20.0f * toRadians, glm::vec3(0.0f, 0.0f, 1.0f));
+	laserMatrix = glm::scale(laserMatrix, glm::vec3(.35f, .7f, .35f));
+	laserPointer.parts.push_back(laserMatrix * cylinderFit);
+	laserPointer.isOccluder = false;
+	laserPointer.lods = &cylinderLods;
+	sceneObjects.push_back(laserPointer);
+
+	makeLego(glm::vec3(-1.0f, -3.0f, 1.0f), sceneObjects);
+
+	// Marble and ring, drawn from the simplifier's levels of detail
+	SceneObject marble = { &sphereLevels[0], lapisTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+	glm::mat4 marbleMatrix;
+	marbleMatrix = glm::translate(marbleMatrix, glm::vec3(0.9f, -2.75f, 1.6f));
+	marbleMatrix = glm::scale(marbleMatrix, glm::vec3(.25f, .25f, .25f));
+	marble.parts.push_back(marbleMatrix);
+	marble.isOccluder = false;
+	marble.lods = &sphereLods;
+	sceneObjects.push_back(marble);
+
+	SceneObject ring = { &torusLevels[0], goldTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+	glm::mat4 ringMatrix;
+	ringMatrix = glm::translate(ringMatrix, glm::vec3(-0.4f, -2.925f, 2.2f));
+	ringMatrix = glm::scale(ringMatrix, glm::vec3(.3f, .3f, .3f));
+	ring.parts.push_back(ringMatrix);
+	ring.isOccluder = false;
+	ring.lods = &torusLods;
+	sceneObjects.push_back(ring);
+
+	// Imported model, scaled to fit a unit cube and stood on the desk
+	if (isModelImported) {
+		SceneObject model = { &modelLevels[0], tanTexture, glm::vec3(1.0f, 1.0f, 1.0f) };
+		glm::vec3 extent = importedModel.boundsMax - importedModel.boundsMin;
+		float fit = 1.0f / max(max(extent.x, extent.y), max(extent.z, 1e-6f));
+		glm::vec3 center = (importedModel.boundsMin + importedModel.boundsMax) * 0.5f;
+		glm::mat4 modelMatrix;
+		modelMatrix = glm::translate(modelMatrix, glm::vec3(2.5f, -3.0f, 1.5f));
+		modelMatrix = glm::scale(modelMatrix, glm::vec3(fit));
+		modelMatrix = glm::translate(modelMatrix, glm::vec3(-center.x, -importedModel.boundsMin.y, -center.z));
+		model.parts.push_back(modelMatrix);
+		model.isOccluder = false;
+		model.lods = &modelLods;
+		sceneObjects.push_back(model);
+	}
+
+	// Plane (desk top) drawn last with its own color
+	SceneObject desk = { &planeMesh, woodTexture, glm::vec3(0.46f, 0.36f, 0.25f) };
+	desk.parts.push_back(glm::mat4());
+	desk.isOccluder = true;
+	sceneObjects.push_back(desk);
+
+	// Crowded desk: rows of lapis, chargers and legos behind the main objects
+	vector<SceneObject> crowdObjects;
+	for (int row = 0; row < 4; row++) {
+		for (int column = 0; column < 10; column++) {
+			glm::vec3 position(-4.5f + column, 0.0f, -1.5f - row);
+			switch ((row + column) % 3) {
+			case 0:
+				crowdObjects.push_back(makeLapis(position));
+				break;
+			case 1:
+				crowdObjects.push_back(makeCharger(position));
+				break;
+			default:
+				makeLego(glm::vec3(position.x, -3.0f, position.z), crowdObjects);
+				break;
+			}
+		}
+	}
+
+	// Overdraw stress scene: a dense block of alternating lapis and chargers filling the view in depth
+	vector<SceneObject> stressObjects;
+	for (int row = 0; row < 8; row++) {
+		for (int column = 0; column < 9; column++) {
+			glm::vec3 position(-4.0f + column, 0.0f, 3.0f - row);
+			if ((row + column) % 2 == 0)
+				stressObjects.push_back(makeLapis(position));
+			else
+				stressObjects.push_back(makeCharger(position));
+		}
+	}
+
+	for (vector<SceneObject>* objects : { &sceneObjects, &crowdObjects, &stressObjects }) {
+		for (SceneObject& object : *objects) {
+			computeBounds(object);
+			object.materialLayer = materialLayer(materials, object.texture);
+		}
+	}
+
+	// BUILD SCENE OBJECTS END *******************************************************
+
+	// Per frame camera and scene lights, one std140 block written to the dynamic ring (FrameBlock)
+	string frameBlockShaderSource =
+		"layout(std140) uniform Frame {"
+		"mat4 view;"
+		"mat4 projection;"
+		"vec3 viewPos;"
+		"vec3 lightPos;"
+		"vec3 lightColor;"
+		"vec3 lightPos1;"
+		"vec3 lightColor1;"
+		"};";
+
+	// Attribute decode shared by the scene vertex shaders: with the quantized format the normal
+	// arrives as an octahedral xy and texture coordinates as unorm16 over the arena's UV range
+	string vertexDecodeShaderSource =
+		"uniform bool isOctahedralNormal;"
+		"uniform vec2 uvOffset;"
+		"uniform vec2 uvScale;"
+		"vec3 decodeNormal(vec3 n)\n"
+		"{\n"
+		"if (!isOctahedralNormal) return n;"
+		"vec3 d = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));"
+		"float fold = max(-d.z, 0.0);"
+		"d.xy += vec2(d.x >= 0.0 ? -fold : fold, d.y >= 0.0 ? -fold : fold);"
+		"return normalize(d);"
+		"}\n";
+
+	// Vertex shader source code
+	string vertexShaderSource =
+		"#version 330 core\n"
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec3 aColor;"
+		"layout(location = 2) in vec2 texCoord;"
+		"layout(location = 3) in vec3 normal;"
+		"out vec3 oColor;"
+		"out vec2 oTexCoord;"
+		"out vec3 oNormal;"
+		"out vec3 fragPos;"
+		"uniform mat4 model;"
+		+ frameBlockShaderSource +
+		"invariant gl_Position;"
+		+ vertexDecodeShaderSource +
+		"void main()\n"
+		"{\n"
+		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
+		"oColor = aColor;"
+		"oTexCoord = uvOffset + texCoord * uvScale;"
+		"oNormal = mat3(transpose(inverse(model))) * decodeNormal(normal);"
+		"fragPos = vec3(model * vec4(vPosition, 1.0f));"
+		"}\n";
+
+	// Material lookup shared by the scene fragment shaders: a layer of the material array, or the
+	// bound 2D texture when the layer is negative
+	string materialShaderSource =
+		"uniform sampler2D myTexture;"
+		"uniform sampler2DArray materialTextures;"
+		"uniform float materialLayer;"
+		"vec4 materialColor(vec2 uv)\n"
+		"{\n"
+		"return materialLayer >= 0.0 ? texture(materialTextures, vec3(uv, materialLayer)) : texture(myTexture, uv);"
+		"}\n";
+
+	// The same lookup through the resident handle of the layer's own texture
+	string bindlessMaterialShaderSource =
+		"uniform sampler2D myTexture;"
+		"layout(std430, binding = 5) readonly buffer MaterialHandles { uvec2 materialHandles[]; };"
+		"uniform float materialLayer;"
+		"vec4 materialColor(vec2 uv)\n"
+		"{\n"
+		"return materialLayer >= 0.0 ? texture(sampler2D(materialHandles[int(materialLayer)]), uv) : texture(myTexture, uv);"
+		"}\n";
+
+	// Shadow lookup shared by the forward and deferred lighting shaders (1 lit, 0 in shadow)
+	string shadowShaderSource =
+		"uniform samplerCube shadowMap;"
+		"uniform samplerCube shadowMap1;"
+		"uniform int shadowFilter;"
+		"uniform float shadowFar;"
+		"const vec3 pcfOffsets[20] = vec3[]("
+		"vec3(1, 1, 1), vec3(1, -1, 1), vec3(-1, -1, 1), vec3(-1, 1, 1),"
+		"vec3(1, 1, -1), vec3(1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),"
+		"vec3(1, 1, 0), vec3(1, -1, 0), vec3(-1, -1, 0), vec3(-1, 1, 0),"
+		"vec3(1, 0, 1), vec3(-1, 0, 1), vec3(1, 0, -1), vec3(-1, 0, -1),"
+		"vec3(0, 1, 1), vec3(0, -1, 1), vec3(0, -1, -1), vec3(0, 1, -1));"
+		"float shadowFactor(samplerCube map, vec3 lightPos, vec3 fragPos, vec3 norm)\n"
+		"{\n"
+		"if (shadowFilter == 0) return 1.0f;"
+		"vec3 toFrag = fragPos - lightPos;"
+		"float lightDistance = length(toFrag);"
+		"// Larger bias at grazing angles, where one texel covers the most depth\n"
+		"float bias = (0.03f + 0.1f * (1.0f - abs(dot(norm, toFrag / lightDistance)))) / shadowFar;"
+		"float current = lightDistance / shadowFar - bias;"
+		"if (shadowFilter == 1) return current > texture(map, toFrag).r ? 0.0f : 1.0f;"
+		"float lit = 0.0f;"
+		"float radius = 0.01f * lightDistance;"
+		"for (int i = 0; i < 20; i++)"
+		"lit += current > texture(map, toFrag + pcfOffsets[i] * radius).r ? 0.0f : 1.0f;"
+		"return lit / 20.0f;"
+		"}\n";
+
+	// Fragment shader source code
+	string fragmentShaderSource =
+		"#version 330 core\n"
+		"in vec3 oColor;"
+		"in vec2 oTexCoord;"
+		"in vec3 oNormal;"
+		"in vec3 fragPos;"
+		"out vec4 fragColor;"
+		"uniform vec3 objectColor;"
+		+ materialShaderSource
+		+ frameBlockShaderSource +
+		"layout(std140) uniform PointLights {"
+		"vec4 pointLights[64];" // xyz position, w radius
+		"vec4 pointLightColors[64];"
+		"int pointLightCount;"
+		"};"
+		+ shadowShaderSource +
+		"void main()\n"
+		"{\n"
+		"// Ambient\n"
+		"float ambientStrength = 0.4f;"
+		"float ambientStrength1 = 0.2f;"
+		"vec3 ambient = ambientStrength * lightColor;"
+		"vec3 ambient1 = ambientStrength1 * lightColor1;"
+		"// Diffuse\n"
+		"vec3 norm = normalize(oNormal);"
+		"vec3 lightDir = normalize(lightPos - fragPos);"
+		"vec3 lightDir1 = normalize(lightPos1 - fragPos);"
+		"float diff = max(dot(norm, lightDir), 0.0);"
+		"float diff1 = max(dot(norm, lightDir1), 0.0);"
+		"vec3 diffuse = diff * lightColor;"
+		"vec3 diffuse1 = diff1 * lightColor1;"
+		"// Specular\n"
+		"float specularStrength = 1.5f;"
+		"vec3 viewDir = normalize(viewPos - fragPos);"
+		"vec3 reflectDir = reflect(-lightDir, norm);"
+		"vec3 reflectDir1 = reflect(-lightDir1, norm);"
+		"float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 128);"
+		"float spec1 = pow(max(dot(viewDir, reflectDir1), 0.0f), 128);"
+		"vec3 specular = specularStrength * spec * lightColor;"
+		"vec3 specular1 = specularStrength * spec1 * lightColor1;"
+		"// Point lights\n"
+		"vec3 pointLighting = vec3(0.0f);"
+		"for (int i = 0; i < pointLightCount; i++) {"
+		"vec3 toLight = pointLights[i].xyz - fragPos;"
+		"float attenuation = clamp(1.0f - dot(toLight, toLight) / (pointLights[i].w * pointLights[i].w), 0.0f, 1.0f);"
+		"vec3 pointDir = normalize(toLight);"
+		"float pointSpec = pow(max(dot(viewDir, reflect(-pointDir, norm)), 0.0f), 128);"
+		"pointLighting += (max(dot(norm, pointDir), 0.0f) + specularStrength * pointSpec) * attenuation * attenuation * pointLightColors[i].rgb;"
+		"}"
+		"// Shadows\n"
+		"float shadow = shadowFactor(shadowMap, lightPos, fragPos, norm);"
+		"float shadow1 = shadowFactor(shadowMap1, lightPos1, fragPos, norm);"
+		"vec3 result = (ambient + ambient1 + shadow * (diffuse + specular) + shadow1 * (diffuse1 + specular1) + pointLighting) * objectColor;"
+		"fragColor = materialColor(oTexCoord) * vec4(result, 1.0f);"
+		"}\n";
+
+	// The cube face being rendered, one std140 block per face written to the dynamic ring (ShadowFaceBlock)
+	string shadowFaceBlockShaderSource =
+		"layout(std140) uniform ShadowFace {"
+		"mat4 lightViewProjection;"
+		"vec3 lightPos;"
+		"};";
+
+	// Shadow pass Vertex shader source code (one cube face per draw)
+	string shadowVertexShaderSource =
+		"#version 330 core\n"
+		"layout(location = 0) in vec3 vPosition;"
+		"out vec3 worldPos;"
+		"uniform mat4 model;"
+		+ shadowFaceBlockShaderSource +
+		"void main()\n"
+		"{\n"
+		"vec4 world = model * vec4(vPosition, 1.0f);"
+		"worldPos = world.xyz;"
+		"gl_Position = lightViewProjection * world;"
+		"}\n";
+
+	// Shadow pass Fragment shader source code (linear distance to the light, so every face compares alike)
+	string shadowFragmentShaderSource =
+		"#version 330 core\n"
+		"in vec3 worldPos;"
+		+ shadowFaceBlockShaderSource +
+		"uniform float shadowFar;"
+		"void main()\n"
+		"{\n"
+		"gl_FragDepth = length(worldPos - lightPos) / shadowFar;"
+		"}\n";
+
+	// Deferred geometry pass Fragment shader source code (surface attributes only, no lighting)
+	string gBufferFragmentShaderSource =
+		"#version 330 core\n"
+		"in vec3 oColor;"
+		"in vec2 oTexCoord;"
+		"in vec3 oNormal;"
+		"in vec3 fragPos;"
+		"layout(location = 0) out vec4 gAlbedo;"
+		"layout(location = 1) out vec4 gNormal;"
+		"uniform vec3 objectColor;"
+		+ materialShaderSource +
+		"void main()\n"
+		"{\n"
+		"vec4 albedo = materialColor(oTexCoord);"
+		"gAlbedo = vec4(albedo.rgb * objectColor, albedo.a);"
+		"gNormal = vec4(normalize(oNormal), 0.0f);"
+		"}\n";
+
+	// Deferred light pass Fragment shader source code (same lighting model as the forward shader)
+	string deferredLightFragmentShaderSource =
+		"#version 330 core\n"
+		"out vec4 fragColor;"
+		"uniform sampler2D gAlbedo;"
+		"uniform sampler2D gNormal;"
+		"uniform sampler2D gDepth;"
+		"uniform mat4 inverseViewProjection;"
+		+ frameBlockShaderSource +
+		"uniform bool isPointLight;"
+		"uniform vec4 pointLight;" // xyz position, w radius
+		"uniform vec3 pointLightColor;"
+		+ shadowShaderSource +
+		"void main()\n"
+		"{\n"
+		"ivec2 coord = ivec2(gl_FragCoord.xy);"
+		"float depth = texelFetch(gDepth, coord, 0).r;"
+		"if (depth == 1.0f) discard;" // background keeps the clear color
+		"// World position from depth\n"
+		"vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));"
+		"vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0f - 1.0f, 1.0f);"
+		"vec3 fragPos = world.xyz / world.w;"
+		"vec4 albedo = texelFetch(gAlbedo, coord, 0);"
+		"vec3 norm = normalize(texelFetch(gNormal, coord, 0).xyz);"
+		"vec3 viewDir = normalize(viewPos - fragPos);"
+		"float specularStrength = 1.5f;"
+		"if (isPointLight) {"
+		"vec3 toLight = pointLight.xyz - fragPos;"
+		"float attenuation = clamp(1.0f - dot(toLight, toLight) / (pointLight.w * pointLight.w), 0.0f, 1.0f);"
+		"if (attenuation <= 0.0f) discard;"
+		"vec3 pointDir = normalize(toLight);"
+		"float pointSpec = pow(max(dot(viewDir, reflect(-pointDir, norm)), 0.0f), 128);"
+		"fragColor = vec4(albedo.rgb * (max(dot(norm, pointDir), 0.0f) + specularStrength * pointSpec) * attenuation * attenuation * pointLightColor, 0.0f);"
+		"return;"
+		"}"
+		"vec3 ambient = 0.4f * lightColor + 0.2f * lightColor1;"
+		"vec3 lightDir = normalize(lightPos - fragPos);"
+		"vec3 lightDir1 = normalize(lightPos1 - fragPos);"
+		"float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0f), 128);"
+		"float spec1 = pow(max(dot(viewDir, reflect(-lightDir1, norm)), 0.0f), 128);"
+		"vec3 lit = (max(dot(norm, lightDir), 0.0) + specularStrength * spec) * lightColor * shadowFactor(shadowMap, lightPos, fragPos, norm);"
+		"vec3 lit1 = (max(dot(norm, lightDir1), 0.0) + specularStrength * spec1) * lightColor1 * shadowFactor(shadowMap1, lightPos1, fragPos, norm);"
+		"fragColor = vec4(albedo.rgb * (ambient + lit + lit1), albedo.a);"
+		"}\n";
+
+	// Depth pre-pass Vertex shader source code (same transform as the lighting pass)
+	string depthVertexShaderSource =
+		"#version 330 core\n"
+		"layout(location = 0) in vec3 vPosition;"
+		"uniform mat4 model;"
+		+ frameBlockShaderSource +
+		"invariant gl_Position;"
+		"void main()\n"
+		"{\n"
+		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
+		"}\n";
+
+	// Depth pre-pass Fragment shader source code (depth only, no color output)
+	string depthFragmentShaderSource =
+		"#version 330 core\n"
+		"void main()\n"
+		"{\n"
+		"}\n";
+
+	// LAMP Vertex shader source code
+	string lampVertexShaderSource =
+		"#version 330 core\n"
+		"layout(location = 0) in vec3 vPosition;"
+		"uniform mat4 model;"
+		+ frameBlockShaderSource +
+		"void main()\n"
+		"{\n"
+		"gl_Position = projection * view * model * vec4(vPosition.x, vPosition.y, vPosition.z, 1.0);"
+		"}\n";
+
+	// LAMP Fragment shader source code
+	string lampFragmentShaderSource =
+		"#version 330 core\n"
+		"out vec4 fragColor;"
+		"void main()\n"
+		"{\n"
+		"fragColor = vec4(1.0f);" // Set lamp to white.
+		"}\n";
+
+	// GPU culling Vertex shader source code (model matrix fetched per visible instance)
+	string gpuVertexShaderSource =
+		"#version 430 core\n"
+		"layout(location = 0) in vec3 vPosition;"
+		"layout(location = 1) in vec3 aColor;"
+		"layout(location = 2) in vec2 texCoord;"
+		"layout(location = 3) in vec3 normal;"
+		"layout(location = 4) in uint instanceIndex;"
+		"struct Instance { mat4 model; vec4 boundsMin; vec4 boundsMax; vec4 material; };"
+		"layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };"
+		"out vec3 oColor;"
+		"out vec2 oTexCoord;"
+		"out vec3 oNormal;"
+		"out vec3 fragPos;"
+		"flat out vec3 objectColor;"
+		"flat out float materialLayer;"
+		+ frameBlockShaderSource
+		+ vertexDecodeShaderSource +
+		"void main()\n"
+		"{\n"
+		"mat4 model = instances[instanceIndex].model;"
+		"objectColor = instances[instanceIndex].material.rgb;"
+		"materialLayer = instances[instanceIndex].material.w;"
+		"gl_Position = projection * view * model * vec4(vPosition, 1.0);"
+		"oColor = aColor;"
+		"oTexCoord = uvOffset + texCoord * uvScale;"
+		"oNormal = mat3(transpose(inverse(model))) * decodeNormal(normal);"
+		"fragPos = vec3(model * vec4(vPosition, 1.0f));"
+		"}\n";
+
+	// GPU culling Fragment shader is the forward shader at the same version, with color and layer per instance
+	string gpuFragmentShaderSource = fragmentShaderSource;
+	gpuFragmentShaderSource.replace(0, string("#version 330 core").size(), "#version 430 core");
+	gpuFragmentShaderSource.replace(gpuFragmentShaderSource.find("uniform vec3 objectColor;"), string("uniform vec3 objectColor;").size(), "flat in vec3 objectColor;");
+	gpuFragmentShaderSource.replace(gpuFragmentShaderSource.find("uniform float materialLayer;"), string("uniform float materialLayer;").size(), "flat in float materialLayer;");
+
+	// GPU culling Compute shader source code (frustum test and compaction into indirect commands)
+	string cullComputeShaderSource =
+		"#version 430 core\n"
+		"layout(local_size_x = 64) in;"
+		"struct Instance { mat4 model; vec4 boundsMin; vec4 boundsMax; vec4 material; };"
+		"struct Command { uint count; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };"
+		"layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };"
+		"layout(std430, binding = 1) buffer Commands { Command commands[]; };"
+		"layout(std430, binding = 2) writeonly buffer Visible { uint visibleIndices[]; };"
+		"layout(std430, binding = 3) buffer DebugCommand { uint boxCount; uint culledCount; uint boxFirstIndex; int boxBaseVertex; uint boxBaseInstance; };"
+		"layout(std430, binding = 4) writeonly buffer Culled { uint culledIndices[]; };"
+		"layout(std430, binding = 6) buffer Recheck { uint recheckCount; uint recheckIndices[]; };"
+		"uniform vec4 frustumPlanes[6];"
+		"uniform uint instanceCount;"
+		"uniform uint enabledGroups;"
+		"uniform bool isLatePass;" // re-test the early pass's Hi-Z rejects instead of every instance
+		"uniform bool useHiZ;"
+		"uniform sampler2D hiZ;"
+		"uniform mat4 hiZViewProjection;"
+		"uniform ivec2 hiZSize;"
+		"uniform int hiZLevels;"
+		"// Box is hidden when its nearest depth lies behind the farthest pyramid depth over its screen rectangle\n"
+		"bool isOccludedByHiZ(vec3 boundsMin, vec3 boundsMax)\n"
+		"{\n"
+		"vec2 rectMin = vec2(1.0);"
+		"vec2 rectMax = vec2(0.0);"
+		"float nearest = 1.0;"
+		"for (int c = 0; c < 8; c++) {"
+		"	vec3 corner = vec3((c & 1) != 0 ? boundsMax.x : boundsMin.x, (c & 2) != 0 ? boundsMax.y : boundsMin.y, (c & 4) != 0 ? boundsMax.z : boundsMin.z);"
+		"	vec4 clip = hiZViewProjection * vec4(corner, 1.0);"
+		"	if (clip.w <= 0.0) return false;"
+		"	vec3 ndc = clip.xyz / clip.w;"
+		"	rectMin = min(rectMin, ndc.xy * 0.5 + 0.5);"
+		"	rectMax = max(rectMax, ndc.xy * 0.5 + 0.5);"
+		"	nearest = min(nearest, ndc.z * 0.5 + 0.5);"
+		"}\n"
+		"vec2 pixelMin = clamp(rectMin, 0.0, 1.0) * vec2(hiZSize);"
+		"vec2 pixelMax = clamp(rectMax, 0.0, 1.0) * vec2(hiZSize);"
+		"// Pick the level where the rectangle spans at most two texels per axis\n"
+		"vec2 extent = pixelMax - pixelMin;"
+		"int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiZLevels - 1);"
+		"ivec2 levelSize = textureSize(hiZ, level);"
+		"ivec2 texelMin = min(ivec2(pixelMin) >> level, levelSize - 1);"
+		"ivec2 texelMax = min(ivec2(pixelMax) >> level, levelSize - 1);"
+		"float farthest = 0.0;"
+		"for (int y = texelMin.y; y <= texelMax.y; y++)"
+		"	for (int x = texelMin.x; x <= texelMax.x; x++)"
+		"		farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), level).r);"
+		"return nearest > farthest;"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"uint i = gl_GlobalInvocationID.x;"
+		"if (isLatePass) {"
+		"	if (i >= recheckCount) return;"
+		"	i = recheckIndices[i];"
+		"}\n"
+		"else if (i >= instanceCount) return;"
+		"Instance instance = instances[i];"
+		"if (!isLatePass) {"
+		"	if ((enabledGroups & (1u << uint(instance.boundsMax.w))) == 0u) return;"
+		"	vec3 center = (instance.boundsMin.xyz + instance.boundsMax.xyz) * 0.5;"
+		"	vec3 extent = (instance.boundsMax.xyz - instance.boundsMin.xyz) * 0.5;"
+		"	for (int p = 0; p < 6; p++) {"
+		"		vec4 plane = frustumPlanes[p];"
+		"		if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0) return;"
+		"	}\n"
+		"}\n"
+		"if (useHiZ && isOccludedByHiZ(instance.boundsMin.xyz, instance.boundsMax.xyz)) {"
+		"	if (isLatePass)"
+		"		culledIndices[atomicAdd(culledCount, 1u)] = i;"
+		"	else"
+		"		recheckIndices[atomicAdd(recheckCount, 1u)] = i;"
+		"	return;"
+		"}\n"
+		"uint batch = uint(instance.boundsMin.w);"
+		"uint slot = atomicAdd(commands[batch].instanceCount, 1u);"
+		"visibleIndices[commands[batch].baseInstance + slot] = i;"
+		"}\n";
+
+	// Culled bounds debug Vertex shader source code (unit box stretched over instance bounds)
+	string culledBoundsVertexShaderSource =
+		"#version 430 core\n"
+		"layout(location = 0) in vec3 corner;"
+		"layout(location = 4) in uint instanceIndex;"
+		"struct Instance { mat4 model; vec4 boundsMin; vec4 boundsMax; vec4 material; };"
+		"layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };"
+		+ frameBlockShaderSource +
+		"void main()\n"
+		"{\n"
+		"Instance instance = instances[instanceIndex];"
+		"gl_Position = projection * view * vec4(mix(instance.boundsMin.xyz, instance.boundsMax.xyz, corner), 1.0);"
+		"}\n";
+
+	// Culled bounds debug Fragment shader source code
+	string culledBoundsFragmentShaderSource =
+		"#version 430 core\n"
+		"out vec4 fragColor;"
+		"void main()\n"
+		"{\n"
+		"fragColor = vec4(1.0f, 0.0f, 0.0f, 1.0f);" // Culled objects in red.
+		"}\n";
+
+	// Full screen triangle Vertex shader source code (no vertex buffer needed)
+	string fullScreenVertexShaderSource =
+		"#version 330 core\n"
+		"void main()\n"
+		"{\n"
+		"vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);"
+		"gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);"
+		"}\n";
+
+	// Hi-Z copy Fragment shader source code (scene depth into pyramid level 0)
+	string hiZCopyFragmentShaderSource =
+		"#version 330 core\n"
+		"uniform sampler2D sceneDepth;"
+		"out float depth;"
+		"void main()\n"
+		"{\n"
+		"depth = texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r;"
+		"}\n";
+
+	// Hi-Z downsample Fragment shader source code (max of each 2x2 block, odd edges fold in the extra row/column)
+	string hiZDownsampleFragmentShaderSource =
+		"#version 330 core\n"
+		"uniform sampler2D previousLevel;"
+		"uniform ivec2 previousSize;"
+		"out float depth;"
+		"float fetch(ivec2 coord)\n"
+		"{\n"
+		"return texelFetch(previousLevel, min(coord, previousSize - 1), 0).r;"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"ivec2 coord = ivec2(gl_FragCoord.xy) * 2;"
+		"float farthest = max(max(fetch(coord), fetch(coord + ivec2(1, 0))), max(fetch(coord + ivec2(0, 1)), fetch(coord + ivec2(1, 1))));"
+		"bool extraX = (previousSize.x & 1) != 0 && coord.x + 2 == previousSize.x - 1;"
+		"bool extraY = (previousSize.y & 1) != 0 && coord.y + 2 == previousSize.y - 1;"
+		"if (extraX) farthest = max(farthest, max(fetch(coord + ivec2(2, 0)), fetch(coord + ivec2(2, 1))));"
+		"if (extraY) farthest = max(farthest, max(fetch(coord + ivec2(0, 2)), fetch(coord + ivec2(1, 2))));"
+		"if (extraX && extraY) farthest = max(farthest, fetch(coord + ivec2(2, 2)));"
+		"depth = farthest;"
+		"}\n";
+
+	// Creating Shader Program
+	GLuint shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+	GLuint lampShaderProgram = CreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource);
+	GLuint depthShaderProgram = CreateShaderProgram(depthVertexShaderSource, depthFragmentShaderSource);
+	gBuffer.geometryProgram = CreateShaderProgram(vertexShaderSource, gBufferFragmentShaderSource);
+	gBuffer.lightProgram = CreateShaderProgram(fullScreenVertexShaderSource, deferredLightFragmentShaderSource);
+	glGenVertexArrays(1, &fullScreenVAO);
+	shadowMaps.program = CreateShaderProgram(shadowVertexShaderSource, shadowFragmentShaderSource);
+	createShadowMaps();
+	setShadowSamplerUnits(shaderProgram);
+	setShadowSamplerUnits(gBuffer.lightProgram);
+	setMaterialSamplerUnit(shaderProgram);
+	setMaterialSamplerUnit(gBuffer.geometryProgram);
+	for (GLuint program : { shaderProgram, lampShaderProgram, depthShaderProgram, gBuffer.geometryProgram, gBuffer.lightProgram, shadowMaps.program })
+		setUniformBlockBindings(program);
+
+	// Bindless variants of the forward and G-buffer shaders, used by default where they link and the
+	// driver hands out handles (llvmpipe and older drivers stay on the array)
+	if (GLEW_ARB_bindless_texture && GLEW_VERSION_4_3) {
+		auto makeBindless = [&](string source) {
+			source.replace(0, string("#version 330 core").size(), "#version 430 core\n#extension GL_ARB_bindless_texture : require");
+			source.replace(source.find(materialShaderSource), materialShaderSource.size(), bindlessMaterialShaderSource);
+			return source;
+		};
+		bindless.forwardProgram = CreateShaderProgram(vertexShaderSource, makeBindless(fragmentShaderSource));
+		bindless.geometryProgram = CreateShaderProgram(vertexShaderSource, makeBindless(gBufferFragmentShaderSource));
+		bindless.isSupported = isProgramLinked(bindless.forwardProgram) && isProgramLinked(bindless.geometryProgram)
+			&& makeMaterialsResident(bindless, materials);
+		if (bindless.isSupported) {
+			setShadowSamplerUnits(bindless.forwardProgram);
+			setUniformBlockBindings(bindless.forwardProgram);
+			setUniformBlockBindings(bindless.geometryProgram);
+		}
+	}
+	materialMode = bindless.isSupported ? 2 : 1;
+	cout << "Materials: " << materialModeNames[materialMode] << (bindless.isSupported ? "" : " (ARB_bindless_texture unavailable)") << endl;
+
+	// GPU culling programs and buffers (optional path)
+	if (isGpuCullingSupported) {
+		gpuCulling.drawProgram = CreateShaderProgram(gpuVertexShaderSource, gpuFragmentShaderSource);
+		gpuCulling.cullProgram = CreateComputeProgram(cullComputeShaderSource);
+		gpuCulling.debugProgram = CreateShaderProgram(culledBoundsVertexShaderSource, culledBoundsFragmentShaderSource);
+		buildGpuCulling(sceneObjects, crowdObjects, stressObjects);
+		setShadowSamplerUnits(gpuCulling.drawProgram);
+		setMaterialSamplerUnit(gpuCulling.drawProgram);
+		setUniformBlockBindings(gpuCulling.drawProgram);
+		setUniformBlockBindings(gpuCulling.debugProgram);
+
+		hiZ.copyProgram = CreateShaderProgram(fullScreenVertexShaderSource, hiZCopyFragmentShaderSource);
+		hiZ.downsampleProgram = CreateShaderProgram(fullScreenVertexShaderSource, hiZDownsampleFragmentShaderSource);
+	}
+
+	reportAssetStartup();
+
+	glGenQueries(2, passQueries.samplesPassed);
+	glGenQueries(2, passQueries.lateSamplesPassed);
+	glGenQueries(2, passQueries.timeElapsed);
+
+	// Use Shader Program exe once
+	//glUseProgram(shaderProgram);
+
+	cout << "Scroll to Zoom." << endl;
+	cout << "[L-Alt + LMB] to Orbit." << endl;
+	cout << "[L-Alt + MMB] to Pan." << endl;
+	cout << "[F] to Reset camera." << endl;
+	cout << "[P] to Switch projection." << endl;
+	cout << "[O] to Toggle occlusion culling." << endl;
+	cout << "[C] to Toggle crowded desk." << endl;
+	cout << "[G] to Toggle GPU culling (OpenGL 4.3)." << endl;
+	cout << "[H] to Toggle Hi-Z occlusion in GPU culling." << endl;
+	cout << "[V] to Show Hi-Z culled objects." << endl;
+	cout << "[Z] to Toggle depth pre-pass." << endl;
+	cout << "[X] to Toggle front-to-back sorting." << endl;
+	cout << "[T] to Toggle overdraw stress scene." << endl;
+	cout << "[M] to Toggle deferred shading." << endl;
+	cout << "[=]/[-] to Add/Remove point lights." << endl;
+	cout << "[K] to Cycle shadows (off, hard, PCF)." << endl;
+	cout << "[J] to Toggle shadow map caching." << endl;
+	cout << "[Y] to Toggle light animation." << endl;
+	cout << "[L] to Toggle level of detail." << endl;
+	cout << "[Q] to Toggle quantized vertices (and diff the frames)." << endl;
+	cout << "[N] to Toggle meshlet culling." << endl;
+	cout << "[B] to Cycle materials (separate textures, texture array, bindless)." << endl;
+	cout << "[[] and []] to Halve or Double the streamed texture budget." << endl;
+
+	// The render thread owns the context from here on; this thread keeps the window's events, the
+	// camera and the light animation, and hands each frame over as a snapshot
+	glfwMakeContextCurrent(NULL);
+	sceneSettings = captureRenderSettings();
+	sceneSnapshots.ready = 0;
+	sceneSnapshots.quit = false;
+	publishSnapshot(window, glfwGetTime());
+
+	thread renderThread([&]() {
+		glfwMakeContextCurrent(window);
+
+		GLfloat lastStatsTime = 0.0f;
+		int deferredLightsShaded = 0;
+
+		while (!sceneSnapshots.quit.load())
+		{
+
+			// Take the newest snapshot and wake the main thread to simulate the next one, or draw the last
+			// one again if the main thread has not published since
+			if (acquireSnapshot())
+				glfwPostEmptyEvent();
+			else
+				sceneSnapshots.framesRepeated++;
+			const SceneSnapshot& scene = sceneSnapshots.slots[sceneSnapshots.reading];
+			applyRenderSettings(scene.settings);
+
+			// Resize window and graphics simultaneously
+			width = scene.width;
+			height = scene.height;
+
+			// Reclaim the oldest segment of the dynamic ring for this frame's uploads
+			beginDynamicFrame();
+
+			// This frame's object lists and draw items live in the frame arena, sized for every object
+			beginFrameArena();
+			size_t objectCount = sceneObjects.size() + crowdObjects.size() + stressObjects.size();
+			FrameVector<SceneObject*> frameObjects, visibleObjects, shadowCasters;
+			FrameVector<DrawItem> drawItems;
+			frameObjects.reserve(objectCount);
+			visibleObjects.reserve(objectCount);
+			shadowCasters.reserve(objectCount);
+
+			// Stats are printed once per second
+			bool isStatsFrame = scene.time - lastStatsTime >= 1.0f;
+			if (isStatsFrame)
+				lastStatsTime = scene.time;
+
+			// SHADOW MAPS *****************************
+
+			if (shadowFilter != 0) {
+				for (SceneObject& object : sceneObjects)
+					shadowCasters.push_back(&object);
+				if (isCrowdedDesk) {
+					for (SceneObject& object : crowdObjects)
+						shadowCasters.push_back(&object);
+				}
+				if (isStressScene) {
+					for (SceneObject& object : stressObjects)
+						shadowCasters.push_back(&object);
+				}
+
+				updateShadowMaps(shadowCasters, scene.lightPositions);
+				glViewport(0, 0, width, height);
+			}
+
+
+			// GPU culling frames, optionally rendered offscreen so a Hi-Z pyramid can be built from the depth
+			bool isGpuFrame = isGpuCulling && isGpuCullingSupported;
+			bool isHiZFrame = isGpuFrame && isHiZCulling;
+			if (isHiZFrame) {
+				resizeHiZ(width, height);
+				glBindFramebuffer(GL_FRAMEBUFFER, hiZ.sceneFramebuffer);
+			}
+			else {
+				hiZ.isValid = false;
+			}
+
+			// Deferred frames render the scene into the G-buffer (the GPU culled path always shades forward)
+			bool isDeferredFrame = isDeferred && !isGpuFrame;
+
+			/* Render here */
+			if (isDeferredFrame) {
+				resizeGBuffer(width, height);
+				beginGeometryPass();
+			}
+			else {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			}
+
+			// Declare identity matrix
+			glm::mat4 modelMatrix;
+			glm::mat4 projectionMatrix;
+
+		
+			// Initialize transforms
+			viewMatrix = scene.viewMatrix;
+
+			// specify projection
+			// fov, width, height, nearplane, farplane
+		
+
+			if (isPerspective) {
+				// specify projection
+				//glViewport(0, 0, width, height);
+				// fov, width, height, nearplane, farplane
+				projectionMatrix = glm::perspective(scene.fov, (GLfloat)width / (GLfloat)height, 0.1f, 100.0f);
+				//cout << "perspective" << endl;
+
+			}
+			else {
+				// specify projection
+				//glOrtho(0, width, height, 0, 0.1, 50.0);
+				// left, right, bottom, top, near, far
+				projectionMatrix = glm::ortho(-9.0f, 9.0f, -9.0f, 9.0f, 0.1f, 100.0f);
+				//cout << "ortho" << endl;
+			}
+
+			// Camera and light colors and positions for every shader that draws the scene this frame
+			const glm::vec3 lightColors[2] = { glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 0.0f) };
+			setFrameUniforms(viewMatrix, projectionMatrix, scene.cameraPosition, scene.lightPositions, lightColors);
+
+			// GPU path culls and builds its own draw commands before the scene shader runs
+			bool isLateCullPass = false;
+			if (isGpuFrame) {
+				GLuint enabledGroups = 1u | (isCrowdedDesk ? 2u : 0u) | (isStressScene ? 4u : 0u);
+				isLateCullPass = cullInstancesOnGpu(projectionMatrix * viewMatrix, enabledGroups, isHiZCulling);
+			}
+
+			GLuint sceneProgram = isGpuFrame ? gpuCulling.drawProgram : (isDeferredFrame ? gBuffer.geometryProgram : shaderProgram);
+			if (materialMode == 2 && !isGpuFrame)
+				sceneProgram = isDeferredFrame ? bindless.geometryProgram : bindless.forwardProgram;
+
+			// Use Shader Program exe and select VAO before drawing 
+			glUseProgram(sceneProgram); // Call Shader per-frame when updating attributes
+			setVertexDecode(sceneProgram, proceduralArena, isArenaQuantized);
+
+			// Select shader and uniform variable
+			GLuint modelLoc = glGetUniformLocation(sceneProgram, "model");
+
+			// Get object color location
+			GLint objectColorLoc = glGetUniformLocation(sceneProgram, "objectColor");
+
+			// Forward shaders loop over the point lights, the deferred path shades them per light
+			if (!isDeferredFrame) {
+				setForwardPointLights();
+				bindShadowMaps(sceneProgram);
+			}
+
+			// SCENE OBJECTS (GPU CULLED) *****************************
+
+			if (isGpuFrame) {
+				beginPassTimer();
+				beginSampleCount();
+				drawGpuBatches(gpuCulling.commandBuffer);
+				endSampleCount();
+
+				// Reduce the early draws' depth and draw what last frame's pyramid hid but this one does not
+				if (isLateCullPass) {
+					buildHiZ(projectionMatrix * viewMatrix);
+					glBindFramebuffer(GL_FRAMEBUFFER, hiZ.sceneFramebuffer);
+					cullLateInstancesOnGpu();
+					glUseProgram(sceneProgram);
+					beginLateSampleCount();
+					drawGpuBatches(gpuCulling.lateCommandBuffer);
+					endSampleCount();
+				}
+				endPassTimer();
+				collectPassQueries();
+			}
+
+			// Gather this frame's objects (the GPU path never touches them on the CPU)
+			if (!isGpuFrame) {
+				for (SceneObject& object : sceneObjects)
+					frameObjects.push_back(&object);
+				if (isCrowdedDesk) {
+					for (SceneObject& object : crowdObjects)
+						frameObjects.push_back(&object);
+				}
+				if (isStressScene) {
+					for (SceneObject& object : stressObjects)
+						frameObjects.push_back(&object);
+				}
+			}
+
+			// Drop objects hidden behind occluders before any draw is submitted
+			if (isGpuFrame) {
+				visibleObjects.clear();
+			}
+			else if (isOcclusionCulling) {
+				cullOccludedObjects(frameObjects, projectionMatrix * viewMatrix, visibleObjects);
+			}
+			else {
+				visibleObjects = frameObjects;
+			}
+
+			// SCENE OBJECTS *****************************
+
+			if (!isGpuFrame) {
+				buildDrawList(visibleObjects, viewMatrix, projectionMatrix, height, isFrontToBack, drawItems);
+
+				beginPassTimer();
+
+				// Depth pre-pass: lay down depth only, so the lighting shader runs once per pixel
+				if (isDepthPrepass) {
+					glUseProgram(depthShaderProgram);
+
+					glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+					drawItemList(drawItems, glGetUniformLocation(depthShaderProgram, "model"), -1, -1, true);
+					glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+					// Lighting pass only shades the fragments that won the depth test
+					glDepthFunc(GL_LEQUAL);
+					glDepthMask(GL_FALSE);
+					glUseProgram(sceneProgram);
+				}
+
+				beginSampleCount();
+				materialStats = MaterialStats();
+				drawItemList(drawItems, modelLoc, objectColorLoc, glGetUniformLocation(sceneProgram, "materialLayer"), false);
+				endSampleCount();
+
+				if (isDepthPrepass) {
+					glDepthFunc(GL_LESS);
+					glDepthMask(GL_TRUE);
+				}
+
+				// Deferred lighting reads the G-buffer once per light instead of once per drawn fragment
+				if (isDeferredFrame) {
+					deferredLightsShaded = shadeDeferredLights(projectionMatrix * viewMatrix);
+				}
+
+				endPassTimer();
+				collectPassQueries();
+			}
+
+			// Swap in streamed material levels and request finer ones for what was just drawn
+			updateTextureStreaming();
+
+			// Report occlusion rate and CPU cost once per second
+			if (isOcclusionCulling && !isGpuFrame && isStatsFrame) {
+				cout << "Occlusion: " << occlusionStats.objectsOccluded << "/" << occlusionStats.objectsTested << " objects occluded ("
+					<< 100.0f * occlusionStats.objectsOccluded / max(1, occlusionStats.objectsTested) << "%), "
+					<< occlusionStats.objectsOutside << " off screen, "
+					<< occlusionStats.occluderTriangles << " occluder tris, CPU "
+					<< occlusionStats.rasterMs + occlusionStats.testMs << " ms (raster "
+					<< occlusionStats.rasterMs << " ms, test " << occlusionStats.testMs << " ms)" << endl;
+			}
+
+			// Report how many fragments the lighting shader ran for and the GPU time of the scene passes
+			if ((isDepthPrepass || isStressScene) && !isGpuFrame && isStatsFrame) {
+				cout << "Scene pass: depth pre-pass " << (isDepthPrepass ? "on" : "off")
+					<< ", front-to-back " << (isFrontToBack ? "on" : "off")
+					<< ", lighting shaded " << (double)passQueries.lastSamples / max(1, width * height) << "x screen ("
+					<< passQueries.lastSamples << " samples), GPU "
+					<< passQueries.lastNanoseconds / 1.0e6 << " ms" << endl;
+			}
+
+			// Report triangles saved by level of detail selection and how often parts switched level
+			if (!isGpuFrame && isStatsFrame) {
+				cout << "LOD: " << (isLod ? "on" : "off") << ", " << lodStats.trianglesDrawn << "/" << lodStats.trianglesFinest
+					<< " triangles (" << 100.0 * (lodStats.trianglesFinest - lodStats.trianglesDrawn) / max(1LL, lodStats.trianglesFinest)
+					<< "% saved), parts per level";
+				for (int level = 0; level < maxLodLevels; level++)
+					cout << (level ? "/" : " ") << lodStats.partsPerLevel[level];
+				cout << ", " << lodStats.switches << " switches" << endl;
+				lodStats.switches = 0;
+
+				cout << "Meshlets: " << (isMeshletCulling ? "on" : "off") << ", " << meshletStats.tested - meshletStats.frustumCulled - meshletStats.backfaceCulled
+					<< "/" << meshletStats.tested << " clusters drawn (" << meshletStats.frustumCulled << " outside frustum, "
+					<< meshletStats.backfaceCulled << " back facing), " << meshletStats.trianglesCulled << "/" << meshletStats.trianglesTested
+					<< " triangles culled" << endl;
+
+				cout << "Materials: " << materialModeNames[materialMode];
+				if (materialMode == 1)
+					cout << " (" << materials.textures.size() << " layers of " << materials.layerSize << "x" << materials.layerSize << ")";
+				if (materialMode == 2)
+					cout << " (" << bindless.handles.size() << " resident)";
+				cout << ", " << drawItems.size() << " draws, "
+					<< materialStats.textureBinds << " texture binds, " << materialStats.layerChanges << " layer changes" << endl;
+			}
+
+			// Report streamed texture memory against the budget and how many textures are as sharp as drawn
+			if (isStatsFrame) {
+				size_t fullBytes = 0;
+				int loading = 0;
+				for (size_t i = 0; i < textureStreamer.textures.size(); i++) {
+					fullBytes += mipChainBytes(materials.headers[i], 0);
+					if (textureStreamer.textures[i].targetLevel != textureStreamer.textures[i].residentLevel)
+						loading++;
+				}
+				cout << "Texture streaming: " << residentTextureBytes() / 1048576.0 << "/" << textureStreamer.budgetBytes / 1048576.0
+					<< " MB resident (" << fullBytes / 1048576.0 << " MB fully loaded), levels";
+				for (size_t i = 0; i < textureStreamer.textures.size(); i++)
+					cout << (i ? "/" : " ") << textureStreamer.textures[i].residentLevel;
+				cout << ", " << loading << " loading, " << textureStreamer.uploads << " uploads, " << textureStreamer.evictions << " evictions" << endl;
+				textureStreamer.uploads = 0;
+				textureStreamer.evictions = 0;
+			}
+
+			// Report the dynamic ring's busiest frame and how often the CPU had to wait for the GPU
+			if (isStatsFrame) {
+				cout << "Dynamic ring: " << (dynamicRing.isPersistent ? "persistent mapped" : "glBufferSubData") << ", " << dynamicSegmentCount
+					<< " x " << dynamicRing.segmentSize / 1024 << " KB, peak " << dynamicRing.frameBytes << " bytes/frame, "
+					<< dynamicRing.fenceWaits << " fence waits, " << dynamicRing.overflows << " overflows" << endl;
+				dynamicRing.frameBytes = 0;
+				dynamicRing.fenceWaits = 0;
+				dynamicRing.overflows = 0;
+			}
+
+			// Report the frame arena's busiest frame and the heap allocations the last whole frame still made
+			if (isStatsFrame) {
+				cout << "Frame arena: 2 x " << frameArenas.arenas[frameArenas.frame & 1].memory.size() / 1024 << " KB, peak "
+					<< frameArenas.peakBytes << " bytes/frame, " << frameArenas.overflows << " overflows, "
+					<< frameArenas.frameHeapAllocations << " heap allocations last frame" << endl;
+				frameArenas.peakBytes = 0;
+				frameArenas.overflows = 0;
+			}
+
+			// Report how much the job system ran since the last print and how much of it was stolen
+			if (isStatsFrame) {
+				long long jobsRun = jobSystem.jobsRun.exchange(0);
+				long long jobsStolen = jobSystem.jobsStolen.exchange(0);
+				cout << "Jobs: " << jobSystem.threads.size() + 1 << " threads, " << jobsRun << " jobs run, " << jobsStolen << " stolen ("
+					<< 100.0 * jobsStolen / max(jobsRun, 1LL) << "%)" << endl;
+			}
+
+			// Report how often the render thread had no newer snapshot and how old the presented ones were
+			if (isStatsFrame) {
+				cout << "Render thread: " << sceneSnapshots.framesRendered << " frames, " << sceneSnapshots.framesRepeated
+					<< " repeated a snapshot, snapshot " << sceneSnapshots.ageMs / max(sceneSnapshots.framesRendered, 1)
+					<< " ms old at present, simulation at frame " << scene.frame << endl;
+				sceneSnapshots.framesRendered = 0;
+				sceneSnapshots.framesRepeated = 0;
+				sceneSnapshots.ageMs = 0.0;
+			}
+
+			// Report shading mode and GPU cost of the scene passes with point lights
+			if ((isDeferredFrame || !pointLights.empty()) && !isGpuFrame && isStatsFrame) {
+				cout << "Shading: " << (isDeferredFrame ? "deferred" : "forward")
+					<< ", " << pointLights.size() << " point lights";
+				if (isDeferredFrame)
+					cout << " (" << deferredLightsShaded << " light volumes on screen)";
+				cout << ", GPU " << passQueries.lastNanoseconds / 1.0e6 << " ms" << endl;
+			}
+
+			// Report how many shadow faces were re-rendered and what the shadow pass cost
+			if (shadowFilter != 0 && isStatsFrame) {
+				cout << "Shadows: " << (shadowFilter == 1 ? "hard" : "PCF") << ", caching " << (isShadowCaching ? "on" : "off")
+					<< ", " << shadowMaps.facesRendered << "/" << shadowMaps.facesConsidered << " cube faces rendered, CPU "
+					<< shadowMaps.cpuMs << " ms/s, GPU " << shadowMaps.lastNanoseconds / 1.0e6 << " ms last frame" << endl;
+				shadowMaps.facesRendered = 0;
+				shadowMaps.facesConsidered = 0;
+				shadowMaps.cpuMs = 0.0;
+			}
+
+			// Unbind Shader
+			glUseProgram(0); // Incase different shader will be used after
+
+
+			// LAMP *************
+
+			glUseProgram(lampShaderProgram);
+
+			// Get model matrix's uniform location
+			GLint lampModelLoc = glGetUniformLocation(lampShaderProgram, "model");
+
+			glBindVertexArray(lampMesh.vao);
+
+			// One strip box per lamp, centered on the light
+			for (const glm::vec3& position : scene.lightPositions)
+			{
+				glm::mat4 modelMatrix;
+				modelMatrix = glm::translate(modelMatrix, position);
+				modelMatrix = glm::scale(modelMatrix, glm::vec3(.125f, .125f, .125f));
+				modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, -0.5f, 0.0f));
+				glUniformMatrix4fv(lampModelLoc, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+				// Draw primitive(s)
+				drawMesh(lampMesh);
+			}
+
+			glBindVertexArray(0); //Incase different VAO will be used after
+
+			glUseProgram(0); // Incase different shader will be used after
+
+			// Show culled objects, reduce this frame's depth into the pyramid and present the offscreen image
+			if (isHiZFrame) {
+				if (isShowingCulled)
+					drawCulledBounds();
+				buildHiZ(projectionMatrix * viewMatrix);
+				blitSceneToScreen();
+			}
+
+			// Present the lit G-buffer image (lamps were drawn into it with the scene depth)
+			if (isDeferredFrame)
+				blitGBufferToScreen();
+
+			// Report overdraw of the GPU culled scene pass once per second
+			if (isGpuFrame && isStatsFrame) {
+				cout << "GPU culling: Hi-Z " << (isHiZCulling ? "on" : "off")
+					<< ", overdraw " << (double)passQueries.lastSamples / max(1, width * height) << "x ("
+					<< passQueries.lastSamples << " samples passed), scene pass "
+					<< passQueries.lastNanoseconds / 1.0e6 << " ms, "
+					<< (isHiZCulling ? readHiZCulledCount() : 0) << " instances occluded ("
+					<< (isHiZCulling ? readHiZRecheckCount() : 0) << " re-tested in the late pass), " << gpuCulling.batches.size()
+					<< " indirect draws for " << gpuCulling.instanceCount << " instances" << endl;
+			}
+
+			// Switch vertex formats after this frame, keeping it as the reference the next frame is diffed against
+			if (vertexFormatDiff.isComparing) {
+				reportVertexFormatDiff(width, height, isArenaQuantized);
+				vertexFormatDiff.isComparing = false;
+			}
+			if (isQuantizedVertices != isArenaQuantized) {
+				readFramePixels(width, height, vertexFormatDiff.reference);
+				isArenaQuantized = isQuantizedVertices;
+				setMeshHeapFormat(isArenaQuantized);
+				vertexFormatDiff.isComparing = true;
+			}
+
+			endDynamicFrame();
+
+			/* Swap front and back buffers */
+			glfwSwapBuffers(window);
+			sceneSnapshots.framesRendered++;
+			sceneSnapshots.ageMs += (glfwGetTime() - scene.time) * 1000.0;
+		}
+
+		//Clear GPU resources
+		destroyMeshHeap();
+		for (GLuint64 handle : bindless.handles)
+			glMakeTextureHandleNonResidentARB(handle);
+
+		destroyDynamicRing();
+		glfwMakeContextCurrent(NULL);
+	});
+
+	GLfloat lightOrbitAngle = atan2(lightPosition1.x, lightPosition1.z);
+	GLfloat lightOrbitRadius = glm::length(glm::vec2(lightPosition1.x, lightPosition1.z));
+
+	/* Loop until the user closes the window */
+	while (!glfwWindowShouldClose(window))
+	{
+		// Wait for the render thread to take the last snapshot, handling events meanwhile
+		while (isSnapshotPending() && !glfwWindowShouldClose(window))
+			glfwWaitEvents();
+
+		/* Poll for and process events */
+		glfwPollEvents();
+
+		// Poll camera transformations
+		TransformCamera();
+
+		// set delta time
+		GLfloat currentFrame = glfwGetTime();
+		deltaTime = currentFrame - lastFrame;
+		lastFrame = currentFrame;
+
+		// Orbit the second light around the desk, which invalidates its cached shadow faces
+		if (isAnimatingLight) {
+			lightOrbitAngle += deltaTime * 0.5f;
+			lightPosition1.x = lightOrbitRadius * sin(lightOrbitAngle);
+			lightPosition1.z = lightOrbitRadius * cos(lightOrbitAngle);
+		}
+
+		// Simulated frame N+1 goes out while the render thread is still drawing frame N
+		publishSnapshot(window, currentFrame);
+	}
+
+	sceneSnapshots.quit = true;
+	renderThread.join();
+
+	stopTextureStreaming();
+	stopJobWorkers();
+
+	glfwTerminate();
+	return 0;
+}
+
+// Define Input Callback funtions
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	// Display ASCII Keycode
+	//cout << "ASCII: " << key << endl;
+
+	if (action == GLFW_PRESS) {
+		keys[key] = true;
+	}
+	else if (action == GLFW_RELEASE) {
+		keys[key] = false;
+	}
+
+	// Switch between orthographic and perspective view
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_P) {
+		sceneSettings.isPerspective = !sceneSettings.isPerspective;
+	}
+
+	// Toggle occlusion culling and the crowded desk scene
+	if (action == GLFW_PRESS && key == GLFW_KEY_O) {
+		sceneSettings.isOcclusionCulling = !sceneSettings.isOcclusionCulling;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_C) {
+		sceneSettings.isCrowdedDesk = !sceneSettings.isCrowdedDesk;
+	}
+
+	// Toggle GPU culling with indirect draws
+	if (action == GLFW_PRESS && key == GLFW_KEY_G) {
+		sceneSettings.isGpuCulling = !sceneSettings.isGpuCulling;
+	}
+
+	// Toggle Hi-Z occlusion and the culled object view
+	if (action == GLFW_PRESS && key == GLFW_KEY_H) {
+		sceneSettings.isHiZCulling = !sceneSettings.isHiZCulling;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_V) {
+		sceneSettings.isShowingCulled = !sceneSettings.isShowingCulled;
+	}
+
+	// Toggle depth pre-pass, front-to-back sorting and the stress scene
+	if (action == GLFW_PRESS && key == GLFW_KEY_Z) {
+		sceneSettings.isDepthPrepass = !sceneSettings.isDepthPrepass;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_X) {
+		sceneSettings.isFrontToBack = !sceneSettings.isFrontToBack;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_T) {
+		sceneSettings.isStressScene = !sceneSettings.isStressScene;
+	}
+
+	// Toggle deferred shading and change the number of point lights
+	if (action == GLFW_PRESS && key == GLFW_KEY_M) {
+		sceneSettings.isDeferred = !sceneSettings.isDeferred;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_EQUAL) {
+		sceneSettings.pointLightCount = min(sceneSettings.pointLightCount + 8, maxPointLights);
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_MINUS) {
+		sceneSettings.pointLightCount = max(sceneSettings.pointLightCount - 8, 0);
+	}
+
+	// Cycle shadow filtering, toggle shadow caching and the moving light
+	if (action == GLFW_PRESS && key == GLFW_KEY_K) {
+		sceneSettings.shadowFilter = (sceneSettings.shadowFilter + 1) % 3;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_J) {
+		sceneSettings.isShadowCaching = !sceneSettings.isShadowCaching;
+	}
+
+	if (action == GLFW_PRESS && key == GLFW_KEY_Y) {
+		isAnimatingLight = !isAnimatingLight;
+	}
+
+	// Toggle level of detail selection
+	if (action == GLFW_PRESS && key == GLFW_KEY_L) {
+		sceneSettings.isLod = !sceneSettings.isLod;
+	}
+
+	// Toggle the quantized vertex format
+	if (action == GLFW_PRESS && key == GLFW_KEY_Q) {
+		sceneSettings.isQuantizedVertices = !sceneSettings.isQuantizedVertices;
+	}
+
+	// Toggle cluster culling of the large meshes
+	if (action == GLFW_PRESS && key == GLFW_KEY_N) {
+		sceneSettings.isMeshletCulling = !sceneSettings.isMeshletCulling;
+	}
+
+	// Resize the streamed texture budget
+	if (action == GLFW_PRESS && (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET)) {
+		size_t& budgetBytes = sceneSettings.textureBudgetBytes;
+		budgetBytes = key == GLFW_KEY_LEFT_BRACKET ? budgetBytes / 2 : max(budgetBytes * 2, (size_t)1 << 16);
+		cout << "Texture budget: " << budgetBytes / 1048576.0 << " MB" << endl;
+	}
+
+	// Cycle how materials are bound, skipping bindless where it is unsupported
+	if (action == GLFW_PRESS && key == GLFW_KEY_B) {
+		sceneSettings.materialMode = (sceneSettings.materialMode + 1) % (bindless.isSupported ? 3 : 2);
+	}
+
+
+}
+
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	// Display scroll offset value
+	/*
+	if (yoffset > 0) {
+		cout << "Scroll up: ";
+	}
+	else if (yoffset < 0) {
+		cout << "Scroll down: ";
+	}
+
+	cout << yoffset << endl;
+	*/
+
+	// Clamp FOV
+	if (fov >= 1.5f && fov <= 45.0f) {
+		fov -= yoffset * 0.01f;
+	}
+
+	//Default FOV
+	if (fov < 1.5f) {
+		fov = 1.5f;
+	}
+	if (fov > 45.0f) {
+		fov = 45.0f;
+	}
+
+}
+
+void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	// Display Mouse Position
+	//cout << "Mouse pos [" << xpos << ", " << ypos << "]" << endl;
+
+	if (firstMouseMove) { // Getting initial mouse position
+		lastX = xpos;
+		lastY = ypos;
+		firstMouseMove = false;
+	}
+
+	// Calculate cursor offset
+	xChange = xpos - lastX;
+	yChange = lastY - ypos; // inverted controls for y
+
+	lastX = xpos;
+	lastY = ypos;
+
+
+	if (isPanning) {
+
+		if (cameraPosition.z < 0.0f) {
+			cameraFront.z = 6.0f;
+		}
+		else {
+			cameraFront.z = -1.0f;
+		}
+
+		// Pan camera X
+		GLfloat cameraSpeed = xChange * deltaTime;
+		cameraPosition += cameraSpeed * cameraRight;
+
+		// Pan camera Y
+		cameraSpeed = yChange * deltaTime;
+		cameraPosition += cameraSpeed * cameraUp;
+	}
+
+	// Orbit camera
+	if (isOrbiting) {
+		rawYaw += xChange;
+		rawPtich += yChange;
+
+		// Convert Yaw and Pitch to degrees
+		degYaw = glm::radians(rawYaw);
+		degPitch = glm::radians(rawPtich);
+
+		// Azimuth Altitude formula
+		cameraPosition.x = target.x + radius * cosf(degPitch) * sinf(degYaw);
+		cameraPosition.y = target.y + radius * sinf(degPitch);
+		cameraPosition.z = target.z + radius * cosf(degPitch) * cosf(degYaw);
+	}
+
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	/*
+	// Display mouse button clicks
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+		cout << "LMB clicked" << endl;
+	}
+	if (button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_PRESS) {
+		cout << "MMB clicked" << endl;
+	}
+	if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+		cout << "RMB clicked" << endl;
+	}
+	*/
+
+	if (action == GLFW_PRESS) {
+		mouseButtons[button] = true;
+	}
+	else if (action == GLFW_RELEASE) {
+		mouseButtons[button] = false;
+	}
+}
+
+// Define getTarget function
+glm::vec3 getTarget() {
+
+	if (isPanning) {
+		target = cameraPosition + cameraFront;
+	}
+
+	return target;
+}
+
+// Define TransformCamera function
+void TransformCamera() {
+
+	// Pan Camera
+	if (keys[GLFW_KEY_LEFT_ALT] && mouseButtons[GLFW_MOUSE_BUTTON_MIDDLE]) {
+		isPanning = true;
+	}
+	else {
+		isPanning = false;
+	}
+
+	// Orbit Camera
+	if (keys[GLFW_KEY_LEFT_ALT] && mouseButtons[GLFW_MOUSE_BUTTON_LEFT]) {
+		isOrbiting = true;
+	}
+	else {
+		isOrbiting = false;
+	}
+
+	// Reset/init camera
+	if (keys[GLFW_KEY_F]) {
+		initCamera();
+	}
+
+}
+
+void initCamera() {
+	cameraPosition = glm::vec3(0.0f, 1.25f, 6.0f);
+	target = glm::vec3(0.0f, 0.0f, 0.0f);
+	cameraDirection = glm::normalize(cameraPosition - target);
+	worldUp = glm::vec3(0.0f, 1.0f, 0.0f);
+	cameraRight = glm::normalize(glm::cross(worldUp, cameraDirection));
+	cameraUp = glm::normalize(glm::cross(cameraDirection, cameraRight));
+	cameraFront = glm::normalize(glm::vec3(0.0f, 0.0f, -1.0f));
+	firstMouseMove = true;
+	fov = 45.0f;
 }
\ No newline at end of file